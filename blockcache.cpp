@@ -0,0 +1,303 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Cache of decoded BK blocks, so that looking at the same part of an archive
+ * again does not mean unpacking its words again.
+ *
+ * Slots are found by block index through a chained hash table and kept in a
+ * doubly linked list in order of use, so that a lookup, a hit and an eviction
+ * each take constant time. Everything is allocated when the cache is made.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "gbytes.cpp"
+#include "cdc.hpp"
+#include "tbm.hpp"
+#include "blockcache.hpp"
+
+#define NO_SLOT ((size_t) -1)
+
+/* Bits in a BK block. */
+#define BLOCK_BITS ((size_t) BK_BLOCK_SIZE_CDC_WORDS*60)
+
+static size_t get_block(BlockCache *const cache, const size_t block);
+static void decode_block(BlockCache *const cache, const size_t slot,
+                         const size_t block);
+static void unlink_slot(BlockCache *const cache, const size_t slot);
+static void push_slot(BlockCache *const cache, const size_t slot);
+
+/**
+ * Makes a cache of the blocks of the archive in `buf'.
+ *
+ * @param cache
+ * @param buf The archive, which must stay valid while the cache is used.
+ * @param len Size of the archive in bytes.
+ * @param budget How much memory the cache may use, in bytes. The cache holds
+ *        at least one block, and never more than the archive has.
+ * @return TBM_OK or TBM_ERR_NOMEM.
+ */
+int block_cache_init(BlockCache *const cache, uint8_t const*const buf,
+                     const size_t len, const size_t budget)
+{
+	size_t i;
+
+	memset(cache, 0, sizeof(BlockCache));
+	cache->buf = buf;
+	cache->len = len;
+	cache->numSlots = budget/BLOCK_CACHE_SLOT_SIZE;
+	if (cache->numSlots > DIV_CEIL(len, BK_BLOCK_SIZE_BYTES)) {
+		cache->numSlots = DIV_CEIL(len, BK_BLOCK_SIZE_BYTES);
+	}
+	if (cache->numSlots < 1) {
+		cache->numSlots = 1;
+	}
+	cache->numBuckets = cache->numSlots*2;
+	cache->head = cache->tail = NO_SLOT;
+
+	cache->words = (uint64_t (*)[BK_BLOCK_SIZE_CDC_WORDS])
+		malloc(sizeof(*cache->words)*cache->numSlots);
+	cache->text = (char (*)[BLOCK_CACHE_TEXT_LEN])
+		malloc(sizeof(*cache->text)*cache->numSlots);
+	cache->block = (size_t*) malloc(sizeof(size_t)*cache->numSlots);
+	cache->prev = (size_t*) malloc(sizeof(size_t)*cache->numSlots);
+	cache->next = (size_t*) malloc(sizeof(size_t)*cache->numSlots);
+	cache->chain = (size_t*) malloc(sizeof(size_t)*cache->numSlots);
+	cache->buckets = (size_t*) malloc(sizeof(size_t)*cache->numBuckets);
+	if (!cache->words || !cache->text || !cache->block || !cache->prev ||
+	    !cache->next || !cache->chain || !cache->buckets)
+	{
+		block_cache_free(cache);
+		return TBM_ERR_NOMEM;
+	}
+
+	for (i = 0; i < cache->numBuckets; i++) {
+		cache->buckets[i] = NO_SLOT;
+	}
+
+	return TBM_OK;
+}
+
+void block_cache_free(BlockCache *const cache)
+{
+	free(cache->words);
+	free(cache->text);
+	free(cache->block);
+	free(cache->prev);
+	free(cache->next);
+	free(cache->chain);
+	free(cache->buckets);
+	memset(cache, 0, sizeof(BlockCache));
+}
+
+/**
+ * Gets 60-bit words of the archive. Words which start on a word boundary
+ * come from the cache; others are unpacked directly.
+ *
+ * @param cache
+ * @param offset Bit offset of the first word in the archive.
+ * @param words Receives the words. Words past the end of the archive are 0.
+ * @param numWords
+ * @return The number of words which are within the archive.
+ */
+size_t block_cache_words(BlockCache *const cache, const size_t offset,
+                         uint64_t *const words, const size_t numWords)
+{
+	size_t avail, n, i, slot;
+
+	avail = offset < cache->len*8 ? (cache->len*8 - offset)/60 : 0;
+	if (avail > numWords) {
+		avail = numWords;
+	}
+
+	if (offset % 60) {
+		gbytes<uint8_t,uint64_t>(cache->buf+(offset/8), words, offset%8, 60,
+		                         0, avail);
+		memset(words+avail, 0, sizeof(uint64_t)*(numWords-avail));
+		return avail;
+	}
+
+	for (i = 0; i < numWords; i += n) {
+		n = BK_BLOCK_SIZE_CDC_WORDS - (offset/60+i) % BK_BLOCK_SIZE_CDC_WORDS;
+		if (n > numWords-i) {
+			n = numWords-i;
+		}
+		slot = get_block(cache, (offset/60+i) / BK_BLOCK_SIZE_CDC_WORDS);
+		memcpy(words+i,
+		       cache->words[slot]+(offset/60+i) % BK_BLOCK_SIZE_CDC_WORDS,
+		       sizeof(uint64_t)*n);
+	}
+
+	return avail;
+}
+
+/**
+ * Gets DPC text from the archive, decoded to ASCII. Text which starts on a
+ * character boundary comes from the cache; other text is unpacked directly.
+ *
+ * @param cache
+ * @param offset Bit offset of the first character in the archive.
+ * @param text Receives the text, which is not terminated. Characters past the
+ *        end of the archive are decoded as if they were 0.
+ * @param numChars
+ * @return The number of characters which are within the archive.
+ */
+size_t block_cache_text(BlockCache *const cache, const size_t offset,
+                        char *const text, const size_t numChars)
+{
+	size_t avail, n, i, slot;
+
+	avail = offset < cache->len*8 ? (cache->len*8 - offset)/6 : 0;
+	if (avail > numChars) {
+		avail = numChars;
+	}
+
+	if (offset % 6) {
+		gbytes<uint8_t,char>(cache->buf+(offset/8), text, offset%8, 6, 0,
+		                     avail);
+		memset(text+avail, 0, numChars-avail);
+		cdc_decode(text, numChars);
+		return avail;
+	}
+
+	for (i = 0; i < numChars; i += n) {
+		n = BLOCK_CACHE_TEXT_LEN - (offset/6+i) % BLOCK_CACHE_TEXT_LEN;
+		if (n > numChars-i) {
+			n = numChars-i;
+		}
+		slot = get_block(cache, (offset/6+i) / BLOCK_CACHE_TEXT_LEN);
+		memcpy(text+i, cache->text[slot]+(offset/6+i) % BLOCK_CACHE_TEXT_LEN,
+		       n);
+	}
+
+	return avail;
+}
+
+/**
+ * Finds the slot holding a block, decoding the block into the least recently
+ * used slot if it is not in the cache, and marks the slot most recently used.
+ *
+ * @return The slot.
+ */
+static size_t get_block(BlockCache *const cache, const size_t block)
+{
+	size_t *link;
+	size_t slot;
+
+	for (slot = cache->buckets[block % cache->numBuckets];
+	     slot != NO_SLOT && cache->block[slot] != block;
+	     slot = cache->chain[slot]);
+
+	if (slot != NO_SLOT) {
+		cache->hits++;
+		if (slot != cache->head) {
+			unlink_slot(cache, slot);
+			push_slot(cache, slot);
+		}
+		return slot;
+	}
+
+	cache->misses++;
+	if (cache->numUsed < cache->numSlots) {
+		slot = cache->numUsed++;
+	} else {
+		slot = cache->tail;
+		unlink_slot(cache, slot);
+		for (link = &cache->buckets[cache->block[slot] % cache->numBuckets];
+		     *link != slot; link = &cache->chain[*link]);
+		*link = cache->chain[slot];
+	}
+
+	decode_block(cache, slot, block);
+	cache->block[slot] = block;
+	cache->chain[slot] = cache->buckets[block % cache->numBuckets];
+	cache->buckets[block % cache->numBuckets] = slot;
+	push_slot(cache, slot);
+
+	return slot;
+}
+
+static void decode_block(BlockCache *const cache, const size_t slot,
+                         const size_t block)
+{
+	uint64_t *const words = cache->words[slot];
+	char *const text = cache->text[slot];
+	size_t numWords, i, j;
+
+	numWords = block*BLOCK_BITS < cache->len*8
+	           ? (cache->len*8 - block*BLOCK_BITS)/60 : 0;
+	if (numWords > BK_BLOCK_SIZE_CDC_WORDS) {
+		numWords = BK_BLOCK_SIZE_CDC_WORDS;
+	}
+
+	gbytes<uint8_t,uint64_t>(cache->buf+block*BK_BLOCK_SIZE_BYTES, words, 0,
+	                         60, 0, numWords);
+	memset(words+numWords, 0,
+	       sizeof(uint64_t)*(BK_BLOCK_SIZE_CDC_WORDS-numWords));
+
+	for (i = 0; i < BK_BLOCK_SIZE_CDC_WORDS; i++) {
+		for (j = 0; j < 10; j++) {
+			text[i*10+j] = (words[i] >> (54-6*j)) & 077;
+		}
+	}
+	cdc_decode(text, BLOCK_CACHE_TEXT_LEN);
+}
+
+static void unlink_slot(BlockCache *const cache, const size_t slot)
+{
+	if (cache->prev[slot] != NO_SLOT) {
+		cache->next[cache->prev[slot]] = cache->next[slot];
+	} else {
+		cache->head = cache->next[slot];
+	}
+	if (cache->next[slot] != NO_SLOT) {
+		cache->prev[cache->next[slot]] = cache->prev[slot];
+	} else {
+		cache->tail = cache->prev[slot];
+	}
+}
+
+static void push_slot(BlockCache *const cache, const size_t slot)
+{
+	cache->prev[slot] = NO_SLOT;
+	cache->next[slot] = cache->head;
+	if (cache->head != NO_SLOT) {
+		cache->prev[cache->head] = slot;
+	} else {
+		cache->tail = slot;
+	}
+	cache->head = slot;
+}
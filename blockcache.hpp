@@ -0,0 +1,84 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Cache of decoded BK blocks, so that looking at the same part of an archive
+ * again does not mean unpacking its words again.
+ */
+
+#ifndef BLOCKCACHE_HPP
+#define BLOCKCACHE_HPP
+
+/* Number of 6-bit characters in a BK block. */
+#define BLOCK_CACHE_TEXT_LEN (BK_BLOCK_SIZE_CDC_WORDS*10)
+
+/* Memory used by the cache for each block it holds. */
+#define BLOCK_CACHE_SLOT_SIZE (BK_BLOCK_SIZE_CDC_WORDS*sizeof(uint64_t) + \
+                               BLOCK_CACHE_TEXT_LEN + 4*sizeof(size_t))
+
+/* Memory budget of a cache by default, in bytes. */
+#define BLOCK_CACHE_DEFAULT_SIZE (64 << 20)
+
+/**
+ * A cache of the most recently used BK blocks of an archive, each decoded
+ * both into 60-bit words and into DPC text. Blocks are decoded when first
+ * asked for and evicted least recently used first.
+ */
+typedef struct {
+	uint8_t const *buf;   /** The archive. */
+	size_t len;           /** Size of the archive in bytes. */
+	size_t numSlots;      /** Number of blocks the cache can hold. */
+	size_t numUsed;       /** Number of slots which hold a block. */
+	uint64_t (*words)[BK_BLOCK_SIZE_CDC_WORDS];
+	char (*text)[BLOCK_CACHE_TEXT_LEN];
+	size_t *block;        /** Index of the block held by each slot. */
+	size_t *prev;         /** Neighbours of each slot in order of use, most */
+	size_t *next;         /**   recent first. */
+	size_t *chain;        /** Next slot in the same hash bucket. */
+	size_t *buckets;      /** First slot in each hash bucket. */
+	size_t numBuckets;
+	size_t head;          /** Most recently used slot. */
+	size_t tail;          /** Least recently used slot. */
+	size_t hits;
+	size_t misses;
+} BlockCache;
+
+int block_cache_init(BlockCache *const cache, uint8_t const*const buf,
+                     const size_t len, const size_t budget);
+void block_cache_free(BlockCache *const cache);
+size_t block_cache_words(BlockCache *const cache, const size_t offset,
+                         uint64_t *const words, const size_t numWords);
+size_t block_cache_text(BlockCache *const cache, const size_t offset,
+                        char *const text, const size_t numChars);
+
+#endif
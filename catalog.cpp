@@ -0,0 +1,799 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Catalog of the files on many TBM archives.
+ *
+ * A catalog file is a CatalogHeader followed by the columns of the Catalog,
+ * in the order of the `columns' table below, each starting on an 8-byte
+ * boundary, and then the string table holding the name and path of each
+ * volume. The header records the byte order and the layout of the columns,
+ * so a catalog written by an incompatible build is refused rather than
+ * misread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tbm.hpp"
+#include "tbmidx.hpp"
+#include "catalog.hpp"
+
+#define CATALOG_BYTE_ORDER 0x01020304
+
+#define TABLE_VOLUMES 0
+#define TABLE_FILES   1
+
+/* Columns which are not copied from a field of the row. */
+#define NO_FIELD ((size_t) -1)
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t numColumns;
+	uint32_t columnsSize; /* Sum of the element sizes of the columns. */
+	uint64_t numVolumes;
+	uint64_t numFiles;
+	uint64_t stringsLen;
+} CatalogHeader;
+
+/**
+ * One column of a Catalog, and the field of CatalogVolume or CatalogFile it
+ * holds.
+ */
+typedef struct {
+	int table;     /* TABLE_VOLUMES or TABLE_FILES. */
+	size_t size;   /* Size of one element. */
+	size_t column; /* Offset of the column pointer within Catalog. */
+	size_t field;  /* Offset of the field within the row, or NO_FIELD. */
+} CatalogColumn;
+
+#define VOLUME_COLUMN(col, field) \
+	{ TABLE_VOLUMES, sizeof(((CatalogVolume*) 0)->field), \
+	  offsetof(Catalog, col), offsetof(CatalogVolume, field) }
+#define FILE_COLUMN(col) \
+	{ TABLE_FILES, sizeof(((CatalogFile*) 0)->col), \
+	  offsetof(Catalog, col), offsetof(CatalogFile, col) }
+
+static const CatalogColumn columns[] = {
+	{ TABLE_VOLUMES, sizeof(uint64_t), offsetof(Catalog, volName), NO_FIELD },
+	{ TABLE_VOLUMES, sizeof(uint64_t), offsetof(Catalog, volPath), NO_FIELD },
+	VOLUME_COLUMN(volSize, size),
+	VOLUME_COLUMN(volHash, hash),
+	VOLUME_COLUMN(volSerial, serial),
+	VOLUME_COLUMN(volDataType, dataType),
+	VOLUME_COLUMN(volMachineType, machineType),
+	VOLUME_COLUMN(volNumFiles, numFiles),
+	FILE_COLUMN(dataSetID),
+	FILE_COLUMN(volume),
+	FILE_COLUMN(file),
+	FILE_COLUMN(creationYear),
+	FILE_COLUMN(creationDay),
+	FILE_COLUMN(expirationYear),
+	FILE_COLUMN(expirationDay),
+	FILE_COLUMN(recordLen),
+	FILE_COLUMN(maxRecordNum),
+	FILE_COLUMN(useCount),
+	FILE_COLUMN(versionNum),
+	FILE_COLUMN(numBlocks)
+};
+
+#define NUM_COLUMNS (sizeof(columns)/sizeof(columns[0]))
+
+/**
+ * A volume being sorted by catalog_build().
+ */
+typedef struct {
+	CatalogVolume const *volume;
+	size_t index; /* Index of the volume as passed to catalog_build(). */
+} SortVolume;
+
+/**
+ * Work shared by the threads of catalog_scan().
+ */
+typedef struct {
+	char *const *paths;
+	size_t numPaths;
+	CatalogScan *scans;
+	size_t next;          /* Index of the next path to be scanned. */
+	pthread_mutex_t lock; /* Protects `next'. */
+} ScanWork;
+
+static size_t catalog_layout(Catalog *const cat, uint8_t *const mem);
+static int compare_volumes(const void *a, const void *b);
+static int compare_files(const void *a, const void *b);
+static void *scan_worker(void *arg);
+static int scan_volume(const char path[], CatalogScan *const scan);
+static unsigned dpc_number(const char *const s, const int n);
+static unsigned dpc_year(const char *const s);
+
+/**
+ * Returns the address of a column pointer of a catalog.
+ */
+static void **column_ptr(Catalog const*const cat, CatalogColumn const*const c)
+{
+	return (void**) ((uint8_t*) cat + c->column);
+}
+
+/**
+ * Works out where each column of a catalog goes.
+ *
+ * @param cat A catalog whose numVolumes, numFiles and stringsLen are set.
+ * @param mem If not NULL, the column pointers of `cat' are set to point into
+ *        this memory.
+ * @return The size of the catalog in bytes.
+ */
+static size_t catalog_layout(Catalog *const cat, uint8_t *const mem)
+{
+	size_t offset = sizeof(CatalogHeader);
+	size_t i, n;
+
+	for (i = 0; i < NUM_COLUMNS; i++) {
+		offset = (offset + 7) & ~(size_t) 7;
+		n = columns[i].table == TABLE_VOLUMES ? cat->numVolumes
+		                                      : cat->numFiles;
+		if (mem) {
+			*column_ptr(cat, &columns[i]) = mem + offset;
+		}
+		offset += n*columns[i].size;
+	}
+
+	if (mem) {
+		cat->strings = (char*) mem + offset;
+	}
+
+	return offset + cat->stringsLen;
+}
+
+/**
+ * Builds a catalog from a list of volumes and their files.
+ *
+ * @param cat Receives the catalog; free with catalog_free().
+ * @param volumes The volumes, whose names must be unique.
+ * @param numVolumes
+ * @param files The files of all the volumes, in any order; the `volume' field
+ *        of each is an index into `volumes'.
+ * @param numFiles
+ * @return 0 on success, or -1 if memory could not be allocated.
+ */
+int catalog_build(Catalog *const cat, CatalogVolume const*const volumes,
+                  const size_t numVolumes, CatalogFile const*const files,
+                  const size_t numFiles)
+{
+	CatalogHeader *header;
+	SortVolume *order;
+	uint32_t *newIndex;
+	CatalogFile *sorted;
+	uint8_t *column;
+	size_t i, j, len;
+	char *s;
+
+	memset(cat, 0, sizeof(Catalog));
+
+	order = (SortVolume*) malloc(sizeof(SortVolume)*(numVolumes+1));
+	newIndex = (uint32_t*) malloc(sizeof(uint32_t)*(numVolumes+1));
+	sorted = (CatalogFile*) malloc(sizeof(CatalogFile)*(numFiles+1));
+	if (!order || !newIndex || !sorted) {
+		goto mallocfail;
+	}
+
+	/* Sort the volumes by name, and then the files by data set ID. Once the
+	 * volumes are in order, sorting files by volume index sorts them by
+	 * volume name.
+	 */
+	for (i = 0; i < numVolumes; i++) {
+		order[i].volume = &volumes[i];
+		order[i].index = i;
+	}
+	qsort(order, numVolumes, sizeof(SortVolume), compare_volumes);
+	for (i = 0; i < numVolumes; i++) {
+		newIndex[order[i].index] = i;
+		cat->stringsLen += strlen(order[i].volume->name)+1 +
+		                   strlen(order[i].volume->path)+1;
+	}
+	for (j = 0; j < numFiles; j++) {
+		sorted[j] = files[j];
+		sorted[j].volume = newIndex[files[j].volume];
+	}
+	qsort(sorted, numFiles, sizeof(CatalogFile), compare_files);
+
+	cat->numVolumes = numVolumes;
+	cat->numFiles = numFiles;
+	cat->memLen = catalog_layout(cat, NULL);
+	if (!(cat->mem = (uint8_t*) calloc(cat->memLen, sizeof(uint8_t)))) {
+		goto mallocfail;
+	}
+	catalog_layout(cat, cat->mem);
+
+	header = (CatalogHeader*) cat->mem;
+	memcpy(header->magic, CATALOG_MAGIC, sizeof(header->magic));
+	header->version = CATALOG_VERSION;
+	header->byteOrder = CATALOG_BYTE_ORDER;
+	header->numColumns = NUM_COLUMNS;
+	for (i = 0; i < NUM_COLUMNS; i++) {
+		header->columnsSize += columns[i].size;
+	}
+	header->numVolumes = numVolumes;
+	header->numFiles = numFiles;
+	header->stringsLen = cat->stringsLen;
+
+	for (i = 0; i < NUM_COLUMNS; i++) {
+		if (columns[i].field == NO_FIELD) {
+			continue;
+		}
+		column = (uint8_t*) *column_ptr(cat, &columns[i]);
+		if (columns[i].table == TABLE_VOLUMES) {
+			for (j = 0; j < numVolumes; j++) {
+				memcpy(column + j*columns[i].size,
+				       (uint8_t const*) order[j].volume + columns[i].field,
+				       columns[i].size);
+			}
+		} else {
+			for (j = 0; j < numFiles; j++) {
+				memcpy(column + j*columns[i].size,
+				       (uint8_t const*) &sorted[j] + columns[i].field,
+				       columns[i].size);
+			}
+		}
+	}
+
+	for (i = 0, s = cat->strings; i < numVolumes; i++) {
+		len = strlen(order[i].volume->name)+1;
+		memcpy(s, order[i].volume->name, len);
+		cat->volName[i] = s - cat->strings;
+		s += len;
+		len = strlen(order[i].volume->path)+1;
+		memcpy(s, order[i].volume->path, len);
+		cat->volPath[i] = s - cat->strings;
+		s += len;
+	}
+
+	free(order);
+	free(newIndex);
+	free(sorted);
+
+	return 0;
+
+mallocfail:
+	free(order);
+	free(newIndex);
+	free(sorted);
+	catalog_free(cat);
+	return -1;
+}
+
+static int compare_volumes(const void *a, const void *b)
+{
+	return strcmp(((SortVolume const*) a)->volume->name,
+	              ((SortVolume const*) b)->volume->name);
+}
+
+static int compare_files(const void *a, const void *b)
+{
+	CatalogFile const*const x = (CatalogFile const*) a;
+	CatalogFile const*const y = (CatalogFile const*) b;
+	int c;
+
+	if ((c = memcmp(x->dataSetID, y->dataSetID, CATALOG_DSID_LEN))) {
+		return c;
+	}
+	if (x->volume != y->volume) {
+		return x->volume < y->volume ? -1 : 1;
+	}
+	return x->file < y->file ? -1 : x->file > y->file;
+}
+
+/**
+ * Writes a catalog to a file. The catalog is written to a temporary file
+ * which is then renamed, so that readers never see a partial catalog.
+ *
+ * @param cat
+ * @param path
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+int catalog_write(Catalog const*const cat, const char path[])
+{
+	char *tmpPath;
+	FILE *fp;
+	int ok;
+
+	if (!(tmpPath = (char*) malloc(strlen(path) + 32))) {
+		return -1;
+	}
+	sprintf(tmpPath, "%s.%ld", path, (long) getpid());
+
+	if (!(fp = fopen(tmpPath, "wb"))) {
+		free(tmpPath);
+		return -1;
+	}
+
+	ok = fwrite(cat->mem, sizeof(uint8_t), cat->memLen, fp) == cat->memLen;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmpPath, path)) {
+		unlink(tmpPath);
+		free(tmpPath);
+		return -1;
+	}
+
+	free(tmpPath);
+
+	return 0;
+}
+
+/**
+ * Reads a catalog.
+ *
+ * @param cat Receives the catalog; free with catalog_free().
+ * @param path
+ * @return 0 on success, or -1 on failure. errno is ENOENT if there is no
+ *         catalog, or EINVAL if the file is not a catalog that this build can
+ *         read.
+ */
+int catalog_read(Catalog *const cat, const char path[])
+{
+	CatalogHeader header;
+	struct stat st;
+	uint32_t columnsSize = 0;
+	size_t i;
+	int fd;
+
+	memset(cat, 0, sizeof(Catalog));
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) || st.st_size < (off_t) sizeof(CatalogHeader) ||
+	    tbm_pread(fd, (uint8_t*) &header, sizeof(header), 0))
+	{
+		goto invalid;
+	}
+
+	for (i = 0; i < NUM_COLUMNS; i++) {
+		columnsSize += columns[i].size;
+	}
+	if (memcmp(header.magic, CATALOG_MAGIC, sizeof(header.magic)) ||
+	    header.version != CATALOG_VERSION ||
+	    header.byteOrder != CATALOG_BYTE_ORDER ||
+	    header.numColumns != NUM_COLUMNS ||
+	    header.columnsSize != columnsSize)
+	{
+		goto invalid;
+	}
+
+	cat->numVolumes = header.numVolumes;
+	cat->numFiles = header.numFiles;
+	cat->stringsLen = header.stringsLen;
+	cat->memLen = catalog_layout(cat, NULL);
+	if (cat->memLen != (size_t) st.st_size ||
+	    !(cat->mem = (uint8_t*) malloc(cat->memLen)) ||
+	    tbm_pread(fd, cat->mem, cat->memLen, 0))
+	{
+		goto invalid;
+	}
+	close(fd);
+	catalog_layout(cat, cat->mem);
+
+	/* Don't trust the string offsets and volume indices blindly. */
+	if (cat->stringsLen && cat->strings[cat->stringsLen-1] != '\0') {
+		goto corrupt;
+	}
+	for (i = 0; i < cat->numVolumes; i++) {
+		if (cat->volName[i] >= cat->stringsLen ||
+		    cat->volPath[i] >= cat->stringsLen)
+		{
+			goto corrupt;
+		}
+	}
+	for (i = 0; i < cat->numFiles; i++) {
+		if (cat->volume[i] >= cat->numVolumes) {
+			goto corrupt;
+		}
+	}
+
+	return 0;
+
+invalid:
+	close(fd);
+corrupt:
+	catalog_free(cat);
+	errno = EINVAL;
+	return -1;
+}
+
+/**
+ * Releases the memory held by a catalog.
+ *
+ * @param cat
+ */
+void catalog_free(Catalog *const cat)
+{
+	free(cat->mem);
+	memset(cat, 0, sizeof(Catalog));
+}
+
+/**
+ * Gets one volume of a catalog.
+ *
+ * @param cat
+ * @param i Index of the volume.
+ * @param volume Receives the volume; its strings belong to the catalog.
+ */
+void catalog_volume(Catalog const*const cat, const size_t i,
+                    CatalogVolume *const volume)
+{
+	size_t c;
+
+	for (c = 0; c < NUM_COLUMNS; c++) {
+		if (columns[c].table == TABLE_VOLUMES && columns[c].field != NO_FIELD) {
+			memcpy((uint8_t*) volume + columns[c].field,
+			       (uint8_t const*) *column_ptr(cat, &columns[c]) +
+			           i*columns[c].size,
+			       columns[c].size);
+		}
+	}
+	volume->name = cat->strings + cat->volName[i];
+	volume->path = cat->strings + cat->volPath[i];
+}
+
+/**
+ * Gets one file of a catalog.
+ *
+ * @param cat
+ * @param i Index of the file within the catalog.
+ * @param file
+ */
+void catalog_file(Catalog const*const cat, const size_t i,
+                  CatalogFile *const file)
+{
+	size_t c;
+
+	for (c = 0; c < NUM_COLUMNS; c++) {
+		if (columns[c].table == TABLE_FILES) {
+			memcpy((uint8_t*) file + columns[c].field,
+			       (uint8_t const*) *column_ptr(cat, &columns[c]) +
+			           i*columns[c].size,
+			       columns[c].size);
+		}
+	}
+}
+
+/**
+ * Finds a volume by name.
+ *
+ * @param cat
+ * @param name
+ * @return The index of the volume, or -1 if it is not in the catalog.
+ */
+ssize_t catalog_find_volume(Catalog const*const cat, const char name[])
+{
+	size_t lo = 0, hi = cat->numVolumes, mid;
+	int c;
+
+	while (lo < hi) {
+		mid = lo + (hi-lo)/2;
+		c = strcmp(cat->strings + cat->volName[mid], name);
+		if (c == 0) {
+			return mid;
+		}
+		if (c < 0) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Finds the files whose data set IDs begin with `prefix'.
+ *
+ * @param cat
+ * @param prefix
+ * @param first Receives the index of the first such file.
+ * @param end Receives the index after the last such file; equal to `first'
+ *        if there are none.
+ */
+void catalog_find(Catalog const*const cat, const char prefix[],
+                  size_t *const first, size_t *const end)
+{
+	size_t len = strlen(prefix);
+	size_t lo, hi, mid;
+
+	if (len > CATALOG_DSID_LEN) {
+		len = CATALOG_DSID_LEN;
+	}
+
+	for (lo = 0, hi = cat->numFiles; lo < hi; ) {
+		mid = lo + (hi-lo)/2;
+		if (memcmp(cat->dataSetID[mid], prefix, len) < 0) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	*first = lo;
+
+	for (hi = cat->numFiles; lo < hi; ) {
+		mid = lo + (hi-lo)/2;
+		if (memcmp(cat->dataSetID[mid], prefix, len) <= 0) {
+			lo = mid+1;
+		} else {
+			hi = mid;
+		}
+	}
+	*end = lo;
+}
+
+/**
+ * Reads the label buffers of many archives, using a pool of threads since
+ * the time taken is mostly spent waiting for reads.
+ *
+ * @param paths
+ * @param numPaths
+ * @param numThreads
+ * @param scans Receives the result for each path; free the `files' of each
+ *        when done.
+ * @return 0 on success, or -1 if the work could not be shared out.
+ */
+int catalog_scan(char *const*const paths, const size_t numPaths,
+                 const unsigned numThreads, CatalogScan *const scans)
+{
+	ScanWork work;
+	pthread_t *threads;
+	unsigned t, numWorkers;
+
+	numWorkers = numThreads ? numThreads : 1;
+	if (numWorkers > numPaths) {
+		numWorkers = numPaths ? numPaths : 1;
+	}
+	if (!(threads = (pthread_t*) malloc(sizeof(pthread_t)*numWorkers))) {
+		return -1;
+	}
+
+	work.paths = paths;
+	work.numPaths = numPaths;
+	work.scans = scans;
+	work.next = 0;
+	if (pthread_mutex_init(&work.lock, NULL)) {
+		free(threads);
+		return -1;
+	}
+
+	/* The calling thread works too; if a thread can't be started, the
+	 * others simply take its share.
+	 */
+	for (t = 1; t < numWorkers; t++) {
+		if (pthread_create(&threads[t], NULL, scan_worker, &work)) {
+			threads[t] = pthread_self();
+		}
+	}
+	scan_worker(&work);
+	for (t = 1; t < numWorkers; t++) {
+		if (!pthread_equal(threads[t], pthread_self())) {
+			pthread_join(threads[t], NULL);
+		}
+	}
+
+	pthread_mutex_destroy(&work.lock);
+	free(threads);
+
+	return 0;
+}
+
+static void *scan_worker(void *arg)
+{
+	ScanWork *const work = (ScanWork*) arg;
+	size_t i;
+
+	for (;;) {
+		pthread_mutex_lock(&work->lock);
+		i = work->next++;
+		pthread_mutex_unlock(&work->lock);
+
+		if (i >= work->numPaths) {
+			break;
+		}
+		work->scans[i].status = scan_volume(work->paths[i], &work->scans[i]);
+	}
+
+	return NULL;
+}
+
+/**
+ * Reads the label buffer of one archive and describes the archive and its
+ * files.
+ *
+ * @return TBM_OK, or one of the TBM_ERR_* values.
+ */
+static int scan_volume(const char path[], CatalogScan *const scan)
+{
+	CatalogVolume *const v = &scan->volume;
+	SYSLBN_Data syslbn_data;
+	SYSLBN_Text syslbn_text;
+	FileControlPointer fcp;
+	FileHistoryWord_Data fhw_data;
+	FileHistoryWord_Text fhw_text;
+	CatalogFile *f;
+	uint8_t *labelBuf = NULL;
+	size_t *numBlocks = NULL;
+	size_t labelLen, labelBits, offset;
+	struct stat st;
+	const char *s;
+	int fd, i, numFiles;
+	int status = TBM_OK;
+
+	memset(scan, 0, sizeof(CatalogScan));
+	s = strrchr(path, '/');
+	v->name = s ? s+1 : path;
+	v->path = path;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return TBM_ERR_IO;
+	}
+	if (fstat(fd, &st)) {
+		status = TBM_ERR_IO;
+		goto done;
+	}
+	v->size = st.st_size;
+
+	/* The size of the label buffer is given in its first BK block. */
+	labelLen = BK_BLOCK_SIZE_BYTES;
+	if (!(labelBuf = (uint8_t*) malloc(labelLen))) {
+		status = TBM_ERR_NOMEM;
+		goto done;
+	}
+	if (v->size < labelLen) {
+		status = TBM_ERR_FORMAT;
+		goto done;
+	}
+	if (tbm_pread(fd, labelBuf, labelLen, 0)) {
+		status = errno ? TBM_ERR_IO : TBM_ERR_FORMAT;
+		goto done;
+	}
+	read_syslbn(labelBuf, &syslbn_text, &syslbn_data, 0);
+	if ((status = tbm_check_syslbn(&syslbn_data, v->size))) {
+		goto done;
+	}
+	if (syslbn_data.bk > 1) {
+		labelLen = syslbn_data.bk*BK_BLOCK_SIZE_BYTES;
+		free(labelBuf);
+		if (!(labelBuf = (uint8_t*) malloc(labelLen))) {
+			status = TBM_ERR_NOMEM;
+			goto done;
+		}
+		if (tbm_pread(fd, labelBuf, labelLen, 0)) {
+			status = errno ? TBM_ERR_IO : TBM_ERR_FORMAT;
+			goto done;
+		}
+	}
+	labelBits = labelLen*8;
+
+	v->hash = tbmidx_hash(labelBuf, labelLen);
+	memcpy(v->serial, syslbn_text.vol1.tbmVolSerial, CATALOG_SERIAL_LEN);
+	v->dataType = syslbn_data.dataType;
+	v->machineType = syslbn_data.machineType;
+
+	numFiles = tbm_count_files(labelBuf, &syslbn_data, NULL, 0);
+	numBlocks = (size_t*) malloc(sizeof(size_t)*(numFiles+1));
+	scan->files = (CatalogFile*) calloc(numFiles+1, sizeof(CatalogFile));
+	if (!numBlocks || !scan->files) {
+		status = TBM_ERR_NOMEM;
+		goto done;
+	}
+	tbm_count_files(labelBuf, &syslbn_data, numBlocks, 0);
+
+	/* The file history words of each file, as counted by tbm_count_files().
+	 */
+	offset = syslbn_data.firstFCPOff * 60;
+	i = 0;
+	do {
+		if (offset + FCP_HEADER_WORDS*60 > labelBits) {
+			status = TBM_ERR_FORMAT;
+			goto done;
+		}
+		read_fileControlPointer(labelBuf, &fcp, offset);
+		if (!fcp.isEOF && fcp.dataBlkNum != syslbn_data.numBKBlocks-1) {
+			read_fileHistoryWord(labelBuf, &fhw_text, &fhw_data, offset+60);
+			f = &(scan->files[i]);
+			memcpy(f->dataSetID, fhw_text.dataSetID, CATALOG_DSID_LEN);
+			f->file = i;
+			f->creationYear = dpc_year(fhw_text.creationYear);
+			f->creationDay = dpc_number(fhw_text.creationDay, 3);
+			f->expirationYear = dpc_year(fhw_text.expirationYear);
+			f->expirationDay = dpc_number(fhw_text.expirationDay, 3);
+			f->recordLen = fhw_data.recordLen;
+			f->maxRecordNum = fhw_data.maxRecordNum;
+			f->useCount = fhw_data.useCount;
+			f->versionNum = fhw_data.versionNum;
+			f->numBlocks = numBlocks[i];
+			i++;
+		}
+		offset += fcp.nextFCPOff*60;
+	} while (!fcp.isEOF && fcp.nextFCPOff && i < numFiles);
+	v->numFiles = i;
+
+done:
+	if (status) {
+		free(scan->files);
+		scan->files = NULL;
+	}
+	free(labelBuf);
+	free(numBlocks);
+	close(fd);
+
+	return status;
+}
+
+/**
+ * Reads a decimal number of `n' digits, as decoded from display code.
+ *
+ * @return The number, or 0 if any of the characters is not a digit.
+ */
+static unsigned dpc_number(const char *const s, const int n)
+{
+	unsigned value = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (s[i] < '0' || s[i] > '9') {
+			return 0;
+		}
+		value = 10*value + (s[i] - '0');
+	}
+
+	return value;
+}
+
+/**
+ * Reads a two-digit year, as decoded from display code.
+ *
+ * @return The year, e.g. 1979, or 0 if it could not be read.
+ */
+static unsigned dpc_year(const char *const s)
+{
+	if (s[0] < '0' || s[0] > '9' || s[1] < '0' || s[1] > '9') {
+		return 0;
+	}
+
+	return 1900 + dpc_number(s, 2);
+}
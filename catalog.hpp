@@ -0,0 +1,143 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Catalog of the files on many TBM archives, built from the label buffer of
+ * each archive (the SYSLBN and each file's FCP and file history words) so
+ * that finding which volumes hold a data set does not mean reading them.
+ */
+
+#ifndef CATALOG_HPP
+#define CATALOG_HPP
+
+#define CATALOG_MAGIC      "TBMCAT\r\n"
+#define CATALOG_VERSION    1
+#define CATALOG_DSID_LEN   17
+#define CATALOG_SERIAL_LEN 6
+
+/**
+ * One volume of a catalog.
+ */
+typedef struct {
+	const char *name;    /** Base name of the path; identifies the volume. */
+	const char *path;
+	uint64_t size;       /** Size of the archive in bytes. */
+	uint64_t hash;       /** tbmidx_hash() of the label buffer. */
+	char serial[CATALOG_SERIAL_LEN]; /** TBM volume serial name. */
+	uint8_t dataType;    /** One of the DATA_TYPE_* values. */
+	uint8_t machineType; /** One of the MACHINE_TYPE_* values. */
+	uint32_t numFiles;
+} CatalogVolume;
+
+/**
+ * One file of a catalog, from its file control pointer and file history
+ * words. Dates which could not be read are 0.
+ */
+typedef struct {
+	char dataSetID[CATALOG_DSID_LEN];
+	uint32_t volume;         /** Index of the volume in the catalog. */
+	uint32_t file;           /** Index of the file within the volume. */
+	uint16_t creationYear;   /** e.g. 1979 */
+	uint16_t creationDay;    /** Day of the year, from 1. */
+	uint16_t expirationYear;
+	uint16_t expirationDay;
+	uint32_t recordLen;
+	uint32_t maxRecordNum;
+	uint16_t useCount;
+	uint16_t versionNum;
+	uint32_t numBlocks;      /** BK blocks spanned by the file. */
+} CatalogFile;
+
+/**
+ * A catalog, stored by column: element i of each vol* array describes volume
+ * i, and element i of each of the other arrays describes file i. Volumes are
+ * sorted by name, and files by data set ID, then volume, then file index, so
+ * that either can be found by binary search. In memory the catalog is laid
+ * out exactly as in its file.
+ */
+typedef struct {
+	size_t numVolumes;
+	size_t numFiles;
+	uint64_t *volName;   /** Offset of the name in `strings'. */
+	uint64_t *volPath;   /** Offset of the path in `strings'. */
+	uint64_t *volSize;
+	uint64_t *volHash;
+	char (*volSerial)[CATALOG_SERIAL_LEN];
+	uint8_t *volDataType;
+	uint8_t *volMachineType;
+	uint32_t *volNumFiles;
+	char (*dataSetID)[CATALOG_DSID_LEN];
+	uint32_t *volume;
+	uint32_t *file;
+	uint16_t *creationYear;
+	uint16_t *creationDay;
+	uint16_t *expirationYear;
+	uint16_t *expirationDay;
+	uint32_t *recordLen;
+	uint32_t *maxRecordNum;
+	uint16_t *useCount;
+	uint16_t *versionNum;
+	uint32_t *numBlocks;
+	char *strings;
+	size_t stringsLen;
+	uint8_t *mem;        /** The whole catalog. */
+	size_t memLen;
+} Catalog;
+
+/**
+ * The result of scanning one archive with catalog_scan().
+ */
+typedef struct {
+	int status;          /** TBM_OK, or one of the TBM_ERR_* values. */
+	CatalogVolume volume;
+	CatalogFile *files;  /** volume.numFiles files; `volume' fields are 0. */
+} CatalogScan;
+
+int catalog_scan(char *const*const paths, const size_t numPaths,
+                 const unsigned numThreads, CatalogScan *const scans);
+int catalog_build(Catalog *const cat, CatalogVolume const*const volumes,
+                  const size_t numVolumes, CatalogFile const*const files,
+                  const size_t numFiles);
+int catalog_write(Catalog const*const cat, const char path[]);
+int catalog_read(Catalog *const cat, const char path[]);
+void catalog_free(Catalog *const cat);
+
+void catalog_volume(Catalog const*const cat, const size_t i,
+                    CatalogVolume *const volume);
+void catalog_file(Catalog const*const cat, const size_t i,
+                  CatalogFile *const file);
+ssize_t catalog_find_volume(Catalog const*const cat, const char name[]);
+void catalog_find(Catalog const*const cat, const char prefix[],
+                  size_t *const first, size_t *const end);
+
+#endif
@@ -35,18 +35,596 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
 #include "cdc.hpp"
 
+#define CDC_EXPONENT_MASK  03777
+#define CDC_COEFF_MASK     07777777777777777
+#define CDC_INDEFINITE     01777
+#define CDC_INFINITE       03777
+
+#define IEEE_BIAS          1023
+#define IEEE_TWO_52        0x4330000000000000 /* 2^52 */
+#define IEEE_INFINITY      0x7FF0000000000000
+#define IEEE_QUIET_NAN     0x7FF8000000000000
+#define IEEE_PAYLOAD_MASK  0x0007FFFFFFFFFFFF
+
+/* The same for binary128, in its upper 64 bits. */
+#define QUAD_BIAS          16383
+#define QUAD_INFINITY      0x7FFF000000000000
+#define QUAD_QUIET_NAN     0x7FFF800000000000
+#define QUAD_FRACTION_MASK 0x0000FFFFFFFFFFFF
+
+/* 1 if `x', which must be less than 2^63, is zero, else 0. This and the
+ * other comparisons in the vectorized loops are done with shifts, as SSE2
+ * has no 64-bit comparisons.
+ */
+#define IS_ZERO(x) (((x) - 1) >> 63)
+
+/* Number of words converted at a time by the vectorized loops. */
+#define CDC_BLOCK 8
+
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+/* Display code to ASCII. */
+static const char dpcAscii[65 /* add one for the null terminator */] =
+	" " /* "display code 0 has no associated graphic in the 63-character set" */
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	"0123456789"
+	"+-*/()$= ,.#[]%\"_!&'?<>@\\^;";
+
+/* External BCD, as written on seven-track tape, to ASCII. Code 00 is not
+ * written on tape; like display code 0 it becomes a blank. */
+static const char bcdAscii[65] =
+	" 1234567890=\"@%[ /STUVWXYZ],(_#&-JKLMNOPQR!$*'?>+ABCDEFGHI<.)\\^;";
+
+/* EBCDIC (code page 037) to ASCII. The cent and not signs, which ASCII
+ * lacks, become '[' and '^', as on many IBM systems; other codes with no
+ * ASCII equivalent become SUB (0x1A).
+ */
+static const uint8_t ebcdicAscii[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x1A, 0x09, 0x1A, 0x7F,
+	0x1A, 0x1A, 0x1A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x10, 0x11, 0x12, 0x13, 0x1A, 0x1A, 0x08, 0x1A,
+	0x18, 0x19, 0x1A, 0x1A, 0x1C, 0x1D, 0x1E, 0x1F,
+	0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x0A, 0x17, 0x1B,
+	0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x05, 0x06, 0x07,
+	0x1A, 0x1A, 0x16, 0x1A, 0x1A, 0x1A, 0x1A, 0x04,
+	0x1A, 0x1A, 0x1A, 0x1A, 0x14, 0x15, 0x1A, 0x1A,
+	0x20, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x1A, 0x5B, 0x2E, 0x3C, 0x28, 0x2B, 0x7C,
+	0x26, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x1A, 0x21, 0x24, 0x2A, 0x29, 0x3B, 0x5E,
+	0x2D, 0x2F, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x1A, 0x1A, 0x2C, 0x25, 0x5F, 0x3E, 0x3F,
+	0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x60, 0x3A, 0x23, 0x40, 0x27, 0x3D, 0x22,
+	0x1A, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67,
+	0x68, 0x69, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F, 0x70,
+	0x71, 0x72, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x7E, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+	0x79, 0x7A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x5E, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x1A, 0x1A, 0x5B, 0x5D, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x7B, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47,
+	0x48, 0x49, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x7D, 0x4A, 0x4B, 0x4C, 0x4D, 0x4E, 0x4F, 0x50,
+	0x51, 0x52, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x5C, 0x1A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A
+};
+
+/* Display code and external BCD to ASCII two characters at a time:
+ * dpcPairs[i] holds the characters of the twelve bits i, in memory order. */
+static char dpcPairs[4096][2];
+static char bcdPairs[4096][2];
+static pthread_once_t pairsOnce = PTHREAD_ONCE_INIT;
+
+/* Number of blanks each COSY code (064 to 076) stands for; 0 for the codes
+ * of characters. */
+static const uint8_t cosyBlanks[64] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 2, 3, 4, 5, 6, 7, 8, 9, 10, 20, 30, 0
+};
+
+/* The high bit of each of the ten characters of a word. */
+#define DPC_HIGH_BITS 040404040404040404040
+
+static void six_bit_ascii(uint64_t const*const words, char *const str,
+                          const size_t numChars, char const (*pairs)[2],
+                          const char singles[]);
+static void init_pairs(void);
+static int has_cosy_codes(const uint64_t w);
+
 void cdc_decode(char *const str, const size_t len)
 {
 	size_t i;
-	char ascii[65 /* add one for the null terminator */] =
-		" " /* "display code 0 has no associated graphic in the 63-character set" */
-		"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-		"0123456789"
-		"+-*/()$= ,.#[]%\"_!&'?<>@\\^;";
 
 	for (i = 0; i < len; i++) {
-		str[i] = ascii[(int) str[i]];
+		str[i] = dpcAscii[(int) str[i]];
+	}
+}
+
+/**
+ * Unpacks 60-bit words from a stream of bits, most significant bit first,
+ * into the low 60 bits of 64-bit words. As the words start every 60 bits,
+ * each lies within the eight bytes from the one holding its first bit if
+ * the stream starts on a four-bit boundary, and is got with one load.
+ *
+ * @param data The first byte of the stream.
+ * @param bitOffset Offset of the first bit of the stream within data[0],
+ *        counting from the most significant bit; 0 or 4.
+ * @param words Receives the words.
+ * @param n Number of words.
+ */
+void cdc_unpack(uint8_t const*const data, const unsigned bitOffset,
+                uint64_t *const words, const size_t n)
+{
+	size_t i, offset;
+	uint64_t w;
+
+	for (i = 0; i < n; i++) {
+		offset = bitOffset + 60*i;
+		memcpy(&w, data + offset/8, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		words[i] = (w >> (4 - offset%8)) & CDC_WORD_MASK;
+	}
+}
+
+/**
+ * Converts the display code characters held ten to a word in a run of
+ * 60-bit words to ASCII, as tbm2cos did with dpcasc.
+ *
+ * @param words The words, one in the low 60 bits of each element.
+ * @param str Receives `numChars' characters; not null-terminated.
+ * @param numChars Number of characters to convert, starting with the high
+ *        six bits of the first word.
+ */
+void cdc_dpc_ascii(uint64_t const*const words, char *const str,
+                   const size_t numChars)
+{
+	pthread_once(&pairsOnce, init_pairs);
+	six_bit_ascii(words, str, numChars, dpcPairs, dpcAscii);
+}
+
+/**
+ * Converts external BCD characters, as read from seven-track tape and held
+ * ten to a word, to ASCII, in the same way as cdc_dpc_ascii().
+ *
+ * @param words The words, one in the low 60 bits of each element.
+ * @param str Receives `numChars' characters; not null-terminated.
+ * @param numChars Number of characters to convert, starting with the high
+ *        six bits of the first word.
+ */
+void cdc_bcd_ascii(uint64_t const*const words, char *const str,
+                   const size_t numChars)
+{
+	pthread_once(&pairsOnce, init_pairs);
+	six_bit_ascii(words, str, numChars, bcdPairs, bcdAscii);
+}
+
+/**
+ * Converts EBCDIC characters to ASCII.
+ *
+ * @param in The characters.
+ * @param out Receives `n' characters; may be the same array as `in'.
+ * @param n
+ */
+void cdc_ebcdic_ascii(uint8_t const*const in, char *const out,
+                      const size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		out[i] = ebcdicAscii[in[i]];
 	}
 }
+
+/**
+ * Converts six-bit characters held ten to a word through a table of their
+ * pairs, and one of the characters themselves for the last partial word.
+ */
+static void six_bit_ascii(uint64_t const*const words, char *const str,
+                          const size_t numChars, char const (*pairs)[2],
+                          const char singles[])
+{
+	size_t i, j;
+	uint64_t w;
+
+	/* Whole words first, a pair of characters at a time, so that each word
+	 * is read once and the inner loop, having a fixed trip count, is
+	 * unrolled.
+	 */
+	for (i = 0; i+10 <= numChars; i += 10) {
+		w = words[i/10];
+		for (j = 0; j < 5; j++) {
+			memcpy(str+i+2*j, pairs[(w >> (48-12*j)) & 07777], 2);
+		}
+	}
+	for (j = 0; i < numChars; i++, j++) {
+		str[i] = singles[(words[i/10] >> (54-6*j)) & 077];
+	}
+}
+
+/**
+ * Expands a COSY-compressed display code card image to an 80-column ASCII
+ * card, as tbm2cos did for records of mode 7. Codes 064 to 076 stand for
+ * runs of blanks (see cosyBlanks), 077 escapes the character after it, and
+ * 00 ends the card. The card is cut off at 80 columns, or filled out to 80
+ * with blanks.
+ *
+ * Words holding none of these codes, which are most of those of cards that
+ * were not compressed, are converted a pair of characters at a time as by
+ * cdc_dpc_ascii(); only the others are expanded a character at a time.
+ *
+ * @param words The words, one in the low 60 bits of each element.
+ * @param card Receives CDC_COSY_COLUMNS characters; not null-terminated.
+ * @param numChars Number of characters of the compressed card; at most
+ *        CDC_COSY_COLUMNS.
+ */
+void cdc_cosy_ascii(uint64_t const*const words, char *const card,
+                    const size_t numChars)
+{
+	size_t i = 0, col = 0, j, n;
+	int escaped = 0;
+	unsigned c;
+	uint64_t w;
+
+	pthread_once(&pairsOnce, init_pairs);
+
+	while (i < numChars && col < CDC_COSY_COLUMNS) {
+		w = words[i/10];
+		if (i%10 == 0 && i+10 <= numChars && col+10 <= CDC_COSY_COLUMNS &&
+		    !escaped && !has_cosy_codes(w))
+		{
+			for (j = 0; j < 5; j++) {
+				memcpy(card+col+2*j, dpcPairs[(w >> (48-12*j)) & 07777], 2);
+			}
+			i += 10;
+			col += 10;
+			continue;
+		}
+
+		c = (w >> (54-6*(i%10))) & 077;
+		i++;
+		if (escaped) {
+			card[col++] = dpcAscii[c];
+			escaped = 0;
+		} else if (c == 0) {
+			break;
+		} else if (c == 077) {
+			escaped = 1;
+		} else if (cosyBlanks[c]) {
+			n = MIN((size_t) cosyBlanks[c], CDC_COSY_COLUMNS-col);
+			memset(card+col, ' ', n);
+			col += n;
+		} else {
+			card[col++] = dpcAscii[c];
+		}
+	}
+
+	memset(card+col, ' ', CDC_COSY_COLUMNS-col);
+}
+
+/**
+ * @return Whether any of the characters of a word is 00 or 064 to 077.
+ */
+static int has_cosy_codes(const uint64_t w)
+{
+	/* For each character, its high bit is set in `high' if its top two
+	 * bits are set and either of the next two, and in `nonzero' if any of
+	 * its bits are set.
+	 */
+	const uint64_t high = w & (w << 1) & ((w << 2) | (w << 3)) &
+	                      DPC_HIGH_BITS;
+	const uint64_t nonzero = (w | (w << 1) | (w << 2) | (w << 3) |
+	                          (w << 4) | (w << 5)) & DPC_HIGH_BITS;
+
+	return high || nonzero != DPC_HIGH_BITS;
+}
+
+static void init_pairs(void)
+{
+	int i;
+
+	for (i = 0; i < 4096; i++) {
+		dpcPairs[i][0] = dpcAscii[i >> 6];
+		dpcPairs[i][1] = dpcAscii[i & 077];
+		bcdPairs[i][0] = bcdAscii[i >> 6];
+		bcdPairs[i][1] = bcdAscii[i & 077];
+	}
+}
+
+/**
+ * Converts 60-bit one's-complement integers to two's complement, as tbm2cos
+ * did with i7tic. Negative zero becomes zero. The loop has no branches, so
+ * that it is vectorized.
+ *
+ * @param words The integers, one in the low 60 bits of each element.
+ * @param ints Receives the integers; may be the same array as `words'.
+ * @param n
+ */
+void cdc_ints(uint64_t const*const words, int64_t *const ints,
+              const size_t n)
+{
+	size_t i, j;
+	uint64_t w[CDC_BLOCK], s;
+
+	/* Blocks of words are loaded before any is stored, so that the block
+	 * is vectorized even though `ints' may overlap `words'.
+	 */
+	for (i = 0; i < n; i += CDC_BLOCK) {
+		if (i + CDC_BLOCK > n) {
+			memset(w, 0, sizeof(w));
+		}
+		memcpy(w, words+i, sizeof(uint64_t)*MIN(n-i, CDC_BLOCK));
+		for (j = 0; j < CDC_BLOCK; j++) {
+			w[j] &= CDC_WORD_MASK;
+			s = CDC_SIGN(w[j]);
+			/* Extend the sign, then add one to negative values. */
+			w[j] = (w[j] | (-s & ~CDC_WORD_MASK)) + s;
+		}
+		memcpy(ints+i, w, sizeof(uint64_t)*MIN(n-i, CDC_BLOCK));
+	}
+}
+
+/**
+ * Converts 60-bit reals to IEEE doubles, following tbm2cos's nc7tc: a word
+ * whose exponent is zero is an integer, and infinite and indefinite values
+ * become infinities and NaNs, both with the sign of the word. Unnormalized
+ * values, which nc7tc made infinite, are converted as they stand, and
+ * counted. A 60-bit real can be as large as 2^1070, beyond the range of a
+ * double; such values become infinities of their sign, and are counted too.
+ * The loop has no branches, so that it is vectorized.
+ *
+ * @param words The reals, one in the low 60 bits of each element.
+ * @param reals Receives the reals; may be the same array as `words'.
+ * @param n
+ * @param nanPayload The low 51 bits of the quiet NaNs made from indefinite
+ *        values.
+ * @param numOverflowed If not NULL, receives the number of values too large
+ *        for a double.
+ * @return The number of unnormalized values.
+ */
+size_t cdc_reals(uint64_t const*const words, double *const reals,
+                 const size_t n, const uint64_t nanPayload,
+                 size_t *const numOverflowed)
+{
+	const uint64_t nan = IEEE_QUIET_NAN | (nanPayload & IEEE_PAYLOAD_MASK);
+	size_t i, j, numUnnormalized = 0, numInfinite = 0;
+	uint64_t w[CDC_BLOCK], s, x, e, m, bits, scale;
+	uint64_t isInteger, isInfinite, isIndefinite, isSpecial;
+	double d, f;
+
+	/* As in cdc_ints(), blocks are loaded before any is stored. The
+	 * exponent is 11 bits and the coefficient 48, so that bit 10 of the one
+	 * tells whether it is below 2000 octal and bit 47 of the other whether
+	 * the value is normalized.
+	 */
+	for (i = 0; i < n; i += CDC_BLOCK) {
+		if (i + CDC_BLOCK > n) {
+			memset(w, 0, sizeof(w));
+		}
+		memcpy(w, words+i, sizeof(uint64_t)*MIN(n-i, CDC_BLOCK));
+		for (j = 0; j < CDC_BLOCK; j++) {
+			s = CDC_SIGN(w[j]);
+			x = (w[j] ^ -s) & CDC_WORD_MASK;
+			e = (x >> 48) & CDC_EXPONENT_MASK;
+			m = x & CDC_COEFF_MASK;
+			isInteger = -IS_ZERO(e);
+			isInfinite = -IS_ZERO(e ^ CDC_INFINITE);
+			isIndefinite = -IS_ZERO(e ^ CDC_INDEFINITE);
+			isSpecial = isInfinite | isIndefinite;
+
+			/* The coefficient is an integer, exactly representable as a
+			 * double: 2^52 + m, less 2^52.
+			 */
+			bits = IEEE_TWO_52 | m;
+			memcpy(&d, &bits, sizeof(d));
+			d -= 4503599627370496.0;
+
+			/* The exponent is biased by 2000 octal, in one's complement;
+			 * integers are scaled by one. The scale is always a double,
+			 * but the product can overflow to infinity for exponents
+			 * above 3720 octal.
+			 */
+			scale = (((e - 1 + (~e >> 10 & 1)) & ~isInteger) |
+			         (IEEE_BIAS & isInteger)) << 52;
+			memcpy(&f, &scale, sizeof(f));
+			d *= f;
+			memcpy(&bits, &d, sizeof(bits));
+			numInfinite += IS_ZERO((bits >> 52) ^ 03777) & ~isSpecial & 1;
+
+			/* Like i7tic, nc7tc makes negative integer zero plain zero. */
+			bits |= (s & ~IS_ZERO(e | m)) << 63;
+			bits = (bits & ~isSpecial) |
+			       (((IEEE_INFINITY & isInfinite) | (nan & isIndefinite) |
+			         (s << 63)) & isSpecial);
+			numUnnormalized += ~(isInteger | isSpecial) & ~m >> 47 & 1;
+			w[j] = bits;
+		}
+		memcpy(reals+i, w, sizeof(uint64_t)*MIN(n-i, CDC_BLOCK));
+	}
+
+	if (numOverflowed) {
+		*numOverflowed = numInfinite;
+	}
+
+	return numUnnormalized;
+}
+
+/**
+ * Converts 120-bit double-precision reals, each a pair of 60-bit words, to
+ * IEEE doubles. The upper word of a pair is converted as by cdc_reals(), but
+ * with the 48 coefficient bits of the lower word appended to its own, and
+ * the 96-bit coefficient rounded once to the nearest double. The loop has
+ * no branches, so that it is vectorized.
+ *
+ * @param words The pairs of words, upper word first, one word in the low 60
+ *        bits of each element.
+ * @param reals Receives one real per pair; may be the same array as `words'.
+ * @param n Number of pairs.
+ * @param nanPayload See cdc_reals().
+ * @param numOverflowed See cdc_reals().
+ * @return The number of unnormalized values.
+ */
+size_t cdc_doubles(uint64_t const*const words, double *const reals,
+                   const size_t n, const uint64_t nanPayload,
+                   size_t *const numOverflowed)
+{
+	const uint64_t nan = IEEE_QUIET_NAN | (nanPayload & IEEE_PAYLOAD_MASK);
+	size_t i, j, numUnnormalized = 0, numInfinite = 0;
+	uint64_t w[2*CDC_BLOCK], r[CDC_BLOCK], s, x, e, m, lo, bits, scale;
+	uint64_t isInteger, isInfinite, isIndefinite, isSpecial;
+	double d, l, f;
+
+	for (i = 0; i < n; i += CDC_BLOCK) {
+		if (i + CDC_BLOCK > n) {
+			memset(w, 0, sizeof(w));
+		}
+		memcpy(w, words+2*i, 2*sizeof(uint64_t)*MIN(n-i, CDC_BLOCK));
+		for (j = 0; j < CDC_BLOCK; j++) {
+			s = CDC_SIGN(w[2*j]);
+			x = (w[2*j] ^ -s) & CDC_WORD_MASK;
+			e = (x >> 48) & CDC_EXPONENT_MASK;
+			m = x & CDC_COEFF_MASK;
+			isInteger = -IS_ZERO(e);
+			isInfinite = -IS_ZERO(e ^ CDC_INFINITE);
+			isIndefinite = -IS_ZERO(e ^ CDC_INDEFINITE);
+			isSpecial = isInfinite | isIndefinite;
+			/* The lower word is complemented with the upper. */
+			lo = (w[2*j+1] ^ -s) & CDC_COEFF_MASK & ~isInteger;
+
+			/* Both halves of the coefficient are exact as doubles, and
+			 * their sum is the one rounding; scaling by a power of two is
+			 * exact.
+			 */
+			bits = IEEE_TWO_52 | m;
+			memcpy(&d, &bits, sizeof(d));
+			d -= 4503599627370496.0;
+			bits = IEEE_TWO_52 | lo;
+			memcpy(&l, &bits, sizeof(l));
+			l -= 4503599627370496.0;
+			d += l * 3.5527136788005009e-15; /* 2^-48 */
+
+			scale = (((e - 1 + (~e >> 10 & 1)) & ~isInteger) |
+			         (IEEE_BIAS & isInteger)) << 52;
+			memcpy(&f, &scale, sizeof(f));
+			d *= f;
+			memcpy(&bits, &d, sizeof(bits));
+			numInfinite += IS_ZERO((bits >> 52) ^ 03777) & ~isSpecial & 1;
+
+			bits |= (s & ~IS_ZERO(e | m | lo)) << 63;
+			bits = (bits & ~isSpecial) |
+			       (((IEEE_INFINITY & isInfinite) | (nan & isIndefinite) |
+			         (s << 63)) & isSpecial);
+			numUnnormalized += ~(isInteger | isSpecial) & ~m >> 47 & 1;
+			r[j] = bits;
+		}
+		memcpy(reals+i, r, sizeof(uint64_t)*MIN(n-i, CDC_BLOCK));
+	}
+
+	if (numOverflowed) {
+		*numOverflowed = numInfinite;
+	}
+
+	return numUnnormalized;
+}
+
+/**
+ * Converts 120-bit double-precision reals to IEEE binary128 (__float128)
+ * values, which hold their 96-bit coefficients exactly, and whose exponents
+ * never overflow. The values are built bit by bit, so no 128-bit floating
+ * point support is needed.
+ *
+ * @param words As for cdc_doubles().
+ * @param quads Receives two elements per pair: the binary128 value, in the
+ *        byte order of this machine. May be the same array as `words'.
+ * @param n Number of pairs.
+ * @param nanPayload The low 64 bits of the quiet NaNs made from indefinite
+ *        values.
+ * @return The number of unnormalized values.
+ */
+size_t cdc_quads(uint64_t const*const words, uint64_t *const quads,
+                 const size_t n, const uint64_t nanPayload)
+{
+	size_t i, numUnnormalized = 0;
+	uint64_t s, x, e, m, lo, cHi, cLo, fHi, fLo, hiBits, loBits;
+	int64_t exponent;
+	int top, k;
+
+	for (i = 0; i < n; i++) {
+		s = CDC_SIGN(words[2*i]);
+		x = (words[2*i] ^ -s) & CDC_WORD_MASK;
+		e = (x >> 48) & CDC_EXPONENT_MASK;
+		m = x & CDC_COEFF_MASK;
+		lo = (words[2*i+1] ^ -s) & CDC_COEFF_MASK;
+
+		/* The value is the coefficient cHi:cLo times 2^exponent. */
+		if (e == 0) {
+			cHi = 0;
+			cLo = m;
+			exponent = 0;
+			lo = 0;
+		} else {
+			cHi = m >> 16;
+			cLo = m << 48 | lo;
+			exponent = (int64_t) e - (e < 02000 ? 01777 : 02000) - 48;
+			numUnnormalized += e != CDC_INFINITE && e != CDC_INDEFINITE &&
+			                   !(m >> 47);
+		}
+
+		if (e == CDC_INFINITE) {
+			hiBits = QUAD_INFINITY;
+			loBits = 0;
+		} else if (e == CDC_INDEFINITE) {
+			hiBits = QUAD_QUIET_NAN;
+			loBits = nanPayload;
+		} else if (!cHi && !cLo) {
+			hiBits = loBits = 0;
+		} else {
+			/* Shift the leading one of the coefficient to bit 112, where
+			 * it is implied; at most 96 bits long, the coefficient fits.
+			 */
+			top = cHi ? 64 + 63 - __builtin_clzll(cHi)
+			          : 63 - __builtin_clzll(cLo);
+			k = 112 - top;
+			if (k >= 64) {
+				fHi = cLo << (k - 64);
+				fLo = 0;
+			} else {
+				fHi = cHi << k | cLo >> (64 - k);
+				fLo = cLo << k;
+			}
+			hiBits = (fHi & QUAD_FRACTION_MASK) |
+			         (uint64_t) (exponent + top + QUAD_BIAS) << 48;
+			loBits = fLo;
+		}
+		/* Like i7tic, nc7tc makes negative integer zero plain zero. */
+		if (s && (e || m || lo)) {
+			hiBits |= (uint64_t) 1 << 63;
+		}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		quads[2*i] = loBits;
+		quads[2*i+1] = hiBits;
+#else
+		quads[2*i] = hiBits;
+		quads[2*i+1] = loBits;
+#endif
+	}
+
+	return numUnnormalized;
+}
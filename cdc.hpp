@@ -37,6 +37,32 @@
 #ifndef CDC_HPP
 #define CDC_HPP
 
+#define CDC_SIGN(w)        (((w) >> 59) & 1)
+#define CDC_WORD_MASK      ((((uint64_t) 1) << 60) - 1)
+
+/* Width of the cards made by cdc_cosy_ascii(). */
+#define CDC_COSY_COLUMNS   80
+
 void cdc_decode(char *const str, const size_t len);
+void cdc_unpack(uint8_t const*const data, const unsigned bitOffset,
+                uint64_t *const words, const size_t n);
+void cdc_dpc_ascii(uint64_t const*const words, char *const str,
+                   const size_t numChars);
+void cdc_bcd_ascii(uint64_t const*const words, char *const str,
+                   const size_t numChars);
+void cdc_ebcdic_ascii(uint8_t const*const in, char *const out,
+                      const size_t n);
+void cdc_cosy_ascii(uint64_t const*const words, char *const card,
+                    const size_t numChars);
+void cdc_ints(uint64_t const*const words, int64_t *const ints,
+              const size_t n);
+size_t cdc_reals(uint64_t const*const words, double *const reals,
+                 const size_t n, const uint64_t nanPayload,
+                 size_t *const numOverflowed);
+size_t cdc_doubles(uint64_t const*const words, double *const reals,
+                   const size_t n, const uint64_t nanPayload,
+                   size_t *const numOverflowed);
+size_t cdc_quads(uint64_t const*const words, uint64_t *const quads,
+                 const size_t n, const uint64_t nanPayload);
 
 #endif
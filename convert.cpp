@@ -0,0 +1,881 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Conversion of the records of TBM files according to their data modes, as
+ * tbm2cos did in rcon().
+ *
+ * A record is `numBits'/60 words long, of which the last holds only
+ * `lastWordBits' bits of data. Records in display code (mode 0) or external
+ * BCD (mode 2) become one line of ASCII text each, EBCDIC records (mode 4)
+ * their bits packed as below with each whole byte translated to ASCII,
+ * one's-complement integers (mode 5) 64-bit
+ * two's-complement integers, reals (mode 6) IEEE doubles, and COSY card
+ * images (mode 7) lines of exactly 80 ASCII characters. Records of any
+ * other mode are written unconverted: their bits, packed together and
+ * zero-filled to a whole number of 64-bit words, as tbm2cos wrote them;
+ * those written in transparent mode (8) are followed, at the end of the
+ * file, by zeros filling out the last Cray block. tbm2cos's mode 9 writes
+ * each word right-justified in 64 bits. A mode may be given for every
+ * record, as with tbm2cos's MODE=i, in place of each record's own.
+ *
+ * Records may instead be framed (CONVERT_FRAMED): written unconverted, each
+ * after a header giving its mode and its exact length in bits, so that the
+ * records of a file can be told apart again without the archive.
+ *
+ * Nothing in a TBM file tells single-precision reals from double-precision
+ * ones, so records of reals are taken as pairs of words only in the ranges
+ * of records given in ConvertOptions.doubles. A record of an odd number of
+ * words is taken to end with a pair whose lower word is zero.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "gbytes.cpp"
+#include "cdc.hpp"
+#include "tbm.hpp"
+#include "libtbm.hpp"
+#include "convert.hpp"
+
+#ifndef MIN
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
+
+/* Size of Converter.packed for a record of `n' words, with room for the
+ * last 64-bit word of output to run past the last word of the record. */
+#define PACKED_SIZE(n) (DIV_CEIL(60*(n), 8) + 16)
+
+/**
+ * How the records of one mode are converted.
+ */
+typedef struct {
+	const char *name;
+	/** Number of bytes written for a record. */
+	size_t (*size)(Converter const*const conv,
+	               TBMRecordView const*const view);
+	/** Converts words to 64-bit values, `in' and `out' perhaps being the
+	    same, adds the number of reals too large for a double to
+	    `conv->numOverflowed', and returns the number of unnormalized reals
+	    among them. Runs of records of modes having a kernel are converted
+	    together. */
+	size_t (*kernel)(Converter *const conv, uint64_t const*const in,
+	                 uint64_t *const out, const size_t n);
+	/** Converts one record; used for modes having no kernel, and for
+	    double-precision reals. */
+	int (*record)(Converter *const conv, TBMRecordView const*const view,
+	              uint8_t *const out);
+} ModeConverter;
+
+static size_t size_dpc(Converter const*const conv,
+                       TBMRecordView const*const view);
+static size_t size_card(Converter const*const conv,
+                        TBMRecordView const*const view);
+static size_t size_words(Converter const*const conv,
+                         TBMRecordView const*const view);
+static size_t size_reals(Converter const*const conv,
+                         TBMRecordView const*const view);
+static size_t size_packed(Converter const*const conv,
+                          TBMRecordView const*const view);
+static size_t kernel_ints(Converter *const conv, uint64_t const*const in,
+                          uint64_t *const out, const size_t n);
+static size_t kernel_reals(Converter *const conv, uint64_t const*const in,
+                           uint64_t *const out, const size_t n);
+static size_t kernel_words(Converter *const conv, uint64_t const*const in,
+                           uint64_t *const out, const size_t n);
+static int convert_dpc(Converter *const conv, TBMRecordView const*const view,
+                       uint8_t *const out);
+static int convert_bcd(Converter *const conv, TBMRecordView const*const view,
+                       uint8_t *const out);
+static int convert_ebcdic(Converter *const conv,
+                          TBMRecordView const*const view, uint8_t *const out);
+static int convert_card(Converter *const conv,
+                        TBMRecordView const*const view, uint8_t *const out);
+static int convert_framed(Converter *const conv,
+                          TBMRecordView const*const view, uint8_t *const out);
+static int convert_doubles(Converter *const conv,
+                           TBMRecordView const*const view,
+                           uint8_t *const out);
+static int convert_packed(Converter *const conv,
+                          TBMRecordView const*const view, uint8_t *const out);
+static ModeConverter const *mode_converter(const int mode);
+static size_t record_chars(TBMRecordView const*const view);
+static uint64_t const *record_words(Converter *const conv,
+                                    TBMRecordView const*const view);
+static int is_double(Converter const*const conv,
+                     TBMRecordView const*const view);
+static int in_ranges(ConvertRange const*const ranges, const size_t n,
+                     TBMRecordView const*const view);
+static int reserve(Converter *const conv, const size_t numWords);
+static void store_words(Converter const*const conv, uint8_t *const out,
+                        const size_t numWords, const size_t itemWords);
+
+/* Converters of the modes, by mode. */
+static const ModeConverter modeConverters[CONVERT_MODE_MAX+1] = {
+	{ "display code", size_dpc,    NULL,         convert_dpc     },
+	{ "binary",       size_packed, NULL,         convert_packed  },
+	{ "BCD",          size_dpc,    NULL,         convert_bcd     },
+	{ "ASCII",        size_packed, NULL,         convert_packed  },
+	{ "EBCDIC",       size_packed, NULL,         convert_ebcdic  },
+	{ "integer",      size_words,  kernel_ints,  NULL            },
+	{ "real",         size_reals,  kernel_reals, convert_doubles },
+	{ "card image",   size_card,   NULL,         convert_card    },
+	{ "transparent",  size_packed, NULL,         convert_packed  },
+	{ "words",        size_words,  kernel_words, NULL            }
+};
+
+/* Records of any other mode are written as their packed bits. */
+static const ModeConverter unknownConverter =
+	{ "unknown",      size_packed, NULL,         convert_packed  };
+
+/**
+ * Parses an unsigned decimal number; signs and leading blanks, which
+ * strtoul() would skip, are refused.
+ *
+ * @param str
+ * @param value Receives the number.
+ * @return Pointer past the number, or NULL if `str' does not start with one.
+ */
+static const char *parse_number(const char str[], unsigned long *const value)
+{
+	char *end;
+
+	if (*str < '0' || *str > '9') {
+		return NULL;
+	}
+	errno = 0;
+	*value = strtoul(str, &end, 10);
+	if (errno == ERANGE) {
+		return NULL;
+	}
+
+	return end;
+}
+
+/**
+ * Parses a range of records: "F" for every record of file F, "F:R" for
+ * record R of it, or "F:R1-R2" for records R1 to R2.
+ *
+ * @param str
+ * @param range Receives the range.
+ * @return 0, or -1 if `str' is not a range.
+ */
+int convert_parse_range(const char str[], ConvertRange *const range)
+{
+	unsigned long file, first, last;
+
+	if (!(str = parse_number(str, &file)) || file > INT_MAX) {
+		return -1;
+	}
+	if (*str == '\0') {
+		first = 0;
+		last = (unsigned long) -1;
+	} else if (*str != ':' || !(str = parse_number(str + 1, &first))) {
+		return -1;
+	} else if (*str == '\0') {
+		last = first;
+	} else if (*str != '-' || !(str = parse_number(str + 1, &last))
+	           || *str != '\0' || last < first) {
+		return -1;
+	}
+
+	range->file = (int) file;
+	range->first = first;
+	range->last = last;
+
+	return 0;
+}
+
+/**
+ * @param conv
+ * @param opts How to convert; must outlive the Converter.
+ */
+void convert_init(Converter *const conv, ConvertOptions const*const opts)
+{
+	conv->opts = opts;
+	conv->numUnnormalized = 0;
+	conv->numOverflowed = 0;
+	conv->numMismatched = 0;
+	conv->transparent = 0;
+	memset(conv->numRecords, 0, sizeof(conv->numRecords));
+	conv->words = NULL;
+	conv->packed = NULL;
+	conv->capacity = 0;
+}
+
+void convert_free(Converter *const conv)
+{
+	free(conv->words);
+	free(conv->packed);
+	convert_init(conv, conv->opts);
+}
+
+/**
+ * Finishes converting a file. tbm2cos wrote files holding records of
+ * transparent mode (8) unblocked, filling out the last Cray block with
+ * zeros.
+ *
+ * @param conv
+ * @param size Number of bytes written for the file's records.
+ * @return The number of zero bytes to write after them.
+ */
+size_t convert_file_padding(Converter *const conv, const size_t size)
+{
+	const int transparent = conv->transparent;
+
+	conv->transparent = 0;
+	if (!transparent || size % CONVERT_TRANSPARENT_BLOCK == 0) {
+		return 0;
+	}
+	return CONVERT_TRANSPARENT_BLOCK - size % CONVERT_TRANSPARENT_BLOCK;
+}
+
+/**
+ * @param conv
+ * @param view
+ * @return The mode with which a record is converted: its own, or the one
+ *         given for every record.
+ */
+int convert_mode(Converter const*const conv, TBMRecordView const*const view)
+{
+	return conv->opts->mode == CONVERT_MODE_RECORD ? view->recordDataMode
+	                                               : conv->opts->mode;
+}
+
+/**
+ * @param conv
+ * @param view
+ * @return Whether a record is to be converted: whether it lies in any of
+ *         the ranges of ConvertOptions.selected, if there are any.
+ */
+int convert_selected(Converter const*const conv,
+                     TBMRecordView const*const view)
+{
+	return !conv->opts->numSelected ||
+	       in_ranges(conv->opts->selected, conv->opts->numSelected, view);
+}
+
+/**
+ * Records of integers (mode 5), reals (mode 6) and words (mode 9) are
+ * converted to 64-bit values, and so may be written as the elements of a
+ * NumPy array (CONVERT_NPY). Double-precision reals written as binary128
+ * values have no portable NumPy type.
+ *
+ * @param conv
+ * @param mode
+ * @return The NumPy array-protocol type string of the values to which
+ *         records of a mode are converted, or NULL if they are not numbers.
+ */
+const char *convert_npy_descr(Converter const*const conv, const int mode)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	const int big = conv->opts->flags & CONVERT_BIG_ENDIAN;
+#else
+	const int big = 1;
+#endif
+
+	switch (mode) {
+		case DATA_TYPE_BINARY_INTEGER:
+			return big ? ">i8" : "<i8";
+		case DATA_TYPE_FLOATING_POINT:
+			if (conv->opts->numDoubles &&
+			    (conv->opts->flags & CONVERT_QUAD))
+			{
+				return NULL;
+			}
+			return big ? ">f8" : "<f8";
+		case CONVERT_MODE_WORDS:
+			return big ? ">u8" : "<u8";
+		default:
+			return NULL;
+	}
+}
+
+/**
+ * The header of a framed record is a 64-bit big-endian word holding the
+ * record's mode (see convert_mode()) in its high eight bits and the exact
+ * length of the record in bits (see tbm_view_bits()) in the rest. The
+ * record's bits follow, packed and zero-filled to a whole number of 64-bit
+ * words.
+ *
+ * @param conv
+ * @param view
+ * @return The header of a record.
+ */
+uint64_t convert_framed_header(Converter const*const conv,
+                               TBMRecordView const*const view)
+{
+	return (uint64_t) convert_mode(conv, view) << 56 | tbm_view_bits(view);
+}
+
+/**
+ * @param mode
+ * @return A name for what records of a mode hold.
+ */
+const char *convert_mode_name(const int mode)
+{
+	return mode_converter(mode)->name;
+}
+
+/**
+ * @param conv
+ * @param view
+ * @return The number of bytes convert_records() writes for a record.
+ */
+size_t convert_size(Converter const*const conv,
+                    TBMRecordView const*const view)
+{
+	if (conv->opts->flags & CONVERT_FRAMED) {
+		return CONVERT_FRAME_HEADER + size_packed(conv, view);
+	}
+	return mode_converter(convert_mode(conv, view))->size(conv, view);
+}
+
+/**
+ * @param conv
+ * @param first The first record of a batch.
+ * @param view
+ * @return Whether a record may be converted in the same call of
+ *         convert_records() as `first': whether both are of the same mode,
+ *         and that mode's records are converted word by word. Framed
+ *         records may always be written together.
+ */
+int convert_can_batch(Converter const*const conv,
+                      TBMRecordView const*const first,
+                      TBMRecordView const*const view)
+{
+	const int mode = convert_mode(conv, first);
+
+	if (conv->opts->flags & CONVERT_FRAMED) {
+		return 1;
+	}
+	return convert_mode(conv, view) == mode &&
+	       mode_converter(mode)->kernel &&
+	       !is_double(conv, first) && !is_double(conv, view);
+}
+
+/**
+ * Converts a batch of records: either one record, or a run of records each
+ * of which convert_can_batch() with the first. The words of a run are
+ * converted with one call of their mode's kernel, so files in which modes
+ * are mixed cost little more to convert than files of one mode.
+ *
+ * @param conv
+ * @param views The records.
+ * @param n Number of records.
+ * @param out Receives the sum of convert_size() of the records, in bytes.
+ * @return TBM_OK, or TBM_ERR_NOMEM.
+ */
+int convert_records(Converter *const conv, TBMRecordView const*const views,
+                    const size_t n, uint8_t *const out)
+{
+	const int mode = convert_mode(conv, &views[0]);
+	ModeConverter const*const mc = mode_converter(mode);
+	uint64_t const *in;
+	uint8_t *o = out;
+	size_t numWords = 0, i;
+	int status;
+
+	if (conv->opts->flags & CONVERT_FRAMED) {
+		for (i = 0; i < n; i++) {
+			conv->numRecords[convert_mode(conv, &views[i])]++;
+			if ((status = convert_framed(conv, &views[i], o))) {
+				return status;
+			}
+			o += convert_size(conv, &views[i]);
+		}
+		return TBM_OK;
+	}
+
+	conv->numRecords[mode] += n;
+	if (mode == DATA_TYPE_TRANSPARENT) {
+		conv->transparent = 1;
+	}
+
+	if (!mc->kernel || is_double(conv, &views[0])) {
+		for (i = 0; i < n; i++) {
+			if ((status = mc->record(conv, &views[i], o))) {
+				return status;
+			}
+			o += mc->size(conv, &views[i]);
+		}
+		return TBM_OK;
+	}
+
+	for (i = 0; i < n; i++) {
+		numWords += views[i].numBits/60;
+	}
+	if (reserve(conv, numWords)) {
+		return TBM_ERR_NOMEM;
+	}
+	/* A record held whole in the word cache need not be copied. */
+	if (n > 1 || !(in = tbm_view_words(&views[0]))) {
+		for (i = 0, numWords = 0; i < n; i++) {
+			numWords += tbm_view_read(&views[i], 0, conv->words + numWords,
+			                          views[i].numBits/60);
+		}
+		in = conv->words;
+	}
+	conv->numUnnormalized += mc->kernel(conv, in, conv->words, numWords);
+	store_words(conv, out, numWords, 1);
+
+	return TBM_OK;
+}
+
+/**
+ * Display code: a character for every six bits, the last perhaps partly
+ * filled, and a newline.
+ */
+static size_t size_dpc(Converter const*const conv,
+                       TBMRecordView const*const view)
+{
+	(void) conv;
+
+	return record_chars(view) + 1;
+}
+
+/**
+ * COSY card images: 80 columns and a newline.
+ */
+static size_t size_card(Converter const*const conv,
+                        TBMRecordView const*const view)
+{
+	(void) conv;
+	(void) view;
+
+	return CDC_COSY_COLUMNS + 1;
+}
+
+/**
+ * Integers and words: 64 bits for every word.
+ */
+static size_t size_words(Converter const*const conv,
+                         TBMRecordView const*const view)
+{
+	(void) conv;
+
+	return 8*(view->numBits/60);
+}
+
+/**
+ * Reals: 64 bits for every word, or for every pair of words of
+ * double-precision reals, or 128 bits for every pair as binary128.
+ */
+static size_t size_reals(Converter const*const conv,
+                         TBMRecordView const*const view)
+{
+	const size_t numWords = view->numBits/60;
+
+	if (is_double(conv, view)) {
+		return (conv->opts->flags & CONVERT_QUAD ? 16 : 8) *
+		       ((numWords + 1)/2);
+	}
+	return 8*numWords;
+}
+
+/**
+ * Packed bits: zero-filled to a whole number of 64-bit words.
+ */
+static size_t size_packed(Converter const*const conv,
+                          TBMRecordView const*const view)
+{
+	const size_t bits = tbm_view_bits(view);
+
+	(void) conv;
+
+	return bits ? 8*DIV_CEIL(bits, 64) : 0;
+}
+
+static size_t kernel_ints(Converter *const conv, uint64_t const*const in,
+                          uint64_t *const out, const size_t n)
+{
+	(void) conv;
+
+	cdc_ints(in, (int64_t*) out, n);
+
+	return 0;
+}
+
+static size_t kernel_reals(Converter *const conv, uint64_t const*const in,
+                           uint64_t *const out, const size_t n)
+{
+	size_t numUnnormalized, numOverflowed;
+
+	numUnnormalized = cdc_reals(in, (double*) out, n, conv->opts->nanPayload,
+	                            &numOverflowed);
+	conv->numOverflowed += numOverflowed;
+
+	return numUnnormalized;
+}
+
+/**
+ * Words are written as they are decoded, right-justified in 64 bits.
+ */
+static size_t kernel_words(Converter *const conv, uint64_t const*const in,
+                           uint64_t *const out, const size_t n)
+{
+	(void) conv;
+
+	if (in != out) {
+		memcpy(out, in, sizeof(uint64_t)*n);
+	}
+
+	return 0;
+}
+
+static int convert_dpc(Converter *const conv, TBMRecordView const*const view,
+                       uint8_t *const out)
+{
+	uint64_t const *words;
+
+	if (!(words = record_words(conv, view))) {
+		return TBM_ERR_NOMEM;
+	}
+	cdc_dpc_ascii(words, (char*) out, record_chars(view));
+	out[record_chars(view)] = '\n';
+
+	return TBM_OK;
+}
+
+static int convert_bcd(Converter *const conv, TBMRecordView const*const view,
+                       uint8_t *const out)
+{
+	uint64_t const *words;
+
+	if (!(words = record_words(conv, view))) {
+		return TBM_ERR_NOMEM;
+	}
+	cdc_bcd_ascii(words, (char*) out, record_chars(view));
+	out[record_chars(view)] = '\n';
+
+	return TBM_OK;
+}
+
+/**
+ * Converts a record of EBCDIC characters, eight bits each, packed as the
+ * bits of ASCII records are. Bits after the last whole character are
+ * cleared.
+ */
+static int convert_ebcdic(Converter *const conv,
+                          TBMRecordView const*const view, uint8_t *const out)
+{
+	const size_t numChars = tbm_view_bits(view)/8;
+	int status;
+
+	if ((status = convert_packed(conv, view, out))) {
+		return status;
+	}
+	cdc_ebcdic_ascii(out, (char*) out, numChars);
+	memset(out+numChars, 0, size_packed(conv, view)-numChars);
+
+	return TBM_OK;
+}
+
+static int convert_card(Converter *const conv,
+                        TBMRecordView const*const view, uint8_t *const out)
+{
+	uint64_t const *words;
+
+	if (!(words = record_words(conv, view))) {
+		return TBM_ERR_NOMEM;
+	}
+	/* Only the first 80 characters are expanded. */
+	cdc_cosy_ascii(words, (char*) out,
+	               MIN(record_chars(view), CDC_COSY_COLUMNS));
+	out[CDC_COSY_COLUMNS] = '\n';
+
+	return TBM_OK;
+}
+
+/**
+ * Converts a record of double-precision reals.
+ */
+static int convert_doubles(Converter *const conv,
+                           TBMRecordView const*const view,
+                           uint8_t *const out)
+{
+	const size_t numWords = view->numBits/60;
+	const size_t numPairs = (numWords + 1)/2;
+	uint64_t const *words;
+	size_t i, numOverflowed;
+
+	if (!numWords) {
+		return TBM_OK;
+	}
+	if (!(words = record_words(conv, view))) {
+		return TBM_ERR_NOMEM;
+	}
+
+	/* A lone last word is given a lower word of zero of the same sign. */
+	if (numWords % 2) {
+		if (words != conv->words) {
+			memcpy(conv->words, words, sizeof(uint64_t)*numWords);
+			words = conv->words;
+		}
+		conv->words[numWords] = CDC_SIGN(words[numWords-1]) ?
+		                        CDC_WORD_MASK : 0;
+	}
+
+	/* The words of a pair have the same sign; pairs whose words don't are
+	 * likely single-precision reals converted by mistake.
+	 */
+	for (i = 0; i < numPairs; i++) {
+		conv->numMismatched += CDC_SIGN(words[2*i]) ^
+		                       CDC_SIGN(words[2*i+1]);
+	}
+
+	/* reserve() left room for the 2*numPairs words of binary128 values. */
+	if (conv->opts->flags & CONVERT_QUAD) {
+		conv->numUnnormalized += cdc_quads(words, conv->words, numPairs,
+		                                   conv->opts->nanPayload);
+		store_words(conv, out, 2*numPairs, 2);
+	} else {
+		conv->numUnnormalized += cdc_doubles(words, (double*) conv->words,
+		                                     numPairs, conv->opts->nanPayload,
+		                                     &numOverflowed);
+		conv->numOverflowed += numOverflowed;
+		store_words(conv, out, numPairs, 1);
+	}
+
+	return TBM_OK;
+}
+
+/**
+ * Writes the packed bits of a record. The bits of the last word beyond
+ * `lastWordBits' are kept, up to the end of the 64-bit word holding the last
+ * bit of data.
+ */
+static int convert_packed(Converter *const conv,
+                          TBMRecordView const*const view, uint8_t *const out)
+{
+	const size_t numWords = view->numBits/60;
+	const size_t size = size_packed(conv, view);
+	uint64_t const *words;
+	size_t n;
+
+	/* Records which lie whole in the archive, starting on a byte boundary,
+	 * are already packed as they are to be written.
+	 */
+	if (view->bitOffset == 0 && view->contiguousBits >= view->numBits) {
+		n = MIN(size, DIV_CEIL(view->numBits, 8));
+		memcpy(out, view->data, n);
+		/* The last word may end halfway through a byte. */
+		if (n == DIV_CEIL(view->numBits, 8) && view->numBits % 8) {
+			out[n-1] &= 0xFF << (8 - view->numBits % 8);
+		}
+		memset(out+n, 0, size-n);
+		return TBM_OK;
+	}
+
+	if (!(words = record_words(conv, view))) {
+		return TBM_ERR_NOMEM;
+	}
+	memset(conv->packed, 0, PACKED_SIZE(numWords));
+	sbytes<uint8_t,uint64_t>(conv->packed, words, 0, 60, 0, numWords);
+	memcpy(out, conv->packed, size);
+
+	return TBM_OK;
+}
+
+/**
+ * Writes a record's header (see convert_framed_header()) and its packed
+ * bits, clearing those past its last bit of data.
+ */
+static int convert_framed(Converter *const conv,
+                          TBMRecordView const*const view, uint8_t *const out)
+{
+	const uint64_t header = convert_framed_header(conv, view);
+	const size_t bits = tbm_view_bits(view);
+	uint8_t *const data = out + CONVERT_FRAME_HEADER;
+	const size_t n = bits ? DIV_CEIL(bits, 8) : 0;
+	int i, status;
+
+	for (i = 0; i < CONVERT_FRAME_HEADER; i++) {
+		out[i] = (uint8_t) (header >> (56 - 8*i));
+	}
+	if (!bits) {
+		return TBM_OK;
+	}
+	if ((status = convert_packed(conv, view, data))) {
+		return status;
+	}
+	if (bits % 8) {
+		data[n-1] &= 0xFF << (8 - bits % 8);
+	}
+	memset(data+n, 0, size_packed(conv, view)-n);
+
+	return TBM_OK;
+}
+
+/**
+ * @return The converter of a mode.
+ */
+static ModeConverter const *mode_converter(const int mode)
+{
+	return mode >= 0 && mode <= CONVERT_MODE_MAX ? &modeConverters[mode]
+	                                             : &unknownConverter;
+}
+
+/**
+ * @return The number of six-bit characters in a record, the last perhaps
+ *         partly filled.
+ */
+static size_t record_chars(TBMRecordView const*const view)
+{
+	const size_t bits = tbm_view_bits(view);
+
+	return bits ? DIV_CEIL(bits, 6) : 0;
+}
+
+/**
+ * Decodes the words of a record into the scratch space, which is made large
+ * enough for the record in any case.
+ *
+ * @return The words, or NULL if memory could not be allocated.
+ */
+static uint64_t const *record_words(Converter *const conv,
+                                    TBMRecordView const*const view)
+{
+	const size_t numWords = view->numBits/60;
+	uint64_t const *words;
+
+	if (reserve(conv, numWords)) {
+		return NULL;
+	}
+	/* Records held whole in the word cache need not be decoded. */
+	if (!(words = tbm_view_words(view))) {
+		tbm_view_read(view, 0, conv->words, numWords);
+		words = conv->words;
+	}
+
+	return words;
+}
+
+/**
+ * @return Whether a record of reals holds double-precision reals.
+ */
+static int is_double(Converter const*const conv,
+                     TBMRecordView const*const view)
+{
+	return convert_mode(conv, view) == DATA_TYPE_FLOATING_POINT &&
+	       in_ranges(conv->opts->doubles, conv->opts->numDoubles, view);
+}
+
+/**
+ * @return Whether a record lies in any of `n' ranges.
+ */
+static int in_ranges(ConvertRange const*const ranges, const size_t n,
+                     TBMRecordView const*const view)
+{
+	ConvertRange const *r;
+
+	for (r = ranges; r < ranges + n; r++) {
+		if (r->file == view->file && r->first <= view->record &&
+		    view->record <= r->last)
+		{
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Makes room in the scratch space for a record of `numWords' words, and one
+ * word more.
+ *
+ * @return 0 on success, or 1 if memory could not be allocated.
+ */
+static int reserve(Converter *const conv, const size_t numWords)
+{
+	uint64_t *words;
+	uint8_t *packed;
+
+	/* The scratch space is allocated even for records with no words, so
+	 * that a NULL pointer always means a failure.
+	 */
+	if (numWords <= conv->capacity && conv->words) {
+		return 0;
+	}
+	if (!(words = (uint64_t*) realloc(conv->words,
+	                                  sizeof(uint64_t)*(numWords+1))))
+	{
+		return 1;
+	}
+	conv->words = words;
+	if (!(packed = (uint8_t*) realloc(conv->packed, PACKED_SIZE(numWords))))
+	{
+		return 1;
+	}
+	conv->packed = packed;
+	conv->capacity = numWords;
+
+	return 0;
+}
+
+/**
+ * Copies converted words from the scratch space to the output, in the byte
+ * order asked for.
+ *
+ * @param conv
+ * @param out
+ * @param numWords
+ * @param itemWords Number of words in each value: 1, or 2 for binary128
+ *        values, whose halves are swapped as well as their bytes.
+ */
+static void store_words(Converter const*const conv, uint8_t *const out,
+                        const size_t numWords, const size_t itemWords)
+{
+	uint64_t t;
+	size_t i;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (conv->opts->flags & CONVERT_BIG_ENDIAN) {
+		for (i = 0; i < numWords; i++) {
+			conv->words[i] = __builtin_bswap64(conv->words[i]);
+		}
+		for (i = 0; itemWords == 2 && i < numWords; i += 2) {
+			t = conv->words[i];
+			conv->words[i] = conv->words[i+1];
+			conv->words[i+1] = t;
+		}
+	}
+#else
+	(void) itemWords;
+	(void) t;
+#endif
+	memcpy(out, conv->words, sizeof(uint64_t)*numWords);
+}
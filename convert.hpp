@@ -0,0 +1,146 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Conversion of the records of TBM files according to their data modes, as
+ * tbm2cos did in rcon().
+ */
+
+#ifndef CONVERT_HPP
+#define CONVERT_HPP
+
+#include "libtbm.hpp"
+
+/* Values of ConvertOptions.flags. */
+#define CONVERT_BIG_ENDIAN 1 /** Write integers and reals big-endian, as the
+                                 Cray did, rather than in the host's byte
+                                 order. */
+#define CONVERT_QUAD       2 /** Write double-precision reals as IEEE
+                                 binary128 rather than binary64. */
+#define CONVERT_FRAMED     4 /** Write each record unconverted, framed by
+                                 a header; see convert_framed_header(). */
+#define CONVERT_NPY        8 /** Write the integer, real or mode 9 records
+                                 of each file as one NumPy array; see
+                                 convert_npy_descr(). */
+
+/* Values of ConvertOptions.mode besides the DATA_TYPE_* values. */
+#define CONVERT_MODE_RECORD -1 /** Convert each record by its own mode. */
+#define CONVERT_MODE_WORDS   9 /** tbm2cos's mode 9: each 60-bit word
+                                   right-justified in a 64-bit word. */
+#define CONVERT_MODE_MAX     9
+
+/* Number of values of DataBufferFlags.recordDataMode. */
+#define CONVERT_NUM_MODES   64
+
+/* Most records, and most words, converted together by convert_records(). */
+#define CONVERT_BATCH_RECORDS 256
+#define CONVERT_BATCH_WORDS   65536
+
+/* Size of the header of a framed record. */
+#define CONVERT_FRAME_HEADER 8
+
+/* Transparent (mode 8) output is filled out with zeros to a whole number of
+ * these, the size of a Cray block. */
+#define CONVERT_TRANSPARENT_BLOCK 4096
+
+/**
+ * A run of records of one file: records `first' to `last' of file `file'.
+ */
+typedef struct {
+	int file;
+	size_t first;
+	size_t last;
+} ConvertRange;
+
+/**
+ * How records are to be converted; may be shared by many Converters.
+ */
+typedef struct {
+	int flags;                    /** CONVERT_* flags. */
+	int mode;                     /** Mode with which to convert every
+	                                  record, as tbm2cos's MODE=i, or
+	                                  CONVERT_MODE_RECORD. */
+	uint64_t nanPayload;          /** Payload of NaNs made from indefinite
+	                                  reals; see cdc_reals(). */
+	ConvertRange const *doubles;  /** Records of reals (mode 6) in these
+	                                  ranges hold double-precision reals, in
+	                                  pairs of words. */
+	size_t numDoubles;
+	ConvertRange const *selected; /** If any are given, only records in
+	                                  these ranges are converted. */
+	size_t numSelected;
+} ConvertOptions;
+
+/**
+ * Scratch space for converting records, and counts of what was found in
+ * them; one per thread.
+ */
+typedef struct {
+	ConvertOptions const *opts;
+	size_t numUnnormalized;  /** Number of unnormalized reals converted. */
+	size_t numOverflowed;    /** Number of reals too large for a double,
+	                             converted to infinities. */
+	size_t numMismatched;    /** Number of double-precision reals whose
+	                             words differ in sign, and so are probably
+	                             not pairs. */
+	int transparent;         /** A record of the current file was written
+	                             in transparent mode; see
+	                             convert_file_padding(). */
+	size_t numRecords[CONVERT_NUM_MODES]; /** Number of records converted
+	                                          with each mode. */
+	uint64_t *words;         /** Decoded words of the record being
+	                             converted. */
+	uint8_t *packed;         /** The same words packed back together. */
+	size_t capacity;         /** Number of words `words' can hold. */
+} Converter;
+
+int convert_parse_range(const char str[], ConvertRange *const range);
+void convert_init(Converter *const conv, ConvertOptions const*const opts);
+void convert_free(Converter *const conv);
+size_t convert_file_padding(Converter *const conv, const size_t size);
+int convert_mode(Converter const*const conv, TBMRecordView const*const view);
+int convert_selected(Converter const*const conv,
+                     TBMRecordView const*const view);
+const char *convert_npy_descr(Converter const*const conv, const int mode);
+uint64_t convert_framed_header(Converter const*const conv,
+                               TBMRecordView const*const view);
+const char *convert_mode_name(const int mode);
+size_t convert_size(Converter const*const conv,
+                    TBMRecordView const*const view);
+int convert_can_batch(Converter const*const conv,
+                      TBMRecordView const*const first,
+                      TBMRecordView const*const view);
+int convert_records(Converter *const conv, TBMRecordView const*const views,
+                    const size_t n, uint8_t *const out);
+
+#endif
@@ -0,0 +1,918 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * libtbm: reading TBM archives from within another program.
+ *
+ * Opening an archive maps it into memory (or reads it, if it can't be
+ * mapped) and builds its index (see tbmidx.hpp), so that everything after
+ * that is a lookup in the index plus decoding the words asked for.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gbytes.cpp"
+#include "tbm.hpp"
+#include "cdc.hpp"
+#include "tbmidx.hpp"
+#include "wordcache.hpp"
+#include "libtbm.hpp"
+
+struct TBMArchive {
+	uint8_t const *buf; /* The whole archive. */
+	size_t len;         /* Length of the archive in bytes. */
+	void *mapping;      /* If not NULL, `buf' is mapped and is unmapped on
+	                       close. */
+	uint8_t *owned;     /* If not NULL, `buf' was read into memory and is
+	                       freed on close. */
+	uint64_t inode;     /* The inode number and modification time (in
+	                       nanoseconds) of the file the archive was loaded
+	                       from, which key its index; zero if not a file. */
+	uint64_t mtime;
+	TBMIndex idx;
+	WordCache words;    /* If words.words is not NULL, records are read from
+	                       the shared word cache rather than decoded. */
+};
+
+/**
+ * State of tbm_stream_file().
+ */
+typedef struct {
+	TBMStreamFunc func;
+	void *arg;
+	uint8_t *buf;   /* TBM_STREAM_CHUNK_SIZE bytes. */
+	size_t len;     /* Number of bytes staged in `buf'. */
+	size_t written; /* Number of bytes of the file streamed so far. */
+} Stream;
+
+static int open_archive(TBMArchive *const archive, const char path[],
+                        const int flags);
+static int load_fd(TBMArchive *const archive, const int fd);
+static int stream_put(Stream *const s, uint8_t const*const inBuf,
+                      size_t offset, size_t len);
+static size_t segment_words(TBMArchive const*const archive,
+                            TBMIndexEntry const*const e);
+
+/**
+ * Opens the archive at `path'.
+ *
+ * @param archive Receives the archive; close with tbm_close().
+ * @param path
+ * @param flags Zero or more of the TBM_OPEN_* flags.
+ * @return TBM_OK, or one of the TBM_ERR_* values, in which case `*archive'
+ *         is NULL.
+ */
+int tbm_open_path(TBMArchive **const archive, const char path[],
+                  const int flags)
+{
+	TBMArchive *a;
+	int fd;
+	int status;
+	int err;
+
+	*archive = NULL;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return TBM_ERR_IO;
+	}
+	if (!(a = (TBMArchive*) calloc(1, sizeof(TBMArchive)))) {
+		close(fd);
+		return TBM_ERR_NOMEM;
+	}
+
+	/* A mapping outlives the descriptor it was made from. */
+	status = load_fd(a, fd);
+	close(fd);
+
+	if (status || (status = open_archive(a, path, flags))) {
+		err = errno;
+		tbm_close(a);
+		errno = err;
+		return status;
+	}
+
+	*archive = a;
+
+	return TBM_OK;
+}
+
+/**
+ * Opens the archive in the file open on `fd', from its start. The descriptor
+ * is not closed, and need not be kept open.
+ *
+ * @param archive Receives the archive; close with tbm_close().
+ * @param fd
+ * @return TBM_OK, or one of the TBM_ERR_* values, in which case `*archive'
+ *         is NULL.
+ */
+int tbm_open_fd(TBMArchive **const archive, const int fd)
+{
+	TBMArchive *a;
+	int status;
+	int err;
+
+	*archive = NULL;
+
+	if (!(a = (TBMArchive*) calloc(1, sizeof(TBMArchive)))) {
+		return TBM_ERR_NOMEM;
+	}
+
+	if ((status = load_fd(a, fd)) || (status = open_archive(a, NULL, 0))) {
+		err = errno;
+		tbm_close(a);
+		errno = err;
+		return status;
+	}
+
+	*archive = a;
+
+	return TBM_OK;
+}
+
+/**
+ * Opens an archive which is already in memory. The memory is not copied, and
+ * must stay valid and unchanged until the archive is closed.
+ *
+ * @param archive Receives the archive; close with tbm_close().
+ * @param buf The whole archive.
+ * @param len Length of the archive in bytes.
+ * @return TBM_OK, or one of the TBM_ERR_* values, in which case `*archive'
+ *         is NULL.
+ */
+int tbm_open_memory(TBMArchive **const archive, void const*const buf,
+                    const size_t len)
+{
+	TBMArchive *a;
+	int status;
+
+	*archive = NULL;
+
+	if (!(a = (TBMArchive*) calloc(1, sizeof(TBMArchive)))) {
+		return TBM_ERR_NOMEM;
+	}
+	a->buf = (uint8_t const*) buf;
+	a->len = len;
+
+	if ((status = open_archive(a, NULL, 0))) {
+		tbm_close(a);
+		return status;
+	}
+
+	*archive = a;
+
+	return TBM_OK;
+}
+
+/**
+ * Checks the labels of an archive and loads or builds its index.
+ *
+ * @param archive
+ * @param path Path of the archive, used to find its sidecar index; may be
+ *        NULL if `flags' does not include TBM_OPEN_INDEX.
+ * @param flags
+ * @return TBM_OK, or one of the TBM_ERR_* values.
+ */
+static int open_archive(TBMArchive *const archive, const char path[],
+                        const int flags)
+{
+	SYSLBN_Text syslbn_text;
+	SYSLBN_Data syslbn_data;
+	TBMIndex volume;
+	char *indexPath = NULL;
+	int status;
+
+	if (archive->len < BK_BLOCK_SIZE_BYTES) {
+		return TBM_ERR_FORMAT;
+	}
+	read_syslbn(archive->buf, &syslbn_text, &syslbn_data, 0);
+	if ((status = tbm_check_syslbn(&syslbn_data, archive->len))) {
+		return status;
+	}
+
+	/* Only a regular file has the metadata that keys an index. */
+	if ((flags & TBM_OPEN_INDEX) && archive->inode) {
+		if (!(indexPath = (char*) malloc(strlen(path) +
+		                                 sizeof(TBMIDX_SUFFIX))))
+		{
+			return TBM_ERR_NOMEM;
+		}
+		sprintf(indexPath, "%s%s", path, TBMIDX_SUFFIX);
+
+		volume.volumeSize = archive->len;
+		volume.volumeHash = tbmidx_hash(archive->buf,
+		                                syslbn_data.bk*BK_BLOCK_SIZE_BYTES);
+		volume.volumeInode = archive->inode;
+		volume.volumeMtime = archive->mtime;
+		if (!tbmidx_read(&archive->idx, indexPath, &volume)) {
+			free(indexPath);
+			return TBM_OK;
+		}
+	}
+
+	if ((status = tbmidx_build(archive->buf, archive->len, &archive->idx))) {
+		free(indexPath);
+		return status;
+	}
+	archive->idx.volumeInode = archive->inode;
+	archive->idx.volumeMtime = archive->mtime;
+
+	/* The index only saves time, so failing to save it is not an error. It
+	 * keeps the hash of the whole archive for tbm_use_word_cache(), so that
+	 * the archive, just walked to build the index, is read through only
+	 * this once.
+	 */
+	if (indexPath) {
+		archive->idx.contentHash = wordcache_hash(archive->buf, archive->len);
+		tbmidx_write(&archive->idx, indexPath);
+		free(indexPath);
+	}
+
+	return TBM_OK;
+}
+
+/**
+ * Maps the file open on `fd' into memory, or, if it can't be mapped (a pipe,
+ * say), reads everything remaining in it.
+ *
+ * @return TBM_OK, TBM_ERR_NOMEM, or TBM_ERR_IO with errno set.
+ */
+static int load_fd(TBMArchive *const archive, const int fd)
+{
+	size_t capacity = TBM_STREAM_CHUNK_SIZE;
+	struct stat st;
+	void *mapping;
+	uint8_t *b;
+	ssize_t n;
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		archive->inode = st.st_ino;
+		archive->mtime = 1000000000*(uint64_t) st.st_mtim.tv_sec +
+		                 st.st_mtim.tv_nsec;
+		if (st.st_size > 0 &&
+		    (mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd,
+		                    0)) != MAP_FAILED)
+		{
+			archive->mapping = mapping;
+			archive->buf = (uint8_t const*) mapping;
+			archive->len = st.st_size;
+			return TBM_OK;
+		}
+	}
+
+	archive->len = 0;
+	if (!(archive->owned = (uint8_t*) malloc(capacity))) {
+		return TBM_ERR_NOMEM;
+	}
+	archive->buf = archive->owned;
+
+	while ((n = read(fd, archive->owned + archive->len,
+	                 capacity - archive->len)) != 0)
+	{
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return TBM_ERR_IO;
+		}
+		archive->len += n;
+		if (archive->len == capacity) {
+			capacity *= 2;
+			if (!(b = (uint8_t*) realloc(archive->owned, capacity))) {
+				return TBM_ERR_NOMEM;
+			}
+			archive->owned = b;
+			archive->buf = b;
+		}
+	}
+
+	return TBM_OK;
+}
+
+/**
+ * Closes an archive.
+ *
+ * @param archive May be NULL.
+ */
+void tbm_close(TBMArchive *const archive)
+{
+	if (!archive) {
+		return;
+	}
+	tbmidx_free(&archive->idx);
+	wordcache_close(&archive->words);
+	if (archive->mapping) {
+		munmap(archive->mapping, archive->len);
+	}
+	free(archive->owned);
+	free(archive);
+}
+
+/**
+ * Reads the records of an archive from the shared decoded-word cache in
+ * `dir' from now on, decoding the whole archive into the cache first if no
+ * other process has (see wordcache.hpp). Opening the cache costs a full
+ * decode only once per archive, so it pays when many records are read, or
+ * the same archive is read by many processes. The cache file is found by a
+ * hash of the whole archive, which is kept in the sidecar index: an archive
+ * opened through an up-to-date index with TBM_OPEN_INDEX is not read at all
+ * here once its words are cached, while any other is read through once to
+ * hash it.
+ *
+ * @param archive
+ * @param dir The cache directory, which must exist and be writable.
+ * @return TBM_OK, or one of the TBM_ERR_* values, in which case records are
+ *         still decoded from the archive as before.
+ */
+int tbm_use_word_cache(TBMArchive *const archive, const char dir[])
+{
+	if (archive->words.words) {
+		return TBM_OK;
+	}
+	if (!archive->idx.contentHash) {
+		archive->idx.contentHash = wordcache_hash(archive->buf, archive->len);
+	}
+	return wordcache_open(&archive->words, dir, archive->buf, archive->len,
+	                      archive->idx.contentHash);
+}
+
+/**
+ * Describes one of the TBM_ERR_* values.
+ *
+ * @param err
+ */
+const char *tbm_strerror(const int err)
+{
+	switch (err) {
+		case TBM_OK:         return "success";
+		case TBM_ERR_IO:     return "read failed";
+		case TBM_ERR_NOMEM:  return "memory allocation failed";
+		case TBM_ERR_FORMAT: return "not a well-formed TBM archive";
+		case TBM_ERR_RANGE:  return "no such file or record";
+		default:             return "unknown error";
+	}
+}
+
+/**
+ * Gives access to the raw bytes of an archive, e.g. to verify its block
+ * checksums with tbm_verify().
+ *
+ * @param archive
+ * @param len Receives the length of the archive in bytes.
+ * @return The archive, which is valid until it is closed.
+ */
+uint8_t const *tbm_archive_data(TBMArchive const*const archive,
+                                size_t *const len)
+{
+	*len = archive->len;
+	return archive->buf;
+}
+
+/**
+ * Gets the SYSLBN (volume labels) of an archive.
+ *
+ * @param archive
+ * @param text
+ * @param data
+ */
+void tbm_archive_syslbn(TBMArchive const*const archive,
+                        SYSLBN_Text *const text, SYSLBN_Data *const data)
+{
+	*text = archive->idx.syslbn_text;
+	*data = archive->idx.syslbn_data;
+}
+
+/**
+ * Returns the number of files in an archive.
+ *
+ * @param archive
+ */
+int tbm_num_files(TBMArchive const*const archive)
+{
+	return archive->idx.numFiles;
+}
+
+/**
+ * Gets the labels, control pointers and sizes of one file of an archive.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param info
+ * @return TBM_OK, or TBM_ERR_RANGE if there is no such file.
+ */
+int tbm_file_info(TBMArchive const*const archive, const int file,
+                  TBMFileInfo *const info)
+{
+	TBMIndexFile const *f;
+
+	if (file < 0 || file >= archive->idx.numFiles) {
+		return TBM_ERR_RANGE;
+	}
+	f = &(archive->idx.files[file]);
+
+	info->file = f->file;
+	info->fcp = f->fcp;
+	info->fhw_data = f->fhw_data;
+	info->fhw_text = f->fhw_text;
+	info->size = DIV_CEIL(f->file.size, 8);
+	info->numSegments = f->numEntries;
+	info->numRecords = f->numRecords;
+
+	return TBM_OK;
+}
+
+/**
+ * Hands the data segments of every file of an archive to the callbacks of
+ * `ex', in order, exactly as tbm_extract() does. Decoding the segments in
+ * place this way avoids the copy made by tbm_stream_file().
+ *
+ * @param archive
+ * @param ex
+ * @return TBM_OK, TBM_ERR_NOMEM, or the first nonzero value returned by a
+ *         callback.
+ */
+int tbm_walk(TBMArchive const*const archive, TBMExtractor const*const ex)
+{
+	TBMFile *files;
+	int status;
+
+	if (!(files = (TBMFile*) malloc(sizeof(TBMFile)*
+	                                (archive->idx.numFiles+1))))
+	{
+		return TBM_ERR_NOMEM;
+	}
+
+	status = tbmidx_extract(&archive->idx, archive->buf, files, ex);
+
+	free(files);
+
+	return status;
+}
+
+/**
+ * Reads part of one file of an archive, as tbm_stream_file() would stream
+ * it, decoding only the data segments which overlap that part. The segment
+ * holding `pos' is found by binary search, so the time taken does not depend
+ * on where in the file `pos' is.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param pos Offset in the extracted file of the first byte to read.
+ * @param buf Receives the bytes.
+ * @param len Number of bytes to read; fewer are read if the file ends first.
+ * @return The number of bytes read, or TBM_ERR_RANGE if there is no such
+ *         file.
+ */
+ssize_t tbm_read_file(TBMArchive const*const archive, const int file,
+                      const size_t pos, uint8_t *const buf, size_t len)
+{
+	TBMIndexFile const *f;
+	TBMIndexEntry const *e;
+	size_t size, start, end, a, b;
+	uint64_t lo, hi, mid;
+
+	if (file < 0 || file >= archive->idx.numFiles) {
+		return TBM_ERR_RANGE;
+	}
+	f = &(archive->idx.files[file]);
+	size = DIV_CEIL(f->file.size, 8);
+	if (pos >= size) {
+		return 0;
+	}
+	if (len > size - pos) {
+		len = size - pos;
+	}
+	memset(buf, 0, len);
+
+	/* Find the last segment which starts at or before `pos'. */
+	lo = 0;
+	hi = f->numEntries;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo)/2;
+		if (archive->idx.entries[f->firstEntry + mid].writeOffset/8 <= pos) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (; lo < f->numEntries; lo++) {
+		e = &(archive->idx.entries[f->firstEntry + lo]);
+		start = e->writeOffset/8;
+		end = start + DIV_CEIL(60*(e->dbf.nextPtrOffset-1), 8);
+		if (start >= pos + len) {
+			break;
+		}
+		a = start > pos ? start : pos;
+		b = end < pos + len ? end : pos + len;
+		if (a < b) {
+			gbytes<uint8_t,uint8_t>(archive->buf, buf + (a - pos),
+			                        e->offset+60 + 8*(a - start), 8, 0, b - a);
+		}
+	}
+
+	return len;
+}
+
+/**
+ * Streams the contents of one file of an archive, exactly as tbmconv would
+ * write them, to `func' in chunks of up to TBM_STREAM_CHUNK_SIZE bytes.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param func
+ * @param arg Passed as the first argument of `func'.
+ * @return TBM_OK, TBM_ERR_RANGE if there is no such file, TBM_ERR_NOMEM, or
+ *         the first nonzero value returned by `func'.
+ */
+int tbm_stream_file(TBMArchive const*const archive, const int file,
+                    TBMStreamFunc func, void *arg)
+{
+	TBMIndexFile const *f;
+	TBMIndexEntry const *e;
+	Stream s;
+	uint64_t j;
+	int status = TBM_OK;
+
+	if (file < 0 || file >= archive->idx.numFiles) {
+		return TBM_ERR_RANGE;
+	}
+	f = &(archive->idx.files[file]);
+
+	s.func = func;
+	s.arg = arg;
+	s.len = 0;
+	s.written = 0;
+	if (!(s.buf = (uint8_t*) malloc(TBM_STREAM_CHUNK_SIZE))) {
+		return TBM_ERR_NOMEM;
+	}
+
+	/* Segments are aligned to 64-bit words in the extracted file; the gaps
+	 * between them are zero.
+	 */
+	for (j = 0; j < f->numEntries; j++) {
+		e = &(archive->idx.entries[f->firstEntry + j]);
+		if ((status = stream_put(&s, NULL, 0,
+		                         e->writeOffset/8 - s.written)) ||
+		    (status = stream_put(&s, archive->buf, e->offset+60,
+		                         DIV_CEIL(60*(e->dbf.nextPtrOffset-1), 8))))
+		{
+			goto done;
+		}
+	}
+	if ((status = stream_put(&s, NULL, 0,
+	                         DIV_CEIL(f->file.size, 8) - s.written)))
+	{
+		goto done;
+	}
+	if (s.len) {
+		status = func(arg, s.buf, s.len);
+	}
+
+done:
+	free(s.buf);
+	return status;
+}
+
+/**
+ * Appends `len' bytes, starting at bit `offset' of `inBuf', or zeros if
+ * `inBuf' is NULL, to a stream, passing each full chunk on.
+ *
+ * @return 0, or the nonzero value returned by the stream's function.
+ */
+static int stream_put(Stream *const s, uint8_t const*const inBuf,
+                      size_t offset, size_t len)
+{
+	size_t n;
+	int status;
+
+	while (len) {
+		n = TBM_STREAM_CHUNK_SIZE - s->len;
+		if (n > len) {
+			n = len;
+		}
+		if (inBuf) {
+			gbytes<uint8_t,uint8_t>(inBuf+(offset/8), s->buf+s->len,
+			                        offset%8, 8, 0, n);
+			offset += 8*n;
+		} else {
+			memset(s->buf+s->len, 0, n);
+		}
+		s->len += n;
+		s->written += n;
+		len -= n;
+
+		if (s->len == TBM_STREAM_CHUNK_SIZE) {
+			if ((status = s->func(s->arg, s->buf, s->len))) {
+				return status;
+			}
+			s->len = 0;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Returns the number of records in one file of an archive.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @return The number of records, or TBM_ERR_RANGE if there is no such file.
+ */
+ssize_t tbm_num_records(TBMArchive const*const archive, const int file)
+{
+	if (file < 0 || file >= archive->idx.numFiles) {
+		return TBM_ERR_RANGE;
+	}
+	return archive->idx.files[file].numRecords;
+}
+
+/**
+ * Returns the length of one record of a file.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param record Index of the record within the file.
+ * @return The length of the record in 60-bit words, or TBM_ERR_RANGE if
+ *         there is no such record.
+ */
+ssize_t tbm_record_length(TBMArchive const*const archive, const int file,
+                          const size_t record)
+{
+	TBMRecordView view;
+
+	if (tbm_record_view(archive, file, record, &view)) {
+		return TBM_ERR_RANGE;
+	}
+	return view.numBits/60;
+}
+
+/**
+ * Reads one record of a file. Only the words of that record are decoded, so
+ * when the archive is mapped only the pages holding it are read.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param record Index of the record within the file.
+ * @param words Receives the 60-bit words of the record, one per element.
+ * @param maxWords Length of `words'; a longer record is truncated.
+ * @return The length of the record in 60-bit words, which may be greater
+ *         than `maxWords', or TBM_ERR_RANGE if there is no such record.
+ */
+ssize_t tbm_read_record(TBMArchive const*const archive, const int file,
+                        const size_t record, uint64_t *const words,
+                        const size_t maxWords)
+{
+	TBMRecordView view;
+
+	if (tbm_record_view(archive, file, record, &view)) {
+		return TBM_ERR_RANGE;
+	}
+	tbm_view_read(&view, 0, words, maxWords);
+
+	return view.numBits/60;
+}
+
+/**
+ * Starts a walk through the records of one file of an archive.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param it
+ * @return TBM_OK, or TBM_ERR_RANGE if there is no such file.
+ */
+int tbm_records(TBMArchive const*const archive, const int file,
+                TBMRecordIter *const it)
+{
+	if (file < 0 || file >= archive->idx.numFiles) {
+		return TBM_ERR_RANGE;
+	}
+	it->archive = archive;
+	it->file = file;
+	it->record = 0;
+
+	return TBM_OK;
+}
+
+/**
+ * Yields the next record of a walk started by tbm_records().
+ *
+ * @param it
+ * @param view Receives the record.
+ * @return 1 if `view' was filled in, or 0 at the end of the file.
+ */
+int tbm_next_record(TBMRecordIter *const it, TBMRecordView *const view)
+{
+	if (tbm_record_view(it->archive, it->file, it->record, view)) {
+		return 0;
+	}
+	it->record++;
+
+	return 1;
+}
+
+/**
+ * Describes one record of a file without decoding it.
+ *
+ * @param archive
+ * @param file Index of the file within the archive.
+ * @param record Index of the record within the file.
+ * @param view Receives the record; valid until the archive is closed.
+ * @return TBM_OK, or TBM_ERR_RANGE if there is no such record.
+ */
+int tbm_record_view(TBMArchive const*const archive, const int file,
+                    const size_t record, TBMRecordView *const view)
+{
+	TBMIndex const*const idx = &archive->idx;
+	TBMIndexFile const *f;
+	TBMIndexEntry const *e;
+	uint64_t first, end, j, offset;
+
+	if (file < 0 || file >= idx->numFiles) {
+		return TBM_ERR_RANGE;
+	}
+	f = &(idx->files[file]);
+	if (record >= f->numRecords) {
+		return TBM_ERR_RANGE;
+	}
+	first = idx->records[f->firstRecord + record];
+	end = record+1 < f->numRecords ? idx->records[f->firstRecord + record+1]
+	                               : f->firstEntry + f->numEntries;
+
+	e = &(idx->entries[first]);
+	offset = e->offset+60;
+	view->data = archive->buf + offset/8;
+	view->bitOffset = offset%8;
+	view->contiguousBits = 60*segment_words(archive, e);
+	view->recordDataMode = e->dbf.recordDataMode;
+	view->dbf = e->dbf;
+	view->file = file;
+	view->record = record;
+	view->archive = archive;
+	view->firstSegment = first;
+	view->numSegments = end - first;
+
+	view->numBits = 0;
+	for (j = first; j < end; j++) {
+		view->numBits += 60*segment_words(archive, &(idx->entries[j]));
+	}
+	view->lastWordBits = idx->entries[end-1].dbf.numBits;
+
+	return TBM_OK;
+}
+
+/**
+ * @param view
+ * @return The exact length of a record in bits: its whole words but the
+ *         last, and the `lastWordBits' bits of the last.
+ */
+size_t tbm_view_bits(TBMRecordView const*const view)
+{
+	const size_t numWords = view->numBits/60;
+
+	return numWords ? 60*(numWords-1) + view->lastWordBits : 0;
+}
+
+/**
+ * Finds the decoded words of a record in the shared word cache, so that they
+ * can be used without being copied.
+ *
+ * @param view
+ * @return The words of the record, valid until the archive is closed, or
+ *         NULL if the archive has no word cache (see tbm_use_word_cache()) or
+ *         the record spans more than one data segment.
+ */
+uint64_t const *tbm_view_words(TBMRecordView const*const view)
+{
+	if (!view->archive->words.words || view->contiguousBits < view->numBits) {
+		return NULL;
+	}
+	return view->archive->words.words +
+	       view->archive->idx.entries[view->firstSegment].offset/60 + 1;
+}
+
+/**
+ * Decodes one word of a record.
+ *
+ * @param view
+ * @param i Index of the word; must be less than view->numBits/60.
+ * @return The 60-bit word.
+ */
+uint64_t tbm_view_word(TBMRecordView const*const view, const size_t i)
+{
+	const size_t offset = view->bitOffset + 60*i;
+	uint64_t word;
+
+	if (60*(i+1) <= view->contiguousBits && view->archive->words.words) {
+		word = view->archive->words.words[
+			view->archive->idx.entries[view->firstSegment].offset/60 + 1 + i];
+	} else if (60*(i+1) <= view->contiguousBits) {
+		cdc_unpack(view->data+(offset/8), offset%8, &word, 1);
+	} else {
+		tbm_view_read(view, i, &word, 1);
+	}
+
+	return word;
+}
+
+/**
+ * Decodes a run of words of a record.
+ *
+ * @param view
+ * @param first Index of the first word to decode.
+ * @param words Receives the 60-bit words, one per element.
+ * @param maxWords Number of words to decode; fewer are decoded if the record
+ *        ends first.
+ * @return The number of words decoded.
+ */
+size_t tbm_view_read(TBMRecordView const*const view, const size_t first,
+                     uint64_t *const words, const size_t maxWords)
+{
+	TBMIndexEntry const *e;
+	size_t skip = first, len = 0, n, j;
+	uint64_t offset;
+
+	for (j = 0; j < view->numSegments && len < maxWords; j++) {
+		e = &(view->archive->idx.entries[view->firstSegment + j]);
+		n = segment_words(view->archive, e);
+		if (skip >= n) {
+			skip -= n;
+			continue;
+		}
+		n -= skip;
+		if (n > maxWords - len) {
+			n = maxWords - len;
+		}
+		offset = e->offset+60 + 60*skip;
+		if (view->archive->words.words) {
+			memcpy(words+len, view->archive->words.words + offset/60,
+			       sizeof(uint64_t)*n);
+		} else {
+			cdc_unpack(view->archive->buf+(offset/8), offset%8, words+len,
+			           n);
+		}
+		len += n;
+		skip = 0;
+	}
+
+	return len;
+}
+
+/**
+ * @param archive
+ * @param e A data segment.
+ * @return The number of words of record data in the segment: all of the
+ *         words up to the next DBF, or, if the DBF says the record is
+ *         shorter, as many as bits 0-21 of its first word give.
+ */
+static size_t segment_words(TBMArchive const*const archive,
+                            TBMIndexEntry const*const e)
+{
+	const size_t numWords = e->dbf.nextPtrOffset-1;
+	uint64_t first;
+
+	if (!e->dbf.recordIsShorter || numWords == 0) {
+		return numWords;
+	}
+	cdc_unpack(archive->buf+((e->offset+60)/8), (e->offset+60)%8, &first, 1);
+	first &= 017777777;
+
+	return first < numWords ? first : numWords;
+}
@@ -0,0 +1,136 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * The C interface of libtbm, for programs in C and for foreign function
+ * interfaces such as Python's ctypes and cffi.
+ *
+ * Unlike libtbm.hpp, this header is plain C, uses only fixed-size types and
+ * opaque handles, and keeps its structures' layouts across versions: new
+ * fields are only ever added at the end of a structure, and new functions
+ * and constants only ever added. tbmc_version() returns TBMC_VERSION of the
+ * library actually loaded.
+ *
+ * Decoded data is returned in a TBMCBuffer, which describes its memory the
+ * way numpy's array interface does (pointer, element type, shape, strides in
+ * bytes), so that it can be wrapped as an array without being copied.
+ */
+
+#ifndef LIBTBM_H
+#define LIBTBM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TBMC_VERSION 1
+
+/* Values of TBMCBuffer.type. */
+#define TBMC_TYPE_UINT8   1 /** Bytes of an extracted file. */
+#define TBMC_TYPE_UINT64  2 /** 60-bit words, right-justified. */
+#define TBMC_TYPE_INT64   3 /** Words converted from one's complement. */
+#define TBMC_TYPE_FLOAT64 4 /** Words converted from CDC reals. */
+
+/* Flags for tbmc_open(). */
+#define TBMC_OPEN_INDEX 1 /** Use or create the sidecar index. */
+
+/* Error codes; the same as libtbm's TBM_ERR_* values. */
+#define TBMC_OK          0
+#define TBMC_ERR_IO     -1
+#define TBMC_ERR_NOMEM  -2
+#define TBMC_ERR_FORMAT -3
+#define TBMC_ERR_RANGE  -4
+
+typedef struct TBMArchive TBMArchive;
+
+/**
+ * What is known about one file of an archive.
+ */
+typedef struct {
+	char dataSetID[18];   /** From the HDR1 label; NUL-terminated. */
+	uint64_t size;        /** Size of the extracted file in bytes. */
+	uint64_t numSegments;
+	uint64_t numRecords;
+} TBMCFileInfo;
+
+/**
+ * Decoded data: element (i, j) is at data + i*strides[0] + j*strides[1].
+ * One-dimensional buffers have ndim 1 and shape[1] and strides[1] 0.
+ */
+typedef struct {
+	void *data;
+	int32_t type;          /** One of the TBMC_TYPE_* values. */
+	int32_t itemSize;      /** Size of an element in bytes. */
+	int32_t ndim;          /** 1 or 2. */
+	int32_t readOnly;      /** 1 if `data' points into the archive's word
+	                           cache and must not be written. */
+	uint64_t shape[2];
+	int64_t strides[2];
+	void *owner;           /** Private; see tbmc_buffer_free(). */
+} TBMCBuffer;
+
+int32_t tbmc_version(void);
+const char *tbmc_strerror(int32_t err);
+
+int32_t tbmc_open(TBMArchive **archive, const char *path, int32_t flags);
+int32_t tbmc_open_memory(TBMArchive **archive, const void *buf,
+                         uint64_t len);
+void tbmc_close(TBMArchive *archive);
+int32_t tbmc_use_word_cache(TBMArchive *archive, const char *dir);
+
+int32_t tbmc_num_files(const TBMArchive *archive);
+int32_t tbmc_file_info(const TBMArchive *archive, int32_t file,
+                       TBMCFileInfo *info);
+int64_t tbmc_read_file(const TBMArchive *archive, int32_t file,
+                       uint64_t pos, void *buf, uint64_t len);
+int32_t tbmc_file(const TBMArchive *archive, int32_t file, TBMCBuffer *buf);
+
+int64_t tbmc_num_records(const TBMArchive *archive, int32_t file);
+int64_t tbmc_record_length(const TBMArchive *archive, int32_t file,
+                           uint64_t record);
+int32_t tbmc_record_mode(const TBMArchive *archive, int32_t file,
+                         uint64_t record);
+int32_t tbmc_record(const TBMArchive *archive, int32_t file, uint64_t record,
+                    int32_t type, TBMCBuffer *buf);
+int32_t tbmc_records(const TBMArchive *archive, int32_t file, uint64_t first,
+                     uint64_t count, int32_t type, TBMCBuffer *buf);
+void tbmc_buffer_free(TBMCBuffer *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
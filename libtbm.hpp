@@ -0,0 +1,162 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * libtbm: reading TBM archives from within another program.
+ *
+ * An archive is opened from a path, a file descriptor or memory, which
+ * checks its labels and walks its control structures once. Its files can
+ * then be listed and their contents streamed, or individual records read or
+ * viewed in place, in any order. Functions report failures by returning one of the TBM_ERR_*
+ * values rather than by printing or aborting.
+ */
+
+#ifndef LIBTBM_HPP
+#define LIBTBM_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "tbm.hpp"
+
+/* Flags for tbm_open_path(). */
+#define TBM_OPEN_INDEX 1 /** Use the sidecar index of the archive if it is up
+                             to date, and (try to) create it if not. */
+
+/* Size of the chunks handed to a TBMStreamFunc. */
+#define TBM_STREAM_CHUNK_SIZE (1 << 20)
+
+/**
+ * An open TBM archive.
+ */
+typedef struct TBMArchive TBMArchive;
+
+/**
+ * What is known about one file of an archive without extracting it.
+ */
+typedef struct {
+	TBMFile file;         /** Labels of the file; file.size is in bits. */
+	FileControlPointer fcp;
+	FileHistoryWord_Data fhw_data;
+	FileHistoryWord_Text fhw_text;
+	size_t size;          /** Size of the extracted file in bytes. */
+	size_t numSegments;   /** Number of data segments in the file. */
+	size_t numRecords;    /** Number of records in the file. */
+} TBMFileInfo;
+
+/**
+ * Receives the contents of a file from tbm_stream_file(), `len' bytes at a
+ * time, in order. Returning nonzero stops the stream.
+ */
+typedef int (*TBMStreamFunc)(void *arg, uint8_t const*const data,
+                             const size_t len);
+
+/**
+ * One record of a file, as it lies in the archive. Nothing is copied or
+ * decoded until the words are asked for with tbm_view_word() or
+ * tbm_view_read(); consumers which can work on the packed bits directly may
+ * use `data' and `bitOffset' for the first `contiguousBits' bits.
+ */
+typedef struct {
+	uint8_t const *data;      /** Byte of the archive holding the first bit
+	                              of the record. */
+	unsigned bitOffset;       /** Offset of the first bit within data[0],
+	                              counting from the most significant bit. */
+	size_t numBits;           /** Length of the record in bits, counting
+	                              the whole of the last word; see
+	                              tbm_view_bits(). */
+	size_t contiguousBits;    /** Number of bits of the record stored without
+	                              a break from its first bit; less than
+	                              `numBits' only if the record spans more than
+	                              one data segment. */
+	unsigned recordDataMode;  /** One of the DATA_TYPE_* values. */
+	unsigned lastWordBits;    /** Number of bits of the last word which hold
+	                              data, from the flags of the last segment. */
+	DataBufferFlags dbf;      /** Flags of the record's first segment. */
+	int file;
+	size_t record;
+	/* Private. */
+	TBMArchive const *archive;
+	size_t firstSegment;
+	size_t numSegments;
+} TBMRecordView;
+
+/**
+ * Position of a walk through the records of a file; see tbm_records().
+ */
+typedef struct {
+	TBMArchive const *archive;
+	int file;
+	size_t record; /** Index of the record tbm_next_record() yields next. */
+} TBMRecordIter;
+
+int tbm_open_path(TBMArchive **const archive, const char path[],
+                  const int flags);
+int tbm_open_fd(TBMArchive **const archive, const int fd);
+int tbm_open_memory(TBMArchive **const archive, void const*const buf,
+                    const size_t len);
+void tbm_close(TBMArchive *const archive);
+int tbm_use_word_cache(TBMArchive *const archive, const char dir[]);
+const char *tbm_strerror(const int err);
+
+uint8_t const *tbm_archive_data(TBMArchive const*const archive,
+                                size_t *const len);
+void tbm_archive_syslbn(TBMArchive const*const archive,
+                        SYSLBN_Text *const text, SYSLBN_Data *const data);
+int tbm_num_files(TBMArchive const*const archive);
+int tbm_file_info(TBMArchive const*const archive, const int file,
+                  TBMFileInfo *const info);
+
+int tbm_walk(TBMArchive const*const archive, TBMExtractor const*const ex);
+int tbm_stream_file(TBMArchive const*const archive, const int file,
+                    TBMStreamFunc func, void *arg);
+ssize_t tbm_read_file(TBMArchive const*const archive, const int file,
+                      const size_t pos, uint8_t *const buf, size_t len);
+ssize_t tbm_num_records(TBMArchive const*const archive, const int file);
+ssize_t tbm_record_length(TBMArchive const*const archive, const int file,
+                          const size_t record);
+ssize_t tbm_read_record(TBMArchive const*const archive, const int file,
+                        const size_t record, uint64_t *const words,
+                        const size_t maxWords);
+
+int tbm_records(TBMArchive const*const archive, const int file,
+                TBMRecordIter *const it);
+int tbm_next_record(TBMRecordIter *const it, TBMRecordView *const view);
+int tbm_record_view(TBMArchive const*const archive, const int file,
+                    const size_t record, TBMRecordView *const view);
+size_t tbm_view_bits(TBMRecordView const*const view);
+uint64_t const *tbm_view_words(TBMRecordView const*const view);
+uint64_t tbm_view_word(TBMRecordView const*const view, const size_t i);
+size_t tbm_view_read(TBMRecordView const*const view, const size_t first,
+                     uint64_t *const words, const size_t maxWords);
+
+#endif
@@ -0,0 +1,349 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * The C interface of libtbm; see libtbm.h.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "tbm.hpp"
+#include "cdc.hpp"
+#include "libtbm.hpp"
+#include "libtbm.h"
+
+/* Number of words converted at a time. */
+#define CONVERT_CHUNK_WORDS 1024
+
+/* The C interface promises the same error codes as libtbm. */
+typedef char ErrorCodesMatch[(TBMC_ERR_IO == TBM_ERR_IO &&
+                               TBMC_ERR_NOMEM == TBM_ERR_NOMEM &&
+                               TBMC_ERR_FORMAT == TBM_ERR_FORMAT &&
+                               TBMC_ERR_RANGE == TBM_ERR_RANGE) ? 1 : -1];
+
+static int convert_record(TBMRecordView const*const view, const int32_t type,
+                          uint8_t *const out);
+static size_t type_size(const int32_t type);
+
+int32_t tbmc_version(void)
+{
+	return TBMC_VERSION;
+}
+
+const char *tbmc_strerror(int32_t err)
+{
+	return tbm_strerror(err);
+}
+
+int32_t tbmc_open(TBMArchive **archive, const char *path, int32_t flags)
+{
+	return tbm_open_path(archive, path,
+	                     (flags & TBMC_OPEN_INDEX) ? TBM_OPEN_INDEX : 0);
+}
+
+int32_t tbmc_open_memory(TBMArchive **archive, const void *buf, uint64_t len)
+{
+	return tbm_open_memory(archive, buf, len);
+}
+
+void tbmc_close(TBMArchive *archive)
+{
+	tbm_close(archive);
+}
+
+int32_t tbmc_use_word_cache(TBMArchive *archive, const char *dir)
+{
+	return tbm_use_word_cache(archive, dir);
+}
+
+int32_t tbmc_num_files(const TBMArchive *archive)
+{
+	return tbm_num_files(archive);
+}
+
+int32_t tbmc_file_info(const TBMArchive *archive, int32_t file,
+                       TBMCFileInfo *info)
+{
+	TBMFileInfo fi;
+	int status;
+
+	if ((status = tbm_file_info(archive, file, &fi))) {
+		return status;
+	}
+	memset(info, 0, sizeof(TBMCFileInfo));
+	memcpy(info->dataSetID, fi.file.hdr1_text.dataSetID,
+	       sizeof(fi.file.hdr1_text.dataSetID));
+	info->size = fi.size;
+	info->numSegments = fi.numSegments;
+	info->numRecords = fi.numRecords;
+
+	return TBMC_OK;
+}
+
+int64_t tbmc_read_file(const TBMArchive *archive, int32_t file, uint64_t pos,
+                       void *buf, uint64_t len)
+{
+	return tbm_read_file(archive, file, pos, (uint8_t*) buf, len);
+}
+
+/**
+ * Extracts a whole file into a new buffer of TBMC_TYPE_UINT8.
+ */
+int32_t tbmc_file(const TBMArchive *archive, int32_t file, TBMCBuffer *buf)
+{
+	TBMFileInfo fi;
+	uint8_t *data;
+	ssize_t n;
+	int status;
+
+	memset(buf, 0, sizeof(TBMCBuffer));
+	if ((status = tbm_file_info(archive, file, &fi))) {
+		return status;
+	}
+	if (!(data = (uint8_t*) malloc(fi.size+1))) {
+		return TBMC_ERR_NOMEM;
+	}
+	if ((n = tbm_read_file(archive, file, 0, data, fi.size)) !=
+	    (ssize_t) fi.size)
+	{
+		free(data);
+		return n < 0 ? (int32_t) n : TBMC_ERR_FORMAT;
+	}
+
+	buf->data = data;
+	buf->owner = data;
+	buf->type = TBMC_TYPE_UINT8;
+	buf->itemSize = 1;
+	buf->ndim = 1;
+	buf->shape[0] = fi.size;
+	buf->strides[0] = 1;
+
+	return TBMC_OK;
+}
+
+int64_t tbmc_num_records(const TBMArchive *archive, int32_t file)
+{
+	return tbm_num_records(archive, file);
+}
+
+int64_t tbmc_record_length(const TBMArchive *archive, int32_t file,
+                           uint64_t record)
+{
+	return tbm_record_length(archive, file, record);
+}
+
+/**
+ * @return The recordDataMode of a record (one of the DATA_TYPE_* values), or
+ *         TBMC_ERR_RANGE if there is no such record.
+ */
+int32_t tbmc_record_mode(const TBMArchive *archive, int32_t file,
+                         uint64_t record)
+{
+	TBMRecordView view;
+	int status;
+
+	if ((status = tbm_record_view(archive, file, record, &view))) {
+		return status;
+	}
+	return view.recordDataMode;
+}
+
+/**
+ * Decodes one record into a one-dimensional buffer.
+ */
+int32_t tbmc_record(const TBMArchive *archive, int32_t file, uint64_t record,
+                    int32_t type, TBMCBuffer *buf)
+{
+	int status;
+
+	if ((status = tbmc_records(archive, file, record, 1, type, buf))) {
+		return status;
+	}
+	buf->ndim = 1;
+	buf->shape[0] = buf->shape[1];
+	buf->strides[0] = buf->strides[1];
+	buf->shape[1] = 0;
+	buf->strides[1] = 0;
+
+	return TBMC_OK;
+}
+
+/**
+ * Decodes a run of records of the same length into a two-dimensional buffer
+ * of `count' rows by the number of words in each record.
+ *
+ * Words wanted as TBMC_TYPE_UINT64 are not copied if the archive has a word
+ * cache (see tbmc_use_word_cache()) and the records lie in the cache at
+ * equal intervals; the buffer then points into the cache and is read-only.
+ *
+ * @return TBMC_OK, TBMC_ERR_RANGE if a record does not exist or `type' is
+ *         not one of the TBMC_TYPE_* values for words, TBMC_ERR_FORMAT if the
+ *         records are not all of the same length, or TBMC_ERR_NOMEM.
+ */
+int32_t tbmc_records(const TBMArchive *archive, int32_t file, uint64_t first,
+                     uint64_t count, int32_t type, TBMCBuffer *buf)
+{
+	TBMRecordView view;
+	uint64_t const *words, *firstWords = NULL;
+	uint8_t *data;
+	size_t numWords = 0, itemSize;
+	int64_t step = 0;
+	int shared = type == TBMC_TYPE_UINT64;
+	uint64_t i;
+	int status;
+
+	memset(buf, 0, sizeof(TBMCBuffer));
+	if (!(itemSize = type_size(type)) || type == TBMC_TYPE_UINT8 ||
+	    count == 0)
+	{
+		return TBMC_ERR_RANGE;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((status = tbm_record_view(archive, file, first+i, &view))) {
+			return status;
+		}
+		if (i == 0) {
+			numWords = view.numBits/60;
+		} else if (view.numBits/60 != numWords) {
+			return TBMC_ERR_FORMAT;
+		}
+		if (shared) {
+			words = tbm_view_words(&view);
+			if (!words) {
+				shared = 0;
+			} else if (i == 0) {
+				firstWords = words;
+			} else if (i == 1) {
+				step = words - firstWords;
+			} else if (words - firstWords != step*(int64_t) i) {
+				shared = 0;
+			}
+		}
+	}
+
+	buf->type = type;
+	buf->itemSize = itemSize;
+	buf->ndim = 2;
+	buf->shape[0] = count;
+	buf->shape[1] = numWords;
+	buf->strides[1] = itemSize;
+
+	if (shared) {
+		buf->data = (void*) firstWords;
+		buf->readOnly = 1;
+		buf->strides[0] = step*sizeof(uint64_t);
+		return TBMC_OK;
+	}
+
+	if (!(data = (uint8_t*) malloc(count*numWords*itemSize+1))) {
+		return TBMC_ERR_NOMEM;
+	}
+	for (i = 0; i < count; i++) {
+		tbm_record_view(archive, file, first+i, &view);
+		if ((status = convert_record(&view, type,
+		                             data + i*numWords*itemSize)))
+		{
+			free(data);
+			memset(buf, 0, sizeof(TBMCBuffer));
+			return status;
+		}
+	}
+	buf->data = data;
+	buf->owner = data;
+	buf->strides[0] = numWords*itemSize;
+
+	return TBMC_OK;
+}
+
+/**
+ * Frees the memory of a buffer, if it has its own. Buffers which point into
+ * an archive's word cache need not be freed, but are only valid until the
+ * archive is closed.
+ */
+void tbmc_buffer_free(TBMCBuffer *buf)
+{
+	free(buf->owner);
+	memset(buf, 0, sizeof(TBMCBuffer));
+}
+
+/**
+ * Decodes and converts every word of a record.
+ *
+ * @return TBMC_OK, or TBMC_ERR_FORMAT if fewer words could be read than the
+ *         record holds.
+ */
+static int convert_record(TBMRecordView const*const view, const int32_t type,
+                          uint8_t *const out)
+{
+	uint64_t words[CONVERT_CHUNK_WORDS];
+	const size_t numWords = view->numBits/60;
+	size_t i, n;
+
+	if (type == TBMC_TYPE_UINT64) {
+		if (tbm_view_read(view, 0, (uint64_t*) out, numWords) != numWords) {
+			return TBMC_ERR_FORMAT;
+		}
+		return TBMC_OK;
+	}
+
+	for (i = 0; i < numWords; i += n) {
+		n = tbm_view_read(view, i, words, CONVERT_CHUNK_WORDS);
+		if (n == 0 || n > numWords - i) {
+			return TBMC_ERR_FORMAT;
+		}
+		if (type == TBMC_TYPE_INT64) {
+			cdc_ints(words, (int64_t*) out + i, n);
+		} else {
+			cdc_reals(words, (double*) out + i, n, 0, NULL);
+		}
+	}
+
+	return TBMC_OK;
+}
+
+/**
+ * @return The size of an element of a type, or 0 if there is no such type.
+ */
+static size_t type_size(const int32_t type)
+{
+	switch (type) {
+		case TBMC_TYPE_UINT8:   return sizeof(uint8_t);
+		case TBMC_TYPE_UINT64:  return sizeof(uint64_t);
+		case TBMC_TYPE_INT64:   return sizeof(int64_t);
+		case TBMC_TYPE_FLOAT64: return sizeof(double);
+		default:                return 0;
+	}
+}
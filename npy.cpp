@@ -0,0 +1,93 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Headers of NumPy .npy files (format version 1.0).
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "npy.hpp"
+
+static const char npyMagic[] = "\x93NUMPY";
+
+/**
+ * Writes the header of a .npy file holding a C-ordered array.
+ *
+ * @param out Receives the header.
+ * @param len Size of `out' in bytes.
+ * @param descr The array-protocol type string of the elements, such as
+ *        "<i8" or ">f8".
+ * @param shape Length of each dimension of the array.
+ * @param ndim Number of dimensions; at most NPY_MAX_DIMS.
+ * @return The length of the header, a multiple of NPY_ALIGNMENT, after which
+ *         the elements follow; or 0 if it would not fit in `len' bytes.
+ */
+size_t npy_header(uint8_t *const out, const size_t len, const char descr[],
+                  size_t const*const shape, const int ndim)
+{
+	char dict[128], dims[64];
+	size_t prefixLen = sizeof(npyMagic)-1 + 4, dictLen, total;
+	int n = 0, i;
+
+	for (i = 0; i < ndim && i < NPY_MAX_DIMS; i++) {
+		n += snprintf(dims+n, sizeof(dims)-n, i ? " %lu," : "%lu,",
+		              (unsigned long) shape[i]);
+	}
+	/* A tuple of more than one element needs no trailing comma. */
+	if (ndim > 1) {
+		dims[--n] = '\0';
+	}
+	dictLen = snprintf(dict, sizeof(dict), "{'descr': '%s', "
+	                   "'fortran_order': False, 'shape': (%s), }", descr,
+	                   dims);
+
+	/* The dictionary is padded with spaces and ends with a newline. */
+	total = NPY_ALIGNMENT*((prefixLen + dictLen + NPY_ALIGNMENT)/
+	                       NPY_ALIGNMENT);
+	if (total > len || dictLen >= sizeof(dict)) {
+		return 0;
+	}
+
+	memcpy(out, npyMagic, sizeof(npyMagic)-1);
+	out[6] = 1;
+	out[7] = 0;
+	out[8] = (uint8_t) ((total - prefixLen) & 0xFF);
+	out[9] = (uint8_t) ((total - prefixLen) >> 8);
+	memcpy(out+prefixLen, dict, dictLen);
+	memset(out+prefixLen+dictLen, ' ', total - prefixLen - dictLen - 1);
+	out[total-1] = '\n';
+
+	return total;
+}
@@ -0,0 +1,246 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Positional-write output backend.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "output.hpp"
+
+/**
+ * Creates (or truncates) an output file.
+ *
+ * @param out
+ * @param path
+ * @param size The final size of the file in bytes, if known, or 0. Giving the
+ *        size allocates the whole file up front (see out_set_size()).
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+int out_open(OutFile *const out, const char path[], const size_t size)
+{
+	int err;
+
+	if ((out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		return -1;
+	}
+	out->size = 0;
+
+	if (size && out_set_size(out, size)) {
+		err = errno;
+		close(out->fd);
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Sets the size of an output file. Space for any growth is allocated now, so
+ * that the file system can lay the file out in contiguous extents and so that
+ * later positional writes never have to extend the file. Writes beyond the
+ * end of the file are also allowed; they simply extend the file as they go,
+ * which is how files of unknown size are written before their final size is
+ * set with this function.
+ *
+ * @param out
+ * @param size
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+int out_set_size(OutFile *const out, const size_t size)
+{
+#ifdef __linux__
+	/* Not every file system supports fallocate(); fall back to a sparse
+	 * file, which still lets the writes land at their final offsets.
+	 */
+	if (size > out->size &&
+	    fallocate(out->fd, 0, out->size, size - out->size) != 0 &&
+	    errno != EOPNOTSUPP && errno != ENOSYS)
+	{
+		return -1;
+	}
+#endif
+	if (ftruncate(out->fd, size) != 0) {
+		return -1;
+	}
+	out->size = size;
+
+	return 0;
+}
+
+/**
+ * Closes an output file.
+ *
+ * @param out
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+int out_close(OutFile *const out)
+{
+	int status = close(out->fd);
+
+	out->fd = -1;
+
+	return status;
+}
+
+/**
+ * Prepares a writer for an output file.
+ *
+ * @param w
+ * @param out
+ * @return 0 on success, or -1 if memory could not be allocated.
+ */
+int out_writer_init(OutWriter *const w, OutFile const*const out)
+{
+	w->file = out;
+	w->capacity = OUT_WINDOW_SIZE;
+	w->start = 0;
+	w->len = 0;
+	w->numRuns = 0;
+	if (!(w->buf = (uint8_t*) calloc(w->capacity, sizeof(uint8_t)))) {
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Returns a pointer to memory which will be written to bytes
+ * [offset, offset+len) of the output file. It remains valid until the next
+ * call to out_reserve() or out_flush(). Only bytes not reserved since the
+ * last flush are zeroed: a reservation which overlaps or touches the last
+ * run returns whatever was already written to the bytes it shares with it.
+ *
+ * @param w
+ * @param offset Offset in the file in bytes; must be no less than the offset
+ *        of any earlier reservation.
+ * @param len
+ * @return NULL if the window could not be flushed or grown.
+ */
+uint8_t *out_reserve(OutWriter *const w, const size_t offset,
+                     const size_t len)
+{
+	size_t begin, end;
+
+	assert(offset >= w->start);
+
+	if (offset + len > w->start + w->capacity ||
+	    (w->numRuns == OUT_MAX_RUNS &&
+	     offset - w->start > w->runs[w->numRuns-1][1]))
+	{
+		if (out_flush(w)) {
+			return NULL;
+		}
+		w->start = offset;
+		if (len > w->capacity) {
+			free(w->buf);
+			w->capacity = len;
+			if (!(w->buf = (uint8_t*) calloc(w->capacity, sizeof(uint8_t)))) {
+				return NULL;
+			}
+		}
+	}
+
+	/* Reservations which touch or overlap the last run extend it; anything
+	 * else starts a new run, leaving a gap which out_flush() skips.
+	 */
+	begin = offset - w->start;
+	end = begin + len;
+	if (w->numRuns && begin <= w->runs[w->numRuns-1][1]) {
+		if (end > w->runs[w->numRuns-1][1]) {
+			w->runs[w->numRuns-1][1] = end;
+		}
+	} else {
+		w->runs[w->numRuns][0] = begin;
+		w->runs[w->numRuns][1] = end;
+		w->numRuns++;
+	}
+	if (end > w->len) {
+		w->len = end;
+	}
+
+	return w->buf + begin;
+}
+
+/**
+ * Writes out the runs of bytes reserved in the writer's window. Gaps between
+ * the runs are not written, so they may belong to another writer.
+ *
+ * @param w
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+int out_flush(OutWriter *const w)
+{
+	size_t done, end;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < w->numRuns; i++) {
+		done = w->runs[i][0];
+		end = w->runs[i][1];
+		while (done < end) {
+			n = pwrite(w->file->fd, w->buf+done, end-done, w->start+done);
+			if (n < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			done += n;
+		}
+	}
+
+	memset(w->buf, 0, w->len);
+	w->start += w->len;
+	w->len = 0;
+	w->numRuns = 0;
+
+	return 0;
+}
+
+/**
+ * Releases the memory held by a writer. Anything not yet flushed is lost.
+ *
+ * @param w
+ */
+void out_writer_free(OutWriter *const w)
+{
+	free(w->buf);
+	w->buf = NULL;
+}
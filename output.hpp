@@ -0,0 +1,85 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Output files whose size is known (or grows in large steps) and which are
+ * filled with positional writes at computed offsets rather than appended to.
+ */
+
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+/* Size of the staging window of an OutWriter. */
+#define OUT_WINDOW_SIZE (1 << 20)
+/* Number of separate runs of reserved bytes an OutWriter stages at once. */
+#define OUT_MAX_RUNS 64
+
+/**
+ * An output file. Several OutWriters may write to the same OutFile
+ * concurrently provided that no byte is reserved by more than one of them;
+ * each writer writes only the bytes it reserved, never the gaps between them.
+ */
+typedef struct {
+	int fd;
+	size_t size; /** Size of the file as last set by out_set_size(). */
+} OutFile;
+
+/**
+ * Stages writes to an OutFile in a window of memory so that many small,
+ * nearly-contiguous writes become a few large positional writes. Offsets
+ * passed to out_reserve() must not decrease. Reserved bytes are zero until
+ * the caller fills them; bytes of the window which were not reserved are
+ * never written to the file.
+ */
+typedef struct {
+	OutFile const *file;
+	uint8_t *buf;
+	size_t capacity; /** Size of `buf' in bytes. */
+	size_t start;    /** Offset in the file of buf[0]. */
+	size_t len;      /** Number of bytes of `buf' in use. */
+	/** Reserved runs [begin, end) as offsets into `buf', in order. */
+	size_t runs[OUT_MAX_RUNS][2];
+	int numRuns;
+} OutWriter;
+
+int out_open(OutFile *const out, const char path[], const size_t size);
+int out_set_size(OutFile *const out, const size_t size);
+int out_close(OutFile *const out);
+
+int out_writer_init(OutWriter *const w, OutFile const*const out);
+uint8_t *out_reserve(OutWriter *const w, const size_t offset,
+                     const size_t len);
+int out_flush(OutWriter *const w);
+void out_writer_free(OutWriter *const w);
+
+#endif
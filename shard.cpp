@@ -0,0 +1,177 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Deterministic work partitioning for job arrays.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "shard.hpp"
+
+typedef struct {
+	uint64_t weight;
+	const char *key;
+	size_t index;
+} ShardUnit;
+
+/**
+ * Parses a shard specification of the form "I/N", where 0 <= I < N.
+ *
+ * @param str
+ * @param shard
+ * @return 0 on success, -1 if `str' is not a valid shard specification.
+ */
+int shard_parse(const char str[], Shard *const shard)
+{
+	unsigned index, count;
+	char trailing;
+
+	if (sscanf(str, "%u/%u%c", &index, &count, &trailing) != 2 ||
+	    count == 0 || index >= count)
+	{
+		return -1;
+	}
+
+	shard->index = index;
+	shard->count = count;
+
+	return 0;
+}
+
+/**
+ * Computes the 64-bit FNV-1a hash of a string. The result depends only on the
+ * bytes of `key', so it is the same on every node of a cluster.
+ *
+ * @param key
+ */
+uint64_t shard_hash(const char key[])
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+
+	for (; *key; key++) {
+		hash ^= (uint8_t) *key;
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Returns the shard to which the unit named `key' is assigned when assigning
+ * by hash.
+ *
+ * @param key
+ * @param count The total number of shards.
+ */
+unsigned shard_of_key(const char key[], const unsigned count)
+{
+	return (unsigned) (shard_hash(key) % count);
+}
+
+static int compare_units(const void *a, const void *b)
+{
+	ShardUnit const*const ua = (ShardUnit const*) a;
+	ShardUnit const*const ub = (ShardUnit const*) b;
+	int cmp;
+
+	/* Heaviest first; ties are broken by key and then by position so that
+	 * the ordering (and hence the assignment) never depends on qsort's
+	 * handling of equal elements.
+	 */
+	if (ua->weight != ub->weight) {
+		return ua->weight > ub->weight ? -1 : 1;
+	}
+	if ((cmp = strcmp(ua->key, ub->key))) {
+		return cmp;
+	}
+	return ua->index < ub->index ? -1 : (ua->index > ub->index);
+}
+
+/**
+ * Assigns units to shards so that the total weight of each shard is roughly
+ * equal, using the "longest processing time first" rule: units are taken in
+ * order of decreasing weight and each is given to the currently lightest
+ * shard. Given the same weights and keys, every caller computes the same
+ * assignment.
+ *
+ * @param weights The weight (e.g., size in bytes) of each unit.
+ * @param keys A stable name for each unit.
+ * @param numUnits
+ * @param count The total number of shards.
+ * @param assignment Receives the shard of each unit.
+ */
+void shard_balance(uint64_t const*const weights, char const*const*const keys,
+                   const size_t numUnits, const unsigned count,
+                   unsigned *const assignment)
+{
+	ShardUnit *units;
+	uint64_t *loads;
+	size_t i;
+	unsigned j, lightest;
+
+	units = (ShardUnit*) malloc(sizeof(ShardUnit)*numUnits);
+	loads = (uint64_t*) calloc(count, sizeof(uint64_t));
+	if (!units || !loads) {
+		/* Fall back to hashing, which needs no memory. */
+		for (i = 0; i < numUnits; i++) {
+			assignment[i] = shard_of_key(keys[i], count);
+		}
+		free(units);
+		free(loads);
+		return;
+	}
+
+	for (i = 0; i < numUnits; i++) {
+		units[i].weight = weights[i];
+		units[i].key = keys[i];
+		units[i].index = i;
+	}
+	qsort(units, numUnits, sizeof(ShardUnit), compare_units);
+
+	for (i = 0; i < numUnits; i++) {
+		lightest = 0;
+		for (j = 1; j < count; j++) {
+			if (loads[j] < loads[lightest]) {
+				lightest = j;
+			}
+		}
+		assignment[units[i].index] = lightest;
+		loads[lightest] += units[i].weight;
+	}
+
+	free(units);
+	free(loads);
+}
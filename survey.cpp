@@ -0,0 +1,502 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Quick estimates of the contents of a TBM archive from a random sample of
+ * its data blocks.
+ *
+ * Only the label buffer and the sampled blocks are read. The sampled blocks
+ * are a simple random sample (without replacement) of the data blocks
+ * described by block control pointers, so totals are estimated by expansion
+ * and means and shares by ratio estimators, each with the usual finite
+ * population correction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include "tbm.hpp"
+#include "survey.hpp"
+
+/* Two-sided 95% quantile of the normal distribution. */
+#define SURVEY_Z 1.96
+
+/**
+ * What was found in one sampled block.
+ */
+typedef struct {
+	double segments;
+	double recordStarts;
+	double words;
+	double modeWords[SURVEY_NUM_MODES];
+} BlockSample;
+
+static uint64_t next_random(uint64_t *const state);
+static void survey_block(uint8_t const*const block, const size_t numWords,
+                         TBMBlock const*const ref, Survey *const survey,
+                         BlockSample *const sample);
+static Estimate estimate_total(BlockSample const*const samples,
+                               const size_t m, const size_t M,
+                               const size_t field);
+static Estimate estimate_ratio(BlockSample const*const samples,
+                               const size_t m, const size_t M,
+                               const size_t numField, const size_t denField);
+
+/**
+ * Surveys a TBM archive by reading its label buffer and a random sample of
+ * its data blocks.
+ *
+ * @param fd The archive, open for reading.
+ * @param name Name of the archive, for error messages.
+ * @param numSamples The number of data blocks to sample.
+ * @param seed Seed for choosing the sample; the same seed always chooses the
+ *        same blocks of a given archive.
+ * @param survey Receives the results.
+ * @return 0 on success, or 1 if the archive could not be surveyed.
+ */
+int tbm_survey(const int fd, const char name[], const unsigned numSamples,
+               const uint64_t seed, Survey *const survey)
+{
+	SYSLBN_Data syslbn_data;
+	SYSLBN_Text syslbn_text;
+	uint8_t *labelBuf = NULL;
+	uint8_t *blockBuf = NULL;
+	uint8_t *buf;
+	TBMBlock *blocks = NULL;
+	TBMBlock **frame = NULL;
+	TBMBlock *tmp;
+	BlockSample *samples = NULL;
+	size_t numRefs, numFrame, blockBytes, fileSize;
+	size_t i, j, m;
+	uint64_t state = seed;
+	off_t end;
+	int mode;
+
+	memset(survey, 0, sizeof(Survey));
+
+	if ((end = lseek(fd, 0, SEEK_END)) < 0) {
+		goto readfail;
+	}
+	fileSize = (size_t) end;
+
+	/* The SYSLBN is in the first BK block; it gives the size of the label
+	 * buffer, which may be several BK blocks long.
+	 */
+	if (fileSize < BK_BLOCK_SIZE_BYTES) {
+		fprintf(stderr, "Error: \"%s\" is too short to be a TBM archive\n",
+		        name);
+		return 1;
+	}
+	if (!(labelBuf = (uint8_t*) malloc(BK_BLOCK_SIZE_BYTES))) {
+		goto mallocfail;
+	}
+	if (tbm_pread(fd, labelBuf, BK_BLOCK_SIZE_BYTES, 0)) {
+		goto readfail;
+	}
+	read_syslbn(labelBuf, &syslbn_text, &syslbn_data, 0);
+
+	if (syslbn_data.vol1.vol1 != MAGIC_VOL1 ||
+	    syslbn_data.hdr1.hdr1 != MAGIC_HDR1 ||
+	    syslbn_data.hdr2.hdr2 != MAGIC_HDR2 ||
+	    syslbn_data.bk == 0)
+	{
+		fprintf(stderr, "Error: \"%s\" does not have a valid SYSLBN\n", name);
+		free(labelBuf);
+		return 1;
+	}
+
+	blockBytes = syslbn_data.bk*BK_BLOCK_SIZE_BYTES;
+	if (blockBytes > fileSize) {
+		fprintf(stderr, "Error: \"%s\" is shorter than its label buffer\n",
+		        name);
+		free(labelBuf);
+		return 1;
+	}
+	if (syslbn_data.bk > 1) {
+		if (!(buf = (uint8_t*) realloc(labelBuf, blockBytes))) {
+			goto mallocfail;
+		}
+		labelBuf = buf;
+		if (tbm_pread(fd, labelBuf, blockBytes, 0)) {
+			goto readfail;
+		}
+	}
+
+	survey->numFiles = tbm_count_files(labelBuf, &syslbn_data, NULL, 0);
+	if (tbm_list_blocks(labelBuf, &syslbn_data, &blocks, &numRefs)) {
+		goto mallocfail;
+	}
+
+	/* The BCPs count records cumulatively within each file. */
+	for (i = 0; i < numRefs; i++) {
+		if (i+1 == numRefs || blocks[i+1].file != blocks[i].file) {
+			survey->bcpRecords += blocks[i].bcp.lastRecord;
+		}
+	}
+
+	/* The sampling frame is every block present in the archive. A block
+	 * shared by two files is described by the BCPs of both; the first one
+	 * points to the earliest DBF in the block.
+	 */
+	if (!(frame = (TBMBlock**) malloc(sizeof(TBMBlock*)*(numRefs+1)))) {
+		goto mallocfail;
+	}
+	for (i = 0, numFrame = 0; i < numRefs; i++) {
+		if (blocks[i].block >= syslbn_data.numBKBlocks ||
+		    (blocks[i].block+2)*blockBytes > fileSize ||
+		    (numFrame && frame[numFrame-1]->block == blocks[i].block))
+		{
+			continue;
+		}
+		frame[numFrame++] = &blocks[i];
+	}
+	survey->numBlocks = numFrame;
+
+	m = numSamples < numFrame ? numSamples : numFrame;
+	if (m < 2 && numFrame >= 2) {
+		/* Need two blocks to say anything about the variance. */
+		m = 2;
+	}
+	survey->numSampled = m;
+
+	samples = (BlockSample*) calloc(m+1, sizeof(BlockSample));
+	blockBuf = (uint8_t*) calloc(blockBytes+8, sizeof(uint8_t));
+	if (!samples || !blockBuf) {
+		goto mallocfail;
+	}
+
+	/* Choose the sample with a partial Fisher-Yates shuffle of the frame,
+	 * then read the chosen blocks in the order they appear in the archive.
+	 */
+	for (i = 0; i < m; i++) {
+		j = i + next_random(&state) % (numFrame - i);
+		tmp = frame[i];
+		frame[i] = frame[j];
+		frame[j] = tmp;
+	}
+	for (i = 1; i < m; i++) {
+		for (j = i; j > 0 && frame[j-1]->block > frame[j]->block; j--) {
+			tmp = frame[j];
+			frame[j] = frame[j-1];
+			frame[j-1] = tmp;
+		}
+	}
+
+	for (i = 0; i < m; i++) {
+		if (tbm_pread(fd, blockBuf, blockBytes,
+		               (frame[i]->block+1)*blockBytes))
+		{
+			goto readfail;
+		}
+		survey_block(blockBuf, syslbn_data.bk*BK_BLOCK_SIZE_CDC_WORDS,
+		             frame[i], survey, &samples[i]);
+	}
+
+	survey->records = estimate_total(samples, m, numFrame,
+	                                 offsetof(BlockSample, recordStarts));
+	survey->words = estimate_total(samples, m, numFrame,
+	                               offsetof(BlockSample, words));
+	survey->recordWords = estimate_ratio(samples, m, numFrame,
+	                                     offsetof(BlockSample, words),
+	                                     offsetof(BlockSample, recordStarts));
+	survey->segmentWords = estimate_ratio(samples, m, numFrame,
+	                                      offsetof(BlockSample, words),
+	                                      offsetof(BlockSample, segments));
+	for (mode = 0; mode < SURVEY_NUM_MODES; mode++) {
+		survey->modeShare[mode] =
+			estimate_ratio(samples, m, numFrame,
+			               offsetof(BlockSample, modeWords) +
+			               mode*sizeof(double),
+			               offsetof(BlockSample, words));
+		if (survey->modeShare[mode].low < 0) {
+			survey->modeShare[mode].low = 0;
+		}
+		if (survey->modeShare[mode].high > 1) {
+			survey->modeShare[mode].high = 1;
+		}
+	}
+
+	free(labelBuf);
+	free(blockBuf);
+	free(blocks);
+	free(frame);
+	free(samples);
+
+	return 0;
+
+readfail:
+	fprintf(stderr, "Error: failed to read \"%s\": %s\n", name,
+	        errno ? strerror(errno) : "unexpected end of file");
+	free(labelBuf);
+	free(blockBuf);
+	free(blocks);
+	free(frame);
+	free(samples);
+	return 1;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
+	free(labelBuf);
+	free(blockBuf);
+	free(blocks);
+	free(frame);
+	free(samples);
+	return 1;
+}
+
+/**
+ * Follows the chain of data buffer flags through one data block, starting at
+ * the DBF named by the block's BCP and stopping at the end of the block.
+ *
+ * @param block
+ * @param numWords Length of the block in 60-bit words.
+ * @param ref The block and its BCP.
+ * @param survey Receives counts of what was seen.
+ * @param sample Receives the amount of data found in the block.
+ */
+static void survey_block(uint8_t const*const block, const size_t numWords,
+                         TBMBlock const*const ref, Survey *const survey,
+                         BlockSample *const sample)
+{
+	DataBufferFlags dbf, prev;
+	size_t word;
+	int first = 1;
+
+	if (ref->bcp.wordsToFirstPtr < BCP_FIRST_PTR_BIAS ||
+	    (size_t) (ref->bcp.wordsToFirstPtr - BCP_FIRST_PTR_BIAS) >= numWords)
+	{
+		survey->badBlocks++;
+		return;
+	}
+
+	for (word = (size_t) (ref->bcp.wordsToFirstPtr - BCP_FIRST_PTR_BIAS);
+	     word < numWords; word += dbf.nextPtrOffset)
+	{
+		read_dataBufferFlags(block, &dbf, word*60);
+
+		if (dbf.nextPtrOffset == 0 && !dbf.isEOD) {
+			/* Not a DBF; the chain can't be followed any further. */
+			if (first) {
+				survey->badBlocks++;
+			} else {
+				survey->badLinks++;
+			}
+			return;
+		}
+		if (!first) {
+			survey->links++;
+			if (dbf.prevPtrOffset != prev.nextPtrOffset) {
+				survey->badLinks++;
+				return;
+			}
+		}
+
+		if (dbf.labelRecordFollows || dbf.endLabelGroup || dbf.isEOF ||
+		    dbf.isEOD)
+		{
+			survey->labelSegments++;
+		} else {
+			survey->segments++;
+			survey->recordStarts += dbf.isRecordStart;
+			survey->modeSegments[dbf.recordDataMode]++;
+			sample->segments++;
+			sample->recordStarts += dbf.isRecordStart;
+			sample->words += dbf.nextPtrOffset-1;
+			sample->modeWords[dbf.recordDataMode] += dbf.nextPtrOffset-1;
+		}
+
+		if (dbf.isEOD) {
+			return;
+		}
+		prev = dbf;
+		first = 0;
+	}
+}
+
+/**
+ * Estimates the total of a quantity over all M blocks from its values in a
+ * simple random sample of m blocks.
+ *
+ * @param field Offset of the quantity within BlockSample.
+ */
+static Estimate estimate_total(BlockSample const*const samples,
+                               const size_t m, const size_t M,
+                               const size_t field)
+{
+	Estimate e;
+	double sum = 0, sumSq = 0, mean, var, y;
+	size_t i;
+
+	for (i = 0; i < m; i++) {
+		y = *(double const*) ((char const*) &samples[i] + field);
+		sum += y;
+		sumSq += y*y;
+	}
+
+	mean = m ? sum/m : 0;
+	var = m > 1 ? (sumSq - m*mean*mean)/(m-1) : 0;
+	if (var < 0) {
+		var = 0;
+	}
+
+	e.value = M*mean;
+	/* Var(total) = M^2 (1 - m/M) s^2 / m */
+	var = m ? (double) M*M*(1 - (double) m/M)*var/m : 0;
+	e.low = e.value - SURVEY_Z*sqrt(var);
+	e.high = e.value + SURVEY_Z*sqrt(var);
+	if (e.low < 0) {
+		e.low = 0;
+	}
+
+	return e;
+}
+
+/**
+ * Estimates the ratio of the totals of two quantities over all M blocks from
+ * their values in a simple random sample of m blocks.
+ *
+ * @param numField Offset of the numerator within BlockSample.
+ * @param denField Offset of the denominator within BlockSample.
+ */
+static Estimate estimate_ratio(BlockSample const*const samples,
+                               const size_t m, const size_t M,
+                               const size_t numField, const size_t denField)
+{
+	Estimate e;
+	double sumY = 0, sumX = 0, meanX, resid, sumResidSq = 0, var, y, x;
+	size_t i;
+
+	for (i = 0; i < m; i++) {
+		sumY += *(double const*) ((char const*) &samples[i] + numField);
+		sumX += *(double const*) ((char const*) &samples[i] + denField);
+	}
+
+	if (sumX == 0) {
+		e.value = e.low = e.high = 0;
+		return e;
+	}
+
+	e.value = sumY/sumX;
+	meanX = sumX/m;
+
+	for (i = 0; i < m; i++) {
+		y = *(double const*) ((char const*) &samples[i] + numField);
+		x = *(double const*) ((char const*) &samples[i] + denField);
+		resid = y - e.value*x;
+		sumResidSq += resid*resid;
+	}
+
+	/* Var(R) = (1 - m/M) / (m xbar^2) * sum((y - R x)^2) / (m-1) */
+	var = m > 1 ? (1 - (double) m/M)/(m*meanX*meanX)*sumResidSq/(m-1) : 0;
+	e.low = e.value - SURVEY_Z*sqrt(var);
+	e.high = e.value + SURVEY_Z*sqrt(var);
+	if (e.low < 0) {
+		e.low = 0;
+	}
+
+	return e;
+}
+
+/**
+ * Pretty-prints the results of a survey to standard out.
+ *
+ * @param survey
+ * @param name Name of the archive.
+ */
+void print_survey(Survey const*const survey, const char name[])
+{
+	int mode;
+
+	printf("==== Survey of \"%s\" ====\n", name);
+	printf(
+"Files:                %d\n"
+"Data blocks:          %lu (%lu sampled)\n"
+"Records (BCPs):       %lu\n"
+"Records:              %.0f [%.0f, %.0f]\n"
+"Data words:           %.0f [%.0f, %.0f]\n"
+"Mean record length:   %.1f [%.1f, %.1f] words\n"
+"Mean segment length:  %.1f [%.1f, %.1f] words\n",
+	       survey->numFiles,
+	       (unsigned long) survey->numBlocks,
+	       (unsigned long) survey->numSampled,
+	       (unsigned long) survey->bcpRecords,
+	       survey->records.value, survey->records.low, survey->records.high,
+	       survey->words.value, survey->words.low, survey->words.high,
+	       survey->recordWords.value, survey->recordWords.low,
+	       survey->recordWords.high,
+	       survey->segmentWords.value, survey->segmentWords.low,
+	       survey->segmentWords.high);
+
+	printf("Data modes (share of data words):\n");
+	for (mode = 0; mode < SURVEY_NUM_MODES; mode++) {
+		if (!survey->modeSegments[mode]) {
+			continue;
+		}
+		printf("  %2d %-26s %5.1f%% [%5.1f%%, %5.1f%%] (%lu segments)\n",
+		       mode, mode <= DATA_TYPE_MAX ? dataTypes[mode].str : "unknown",
+		       100*survey->modeShare[mode].value,
+		       100*survey->modeShare[mode].low,
+		       100*survey->modeShare[mode].high,
+		       (unsigned long) survey->modeSegments[mode]);
+	}
+
+	printf(
+"Structure:            %s\n"
+"  DBF links checked:  %lu (%lu inconsistent)\n"
+"  Bad first pointers: %lu\n"
+"  Label segments:     %lu\n",
+	       survey->badLinks || survey->badBlocks ? "SUSPECT" : "looks sane",
+	       (unsigned long) survey->links, (unsigned long) survey->badLinks,
+	       (unsigned long) survey->badBlocks,
+	       (unsigned long) survey->labelSegments);
+	printf("(Bracketed ranges are 95%% confidence intervals.)\n");
+}
+
+/**
+ * Returns the next value of a splitmix64 sequence. Its output depends only
+ * on the seed, so a survey can be repeated exactly.
+ */
+static uint64_t next_random(uint64_t *const state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return z ^ (z >> 31);
+}
@@ -0,0 +1,87 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Quick estimates of the contents of a TBM archive from a random sample of
+ * its data blocks.
+ */
+
+#ifndef SURVEY_HPP
+#define SURVEY_HPP
+
+/* Number of data blocks sampled by default. */
+#define SURVEY_DEFAULT_SAMPLES 32
+
+/* Number of possible values of DataBufferFlags.recordDataMode. */
+#define SURVEY_NUM_MODES 64
+
+/**
+ * An estimate, with the bounds of its 95% confidence interval. When every
+ * block has been sampled, the bounds equal the estimate.
+ */
+typedef struct {
+	double value;
+	double low;
+	double high;
+} Estimate;
+
+/**
+ * The results of surveying a TBM archive. Counts are of what was seen in the
+ * sampled blocks; estimates are for the whole archive. Each data segment is
+ * attributed to the block holding its data buffer flags, so that every
+ * segment belongs to exactly one block.
+ */
+typedef struct {
+	int numFiles;              /** From the file control pointers (exact). */
+	size_t numBlocks;          /** Data blocks described by BCPs (exact). */
+	size_t bcpRecords;         /** Records counted by the BCPs (exact). */
+	size_t numSampled;         /** Data blocks sampled. */
+	size_t segments;           /** Data segments seen. */
+	size_t recordStarts;       /** Segments which start a record. */
+	size_t labelSegments;      /** Label and end-of-file segments seen. */
+	size_t links;              /** Pairs of adjacent DBFs checked. */
+	size_t badLinks;           /** Pairs whose next/previous pointers disagree. */
+	size_t badBlocks;          /** Blocks whose first pointer is not a DBF. */
+	size_t modeSegments[SURVEY_NUM_MODES]; /** Data segments seen per mode. */
+	Estimate records;          /** Number of records. */
+	Estimate words;            /** Number of 60-bit data words. */
+	Estimate recordWords;      /** Mean record length in 60-bit words. */
+	Estimate segmentWords;     /** Mean data segment length in words. */
+	Estimate modeShare[SURVEY_NUM_MODES]; /** Share of data words per mode. */
+} Survey;
+
+int tbm_survey(const int fd, const char name[], const unsigned numSamples,
+               const uint64_t seed, Survey *const survey);
+void print_survey(Survey const*const survey, const char name[]);
+
+#endif
@@ -37,14 +37,19 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
 #include <stdint.h>
-#include <assert.h>
 #include "gbytes.cpp"
 #include "cdc.hpp"
 #include "tbm.hpp"
 
+/* Words of 6-bit characters in an 80-character label. */
+#define LABEL_WORDS 8
+
 /**
- * States for the tbm_read state machine.
+ * States for the tbm_extract state machine.
  */
 enum {
 	kExpectVOL1,
@@ -57,97 +62,218 @@ enum {
 };
 
 /**
+ * Checks that the SYSLBN of an archive is well formed and describes an
+ * archive of length `len'.
+ *
+ * @param syslbn_data
+ * @param len Length of the archive in bytes.
+ * @return TBM_OK, or TBM_ERR_FORMAT.
+ */
+int tbm_check_syslbn(SYSLBN_Data const*const syslbn_data, const size_t len)
+{
+	if (syslbn_data->vol1.vol1 != MAGIC_VOL1 ||
+	    syslbn_data->hdr1.hdr1 != MAGIC_HDR1 ||
+	    syslbn_data->hdr1.dataSetID_1_6 != MAGIC_NCARSY ||
+	    syslbn_data->hdr1.dataSetID_7_12 != MAGIC_STEMHD ||
+	    syslbn_data->hdr1.dataSetID_13_16 != MAGIC_1000 ||
+	    syslbn_data->hdr1.dataSetID_17 != MAGIC_1 ||
+	    syslbn_data->hdr2.hdr2 != MAGIC_HDR2)
+	{
+		return TBM_ERR_FORMAT;
+	}
+
+	/* The archive is the label buffer followed by the data blocks, and the
+	 * file control pointers are in the label buffer.
+	 */
+	if (syslbn_data->bk == 0 ||
+	    len != (size_t) (syslbn_data->numBKBlocks+1)*
+	           syslbn_data->bk*BK_BLOCK_SIZE_BYTES ||
+	    syslbn_data->firstFCPOff >= syslbn_data->bk*BK_BLOCK_SIZE_CDC_WORDS)
+	{
+		return TBM_ERR_FORMAT;
+	}
+
+	return TBM_OK;
+}
+
+/**
+ * Reads the labels of each file in a TBM archive and computes the size of
+ * each file's data. Kept for existing callers; it is tbm_extract() with no
+ * callbacks, the length of the archive being taken from its SYSLBN.
+ *
+ * @param inBuf The whole archive, as long as its SYSLBN says; use
+ *        tbm_extract() if that is not known to be so.
+ * @param bk The block size (in multiples of 2048 60-bit words) specified in
+ *        the SYSLBN block.
+ * @param files A pointer to an array of `numFiles' TBMFiles structures.
+ * @param numFiles The number of files contained in the TBM file.
+ * @return As for tbm_extract().
+ */
+int tbm_read(uint8_t *const inBuf, const uint64_t bk, TBMFile *const files,
+             int numFiles)
+{
+	SYSLBN_Text syslbn_text;
+	SYSLBN_Data syslbn_data;
+
+	read_syslbn(inBuf, &syslbn_text, &syslbn_data, 0);
+
+	return tbm_extract(inBuf, (size_t) (syslbn_data.numBKBlocks+1)*bk*
+	                   BK_BLOCK_SIZE_BYTES, bk, files, numFiles, NULL);
+}
+
+/**
+ * Walks the chain of data buffer flags of a TBM archive once, reading the
+ * labels of each file, computing where each data segment belongs in the
+ * extracted file and handing the segments to `ex' as they are found.
  *
  * @param inBuf
+ * @param len Length of the archive in bytes.
  * @param bk The block size (in multiples of 2048 60-bit words) specified in
  *        the SYSLBN block.
  * @param files A pointer to an array of `numFiles' TBMFiles structures.
  * @param numFiles The number of files contained in the TBM file.
+ * @param ex Callbacks to receive the data, or NULL to only fill in `files'.
+ * @return 0, TBM_ERR_FORMAT if the chain is malformed or runs off the end of
+ *         the archive, or the first nonzero value returned by a callback. In
+ *         either of the latter cases the walk is abandoned.
  */
-void tbm_read(uint8_t *const inBuf, const uint64_t bk, TBMFile *const files,
-              int numFiles)
+int tbm_extract(uint8_t const*const inBuf, const size_t len,
+                const uint64_t bk, TBMFile *const files, const int numFiles,
+                TBMExtractor const*const ex)
 {
 	size_t offset = bk * BK_BLOCK_SIZE_CDC_WORDS * 60;
 	int first = 1;
 	int i = 0;
 	int fileComplete = 0;
 	int next = kExpectVOL1;
+	int status;
 	DataBufferFlags dbf;
-	size_t writeOffset;
+	size_t writeOffset = 0;
 	VOL1_Text vol1_text;
 	VOL1_Data vol1_data;
 
 	do {
+		if (offset + 60 > len*8) {
+			return TBM_ERR_FORMAT;
+		}
 		read_dataBufferFlags(inBuf, &dbf, offset);
 
 		if (dbf.isEOD) {
 			/* Done reading the entire TBM archive. */
-			assert(dbf.nextPtrOffset == 0);
-			assert(dbf.prevPtrOffset == 1);
-			assert(dbf.isRecordStart == 1);
+			if (dbf.nextPtrOffset != 0 || dbf.prevPtrOffset != 1 ||
+			    dbf.isRecordStart != 1)
+			{
+				return TBM_ERR_FORMAT;
+			}
 			break;
 		}
 
-		/* Read data from the */
+		/* Each segment must lie within the archive, and the chain must
+		 * move forward.
+		 */
+		if (dbf.nextPtrOffset == 0 || offset + 60*dbf.nextPtrOffset > len*8) {
+			return TBM_ERR_FORMAT;
+		}
+
 		/* File parsing state machine. */
 		switch (next) {
 			case kExpectVOL1:
+				if (dbf.nextPtrOffset <= LABEL_WORDS) {
+					return TBM_ERR_FORMAT;
+				}
 				read_vol1(inBuf, &vol1_text,
 				          &vol1_data, offset+60);
-				assert(vol1_data.vol1 == MAGIC_VOL1);
+				if (vol1_data.vol1 != MAGIC_VOL1) {
+					return TBM_ERR_FORMAT;
+				}
 				next = kExpectHDR1;
 				break;
 			case kExpectHDR1:
+				if (i >= numFiles || dbf.nextPtrOffset <= LABEL_WORDS) {
+					return TBM_ERR_FORMAT;
+				}
 				read_hdr1(inBuf, &(files[i].hdr1_text),
 				          &(files[i].hdr1_data), offset+60);
-				assert(files[i].hdr1_data.hdr1 == MAGIC_HDR1);
-				assert(files[i].hdr1_data.dataSetID_1_6 == MAGIC_NCARSY);
-				assert(files[i].hdr1_data.dataSetID_7_12 == MAGIC_STEMHD);
-				assert(files[i].hdr1_data.sysCode_1_10 ==
-				       MAGIC_SYSCODE_1_10);
-				assert(files[i].hdr1_data.sysCode_11_13 ==
-				       MAGIC_SYSCODE_11_13);
+				if (files[i].hdr1_data.hdr1 != MAGIC_HDR1 ||
+				    files[i].hdr1_data.dataSetID_1_6 != MAGIC_NCARSY ||
+				    files[i].hdr1_data.dataSetID_7_12 != MAGIC_STEMHD ||
+				    files[i].hdr1_data.sysCode_1_10 != MAGIC_SYSCODE_1_10 ||
+				    files[i].hdr1_data.sysCode_11_13 != MAGIC_SYSCODE_11_13)
+				{
+					return TBM_ERR_FORMAT;
+				}
 				next = kExpectHDR2;
 
 				break;
 			case kExpectHDR2:
+				if (dbf.nextPtrOffset <= LABEL_WORDS) {
+					return TBM_ERR_FORMAT;
+				}
 				read_hdr2(inBuf, &(files[i].hdr2_text),
 				          &(files[i].hdr2_data), offset+60);
-				assert(files[i].hdr2_data.hdr2 == MAGIC_HDR2);
+				if (files[i].hdr2_data.hdr2 != MAGIC_HDR2) {
+					return TBM_ERR_FORMAT;
+				}
 				next = kExpectEndLabelGroup;
 				break;
 			/* End label group after header before start of data */
 			case kExpectEndLabelGroup:
-				assert(dbf.isEOF == 1);
-				assert(dbf.nextPtrOffset == 1);
-				assert(dbf.prevPtrOffset == 9);
-				assert(dbf.endLabelGroup == 1);
-				assert(dbf.isRecordStart == 1);
-				assert(dbf.isEOD == 0);
+				if (dbf.isEOF != 1 || dbf.nextPtrOffset != 1 ||
+				    dbf.prevPtrOffset != 9 || dbf.endLabelGroup != 1 ||
+				    dbf.isRecordStart != 1)
+				{
+					return TBM_ERR_FORMAT;
+				}
 				next = kExpectData;
 				files[i].offsetToDataStart = offset+60;
 				writeOffset = 0;
+				first = 1;
+				if (ex && ex->beginFile &&
+				    (status = ex->beginFile(ex->arg, i, &files[i])))
+				{
+					return status;
+				}
 				break;
 			case kExpectEOF1:
-				assert(dbf.labelRecordFollows == 1);
 				// TODO: look at dbf.blockCount
+				if (dbf.labelRecordFollows != 1 ||
+				    dbf.nextPtrOffset <= LABEL_WORDS)
+				{
+					return TBM_ERR_FORMAT;
+				}
 				read_hdr1(inBuf, &(files[i].eof1_text),
 				          &(files[i].eof1_data), offset+60);
-				assert(files[i].eof1_data.hdr1 == MAGIC_EOF1);
-				assert(files[i].eof1_data.dataSetID_1_6 == MAGIC_NCARSY);
-				assert(files[i].eof1_data.dataSetID_7_12 == MAGIC_STEMHD);
-				assert(files[i].eof1_data.sysCode_1_10 ==
-				       MAGIC_SYSCODE_1_10);
-				assert(files[i].eof1_data.sysCode_11_13 ==
-				       MAGIC_SYSCODE_11_13);
+				if (files[i].eof1_data.hdr1 != MAGIC_EOF1 ||
+				    files[i].eof1_data.dataSetID_1_6 != MAGIC_NCARSY ||
+				    files[i].eof1_data.dataSetID_7_12 != MAGIC_STEMHD ||
+				    files[i].eof1_data.sysCode_1_10 != MAGIC_SYSCODE_1_10 ||
+				    files[i].eof1_data.sysCode_11_13 != MAGIC_SYSCODE_11_13)
+				{
+					return TBM_ERR_FORMAT;
+				}
 				next = kExpectDBFAfterEOF1;
 				break;
 			case kExpectDBFAfterEOF1:
 				next = kExpectHDR1;
-				assert(dbf.isEOF == 1);
-				assert(dbf.endLabelGroup == 1);
+				if (dbf.isEOF != 1 || dbf.endLabelGroup != 1) {
+					return TBM_ERR_FORMAT;
+				}
 				break;
 			case kExpectData:
+				/* A segment with no words still starts a record if its DBF
+				 * says so, and must be handed on so that the records after it
+				 * keep their numbers. The empty DBF which ends a file doesn't.
+				 */
+				if (ex && ex->segment &&
+				    (dbf.nextPtrOffset > 1 ||
+				     (dbf.nextPtrOffset == 1 && dbf.isRecordStart &&
+				      !dbf.isEOF)) &&
+				    (status = ex->segment(ex->arg, i, inBuf, &dbf, offset+60,
+				                          dbf.nextPtrOffset-1, writeOffset)))
+				{
+					return status;
+				}
+
 				writeOffset += 60*(dbf.nextPtrOffset-1);
 				/* Align writeOffset to 64-bit boundaries, but not immediately after
 				 * the GENPRO-I header.
@@ -166,9 +292,14 @@ void tbm_read(uint8_t *const inBuf, const uint64_t bk, TBMFile *const files,
 				if (dbf.isEOF && !dbf.endLabelGroup) {
 					next = kExpectEOF1;
 					files[i].size = writeOffset;
+					if (ex && ex->endFile &&
+					    (status = ex->endFile(ex->arg, i, &files[i])))
+					{
+						return status;
+					}
 					i++;
 					if (i == numFiles) {
-						return;
+						return 0;
 					}
 				}
 
@@ -176,6 +307,159 @@ void tbm_read(uint8_t *const inBuf, const uint64_t bk, TBMFile *const files,
 		}
 		offset += 60*dbf.nextPtrOffset;
 	} while (!fileComplete);
+
+	return 0;
+}
+
+/**
+ * Counts the files in a TBM archive by following the chain of file control
+ * pointers in the label buffer.
+ *
+ * @param inBuf
+ * @param syslbn_data The SYSLBN of the archive.
+ * @param numBlocks If not NULL, receives the number of BK blocks spanned by
+ *        each file; must have room for one entry per file.
+ * @param print If set to true, each file control pointer and its file history
+ *        words are pretty-printed to standard out.
+ * @return The number of files contained in the archive.
+ */
+int tbm_count_files(uint8_t const*const inBuf,
+                    SYSLBN_Data const*const syslbn_data,
+                    size_t *const numBlocks, const int print)
+{
+	const size_t labelBits = syslbn_data->bk*BK_BLOCK_SIZE_CDC_WORDS*60;
+	FileHistoryWord_Data fhw_data;
+	FileHistoryWord_Text fhw_text;
+	FileControlPointer fcp;
+	size_t offset;
+	int numFiles = 0;
+
+	/* The location of the first file control pointer is specified in the
+	 * SYSLBN.
+	 */
+	offset = syslbn_data->firstFCPOff * 60;
+
+	do {
+		read_fileControlPointer(inBuf, &fcp, offset);
+
+		if (print) {
+			/* Each file control pointer is immediately followed by a set of
+			 * file history words.
+			 */
+			read_fileHistoryWord(inBuf, &fhw_text, &fhw_data, offset+60);
+			print_fileControlPtr(&fcp, offset, 0, 0);
+			print_fileHistoryWord(&fhw_text, &fhw_data, offset+60);
+		}
+
+		offset += fcp.nextFCPOff*60;
+
+		if (!fcp.isEOF && fcp.dataBlkNum != syslbn_data->numBKBlocks-1) {
+			if (numBlocks) {
+				numBlocks[numFiles] = fcp.nextFCPOff > FCP_HEADER_WORDS ?
+				                      fcp.nextFCPOff - FCP_HEADER_WORDS : 0;
+			}
+			numFiles++;
+		}
+	} while (!fcp.isEOF && fcp.nextFCPOff && offset < labelBits);
+
+	return numFiles;
+}
+
+/**
+ * Reads exactly `len' bytes at byte `offset' of a file, so that only the
+ * parts of an archive that are needed have to be read.
+ *
+ * @param fd
+ * @param buf
+ * @param len
+ * @param offset
+ * @return 0 on success, or -1 on failure; errno is 0 if the file is too
+ *         short.
+ */
+int tbm_pread(const int fd, uint8_t *const buf, const size_t len,
+              const size_t offset)
+{
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < len) {
+		n = pread(fd, buf+done, len-done, offset+done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (n == 0) {
+			errno = 0;
+			return -1;
+		}
+		done += n;
+	}
+
+	return 0;
+}
+
+/**
+ * Lists the data blocks spanned by each file of a TBM archive, along with
+ * their block control pointers, by following the chain of file control
+ * pointers in the label buffer. Only the label buffer is read. A block shared
+ * by two files appears once for each file.
+ *
+ * @param inBuf The label buffer (at least) of the archive.
+ * @param syslbn_data The SYSLBN of the archive.
+ * @param blocks Receives the list of blocks, in order of file and then of
+ *        block, which the caller should free().
+ * @param numBlocks Receives the length of `blocks'.
+ * @return 0 on success, or -1 if memory could not be allocated.
+ */
+int tbm_list_blocks(uint8_t const*const inBuf,
+                    SYSLBN_Data const*const syslbn_data,
+                    TBMBlock **const blocks, size_t *const numBlocks)
+{
+	const size_t labelBits = syslbn_data->bk*BK_BLOCK_SIZE_CDC_WORDS*60;
+	FileControlPointer fcp;
+	TBMBlock *list = NULL, *grown;
+	size_t num = 0, capacity = 0;
+	size_t offset, m;
+	int file = 0;
+
+	offset = syslbn_data->firstFCPOff * 60;
+
+	do {
+		read_fileControlPointer(inBuf, &fcp, offset);
+
+		if (!fcp.isEOF && fcp.dataBlkNum != syslbn_data->numBKBlocks-1) {
+			for (m = 0; m + FCP_HEADER_WORDS < fcp.nextFCPOff; m++) {
+				if (offset + (FCP_HEADER_WORDS+m+1)*60 > labelBits) {
+					break;
+				}
+				if (num == capacity) {
+					capacity = capacity ? 2*capacity : 64;
+					if (!(grown = (TBMBlock*)
+					      realloc(list, sizeof(TBMBlock)*capacity)))
+					{
+						free(list);
+						return -1;
+					}
+					list = grown;
+				}
+				read_blockControlPointer(inBuf, &(list[num].bcp),
+				                         offset + (FCP_HEADER_WORDS+m)*60);
+				list[num].block = fcp.dataBlkNum + m;
+				list[num].file = file;
+				num++;
+			}
+			file++;
+		}
+
+		offset += fcp.nextFCPOff*60;
+	} while (!fcp.isEOF && fcp.nextFCPOff && offset < labelBits);
+
+	*blocks = list;
+	*numBlocks = num;
+
+	return 0;
 }
 
 /**
@@ -315,6 +599,22 @@ void read_dataBufferFlags(uint8_t const*const inBuf,
 	                         sizeof(DataBufferFlags)/8);
 }
 
+/**
+ * Reads a BlockControlPointer structure from a buffer.
+ *
+ * @param inBuf
+ * @param bcp
+ * @param offset
+ */
+void read_blockControlPointer(uint8_t const*const inBuf,
+                              BlockControlPointer *const bcp,
+                              const size_t offset)
+{
+	gbytes<uint8_t,uint64_t>(inBuf+(offset/8), (uint64_t*) bcp,
+	                         offset%8, 60, 0,
+	                         sizeof(BlockControlPointer)/8);
+}
+
 /**
  * Pretty-prints a VOL1 structure to standard out.
  *
@@ -38,8 +38,8 @@
 #ifndef TBM_H
 #define TBM_H
 
-// Rounds up division.
-#define DIV_CEIL(n,d) (((n)-1)/(d)+1)
+// Rounds up division. Zero divides to zero, so an empty segment is 0 bytes.
+#define DIV_CEIL(n,d) (((n)+(d)-1)/(d))
 
 #define BK_BLOCK_SIZE_CDC_WORDS 2048
 #define BK_BLOCK_SIZE_BYTES ((BK_BLOCK_SIZE_CDC_WORDS*60)/8)
@@ -361,6 +361,12 @@ HDR2_Text hdr2;
 /* Word     31 */ char fcpToBlkCtrlOff[5];    /** Offset from file control pointer to first block control pointer */
 } SYSLBN_Text;
 
+/* Each file control pointer is followed by eight file history words and then
+ * by one block control pointer per BK block spanned by the file (FCPMIN in
+ * as.s).
+ */
+#define FCP_HEADER_WORDS 9
+
 /** File Control Pointer ("FCP") */
 typedef struct {
 /* Word  0 */ uint64_t nextFCPOff          : 12; /** "[Number of?] words to next file control pointer". */
@@ -447,6 +453,22 @@ typedef struct {
 /* TODO: Word "+9+M-1", Word "+9+M" */
 } BlockControlPointer;
 
+/* BlockControlPointer.wordsToFirstPtr counts from OSSWN (0300 in as.s), and
+ * from 1 rather than 0 (as does tbm2cos), so the first data buffer flags of
+ * the block are at word wordsToFirstPtr-BCP_FIRST_PTR_BIAS of the block.
+ */
+#define BCP_FIRST_PTR_BIAS 0301
+
+/**
+ * A data block of a TBM archive, as described by the block control pointer
+ * of the file which spans it. Block 0 is the one following the label buffer.
+ */
+typedef struct {
+	size_t block;            /** Data block number. */
+	int file;                /** Index of the file whose BCP this is. */
+	BlockControlPointer bcp;
+} TBMBlock;
+
 /**
  * Data buffer flags. "Precede each data record."
  *
@@ -486,18 +508,47 @@ typedef struct {
 	size_t offsetToDataStart; /** Offset to where data (NOT the header) begins */
 } TBMFile;
 
+/* Values returned by the library on failure. The callbacks of a TBMExtractor
+ * should return positive values, so that the two can be told apart.
+ */
+#define TBM_OK          0
+#define TBM_ERR_IO     -1 /** A read failed; errno is set. */
+#define TBM_ERR_NOMEM  -2 /** Memory could not be allocated. */
+#define TBM_ERR_FORMAT -3 /** The archive is malformed or truncated. */
+#define TBM_ERR_RANGE  -4 /** There is no such file or record. */
+
 /**
- * Representation of a TBM archive, containing one or more TBM files. Note that
- * this structure does *not* directly map to the organization of data contained
- * in an actual TBM archive.
+ * Receives the data of the files in a TBM archive from tbm_extract(). Any of
+ * the callbacks may be NULL. A callback returning nonzero stops the walk.
  */
 typedef struct {
-	SYSLBN_Text syslbn_text;
-	SYSLBN_Data syslbn_data;
-	TBMFile *files;
-} TBMArchive;
-
-void tbm_read(uint8_t *const inBuf, const uint64_t bk, TBMFile *const files, int numFiles);
+	void *arg; /** Passed as the first argument of each callback. */
+	/** Called once the labels of file `i' have been read. */
+	int (*beginFile)(void *arg, const int i, TBMFile const*const file);
+	/** Called for each data segment of file `i': `numWords' 60-bit words
+	    starting at bit `offset' of the archive, preceded by the data buffer
+	    flags `dbf', belong at bit `writeOffset' of the extracted file. */
+	int (*segment)(void *arg, const int i, uint8_t const*const inBuf,
+	               DataBufferFlags const*const dbf, const size_t offset,
+	               const size_t numWords, const size_t writeOffset);
+	/** Called at the end of file `i', once file->size is known. */
+	int (*endFile)(void *arg, const int i, TBMFile const*const file);
+} TBMExtractor;
+
+int tbm_check_syslbn(SYSLBN_Data const*const syslbn_data, const size_t len);
+int tbm_read(uint8_t *const inBuf, const uint64_t bk, TBMFile *const files,
+             int numFiles);
+int tbm_extract(uint8_t const*const inBuf, const size_t len,
+                const uint64_t bk, TBMFile *const files, const int numFiles,
+                TBMExtractor const*const ex);
+int tbm_count_files(uint8_t const*const inBuf,
+                    SYSLBN_Data const*const syslbn_data,
+                    size_t *const numBlocks, const int print);
+int tbm_list_blocks(uint8_t const*const inBuf,
+                    SYSLBN_Data const*const syslbn_data,
+                    TBMBlock **const blocks, size_t *const numBlocks);
+int tbm_pread(const int fd, uint8_t *const buf, const size_t len,
+              const size_t offset);
 
 void read_syslbn(uint8_t const*const inBuf, SYSLBN_Text *const text,
                  SYSLBN_Data *const data, const size_t offset);
@@ -511,6 +562,9 @@ void read_dataBufferFlags(uint8_t const*const inBuf,
 void read_fileControlPointer(uint8_t const*const inBuf,
                              FileControlPointer *const fcp,
                              const size_t offset);
+void read_blockControlPointer(uint8_t const*const inBuf,
+                              BlockControlPointer *const bcp,
+                              const size_t offset);
 void read_vol1(uint8_t const*const inBuf,
                VOL1_Text *const text,
                VOL1_Data *const data,
@@ -0,0 +1,464 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Builds and searches a catalog of the files on many TBM archives.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "tbm.hpp"
+#include "libtbm.hpp"
+#include "catalog.hpp"
+
+static int add_volumes(const char catalogPath[], char *const*const paths,
+                       const size_t numPaths, const unsigned numThreads);
+static int list_files(const char catalogPath[], const char prefix[],
+                      const unsigned year, const int listVolumes);
+static int read_path_list(const char listFileName[], char ***paths,
+                          size_t *numPaths);
+static int compare_scans(const void *a, const void *b);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+	static const struct option longOptions[] = {
+		{ "add",     no_argument,       NULL, 'a' },
+		{ "list",    required_argument, NULL, 'l' },
+		{ "jobs",    required_argument, NULL, 'j' },
+		{ "dataset", required_argument, NULL, 'd' },
+		{ "year",    required_argument, NULL, 'Y' },
+		{ "volumes", no_argument,       NULL, 'v' },
+		{ NULL,      0,                 NULL,  0  }
+	};
+	int add = 0;
+	int listVolumes = 0;
+	char *listFileName = NULL;
+	const char *prefix = "";
+	unsigned year = 0;
+	unsigned numThreads = 0;
+	char **paths;
+	size_t numPaths;
+	long n;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "al:j:d:Y:v", longOptions,
+	                          NULL)) != -1)
+	{
+		switch (opt) {
+			case 'a': add = 1;               break;
+			case 'l': listFileName = optarg; break;
+			case 'j':
+				if ((n = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid number of jobs \"%s\".\n",
+					        optarg);
+					return 1;
+				}
+				numThreads = (unsigned) n;
+				break;
+			case 'd': prefix = optarg;       break;
+			case 'Y':
+				if ((n = strtol(optarg, NULL, 10)) < 1900) {
+					fprintf(stderr, "Error: invalid year \"%s\".\n", optarg);
+					return 1;
+				}
+				year = (unsigned) n;
+				break;
+			case 'v': listVolumes = 1;       break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (!add) {
+		if (argc - optind != 1) {
+			fprintf(stderr, "Error: Require exactly one argument.\n");
+			usage();
+			return 1;
+		}
+		return list_files(argv[optind], prefix, year, listVolumes);
+	}
+
+	if (listFileName ? argc - optind != 1 : argc - optind < 2) {
+		fprintf(stderr, "Error: Require %s.\n", listFileName ?
+		        "exactly one argument with --list" : "at least two arguments");
+		usage();
+		return 1;
+	}
+
+	if (listFileName) {
+		if (read_path_list(listFileName, &paths, &numPaths)) {
+			return 1;
+		}
+	} else {
+		paths = argv+optind+1;
+		numPaths = argc-optind-1;
+	}
+
+	if (!numThreads) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		numThreads = n > 0 ? (unsigned) n : 1;
+	}
+
+	return add_volumes(argv[optind], paths, numPaths, numThreads);
+}
+
+/**
+ * Adds volumes to a catalog, creating it if need be. A volume already in the
+ * catalog under the same name is replaced. The other volumes in the catalog
+ * are kept as they are, without being read again.
+ *
+ * @param catalogPath
+ * @param paths
+ * @param numPaths
+ * @param numThreads Number of volumes to read at once.
+ * @return 0 on success, or 1 if any volume could not be added.
+ */
+static int add_volumes(const char catalogPath[], char *const*const paths,
+                       const size_t numPaths, const unsigned numThreads)
+{
+	Catalog old, cat;
+	CatalogScan *scans = NULL;
+	CatalogScan **order = NULL;
+	CatalogVolume *volumes = NULL;
+	CatalogFile *files = NULL;
+	ssize_t *oldIndex = NULL;
+	size_t numVolumes = 0, numFiles = 0, maxFiles;
+	size_t numNew = 0, numUpdated = 0, numUnchanged = 0, numFailed = 0;
+	size_t i, j;
+	ssize_t k;
+	int status = 0;
+
+	if (catalog_read(&old, catalogPath)) {
+		if (errno != ENOENT) {
+			fprintf(stderr, "Error: \"%s\" is not a catalog.\n",
+			        catalogPath);
+			return 1;
+		}
+	}
+
+	scans = (CatalogScan*) calloc(numPaths+1, sizeof(CatalogScan));
+	order = (CatalogScan**) malloc(sizeof(CatalogScan*)*(numPaths+1));
+	oldIndex = (ssize_t*) malloc(sizeof(ssize_t)*(old.numVolumes+1));
+	if (!scans || !order || !oldIndex) {
+		goto mallocfail;
+	}
+
+	if (catalog_scan(paths, numPaths, numThreads, scans)) {
+		goto mallocfail;
+	}
+
+	/* If a name is given more than once, the last one wins. */
+	for (i = 0; i < numPaths; i++) {
+		order[i] = &scans[i];
+	}
+	qsort(order, numPaths, sizeof(CatalogScan*), compare_scans);
+	for (i = 0; i+1 < numPaths; i++) {
+		if (!strcmp(order[i]->volume.name, order[i+1]->volume.name)) {
+			order[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < old.numVolumes; i++) {
+		oldIndex[i] = 0;
+	}
+	maxFiles = old.numFiles;
+	for (i = 0; i < numPaths; i++) {
+		if (!order[i]) {
+			continue;
+		}
+		if (order[i]->status) {
+			fprintf(stderr, "Error: failed to catalog \"%s\": %s\n",
+			        order[i]->volume.path,
+			        order[i]->status == TBM_ERR_IO
+			            ? "failed to read"
+			            : tbm_strerror(order[i]->status));
+			numFailed++;
+			status = 1;
+			continue;
+		}
+		maxFiles += order[i]->volume.numFiles;
+		if ((k = catalog_find_volume(&old, order[i]->volume.name)) < 0) {
+			numNew++;
+			continue;
+		}
+		oldIndex[k] = -1;
+		if (old.volHash[k] == order[i]->volume.hash &&
+		    old.volSize[k] == order[i]->volume.size &&
+		    !strcmp(old.strings + old.volPath[k], order[i]->volume.path))
+		{
+			numUnchanged++;
+		} else {
+			numUpdated++;
+		}
+	}
+
+	volumes = (CatalogVolume*) malloc(sizeof(CatalogVolume)*
+	                                  (old.numVolumes+numPaths+1));
+	files = (CatalogFile*) malloc(sizeof(CatalogFile)*(maxFiles+1));
+	if (!volumes || !files) {
+		goto mallocfail;
+	}
+
+	/* Keep the volumes which are not being replaced, and their files. */
+	for (i = 0; i < old.numVolumes; i++) {
+		if (oldIndex[i] == 0) {
+			catalog_volume(&old, i, &volumes[numVolumes]);
+			oldIndex[i] = numVolumes++;
+		}
+	}
+	for (j = 0; j < old.numFiles; j++) {
+		if (oldIndex[old.volume[j]] >= 0) {
+			catalog_file(&old, j, &files[numFiles]);
+			files[numFiles++].volume = oldIndex[old.volume[j]];
+		}
+	}
+
+	for (i = 0; i < numPaths; i++) {
+		if (!order[i] || order[i]->status) {
+			continue;
+		}
+		for (j = 0; j < order[i]->volume.numFiles; j++) {
+			files[numFiles] = order[i]->files[j];
+			files[numFiles++].volume = numVolumes;
+		}
+		volumes[numVolumes++] = order[i]->volume;
+	}
+
+	if (catalog_build(&cat, volumes, numVolumes, files, numFiles)) {
+		goto mallocfail;
+	}
+	if (catalog_write(&cat, catalogPath)) {
+		fprintf(stderr, "Error: failed to write \"%s\": %s\n", catalogPath,
+		        strerror(errno));
+		status = 1;
+	} else {
+		printf("Info: \"%s\" lists %lu volumes and %lu files (%lu added, "
+		       "%lu updated, %lu unchanged, %lu failed)\n", catalogPath,
+		       (unsigned long) cat.numVolumes, (unsigned long) cat.numFiles,
+		       (unsigned long) numNew, (unsigned long) numUpdated,
+		       (unsigned long) numUnchanged, (unsigned long) numFailed);
+	}
+	catalog_free(&cat);
+
+	goto done;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
+	status = 1;
+
+done:
+	for (i = 0; scans && i < numPaths; i++) {
+		free(scans[i].files);
+	}
+	free(scans);
+	free(order);
+	free(oldIndex);
+	free(volumes);
+	free(files);
+	catalog_free(&old);
+
+	return status;
+}
+
+static int compare_scans(const void *a, const void *b)
+{
+	CatalogScan const*const x = *(CatalogScan const*const*) a;
+	CatalogScan const*const y = *(CatalogScan const*const*) b;
+	int c;
+
+	if ((c = strcmp(x->volume.name, y->volume.name))) {
+		return c;
+	}
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Prints the files of a catalog, or the volumes holding them, whose data set
+ * IDs begin with `prefix' and which were created in `year' (if not 0), as
+ * tab-separated lines.
+ *
+ * @return 0 on success, or 1 if the catalog could not be read.
+ */
+static int list_files(const char catalogPath[], const char prefix[],
+                      const unsigned year, const int listVolumes)
+{
+	Catalog cat;
+	CatalogVolume v;
+	CatalogFile f;
+	size_t first, end, i;
+	uint8_t *seen;
+
+	if (catalog_read(&cat, catalogPath)) {
+		fprintf(stderr, "Error: failed to read catalog \"%s\": %s\n",
+		        catalogPath, errno == EINVAL ? "not a catalog"
+		                                     : strerror(errno));
+		return 1;
+	}
+	if (!(seen = (uint8_t*) calloc(cat.numVolumes+1, sizeof(uint8_t)))) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+		catalog_free(&cat);
+		return 1;
+	}
+
+	if (listVolumes) {
+		printf("# volume\tserial\tfiles\tbytes\tpath\n");
+	} else {
+		printf("# dataset\tvolume\tfile\tcreated\texpires\trecordLen\t"
+		       "maxRecord\tuseCount\tversion\tblocks\n");
+	}
+
+	catalog_find(&cat, prefix, &first, &end);
+	for (i = first; i < end; i++) {
+		if (year && cat.creationYear[i] != year) {
+			continue;
+		}
+		catalog_volume(&cat, cat.volume[i], &v);
+		if (listVolumes) {
+			if (!seen[cat.volume[i]]) {
+				seen[cat.volume[i]] = 1;
+				printf("%s\t%.*s\t%u\t%lu\t%s\n", v.name, CATALOG_SERIAL_LEN,
+				       v.serial, (unsigned) v.numFiles,
+				       (unsigned long) v.size, v.path);
+			}
+			continue;
+		}
+		catalog_file(&cat, i, &f);
+		printf("%.*s\t%s\t%u\t%04u-%03u\t%04u-%03u\t%u\t%u\t%u\t%u\t%u\n",
+		       CATALOG_DSID_LEN, f.dataSetID, v.name, (unsigned) f.file,
+		       f.creationYear, f.creationDay, f.expirationYear,
+		       f.expirationDay, (unsigned) f.recordLen,
+		       (unsigned) f.maxRecordNum, f.useCount, f.versionNum,
+		       (unsigned) f.numBlocks);
+	}
+
+	free(seen);
+	catalog_free(&cat);
+
+	return 0;
+}
+
+/**
+ * Reads a list of paths, one per line. Blank lines and lines beginning with
+ * '#' are ignored.
+ *
+ * @param listFileName
+ * @param paths Receives a newly allocated array of paths.
+ * @param numPaths Receives the number of paths in the list.
+ * @return 0 on success, 1 on failure.
+ */
+static int read_path_list(const char listFileName[], char ***paths,
+                          size_t *numPaths)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t lineLen = 0;
+	size_t capacity = 0;
+	char **grown;
+	char *s;
+
+	if (!(fp = fopen(listFileName, "r"))) {
+		fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n",
+		        listFileName);
+		return 1;
+	}
+
+	*paths = NULL;
+	*numPaths = 0;
+	while (getline(&line, &lineLen, fp) != -1) {
+		if ((s = strchr(line, '\n'))) {
+			*s = '\0';
+		}
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
+		}
+		if (*numPaths == capacity) {
+			capacity = capacity ? 2*capacity : 64;
+			if (!(grown = (char**) realloc(*paths, sizeof(char*)*capacity))) {
+				goto mallocfail;
+			}
+			*paths = grown;
+		}
+		if (!((*paths)[*numPaths] = strdup(line))) {
+			goto mallocfail;
+		}
+		(*numPaths)++;
+	}
+
+	free(line);
+	fclose(fp);
+
+	return 0;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
+	while (*numPaths) {
+		free((*paths)[--(*numPaths)]);
+	}
+	free(*paths);
+	*paths = NULL;
+	free(line);
+	fclose(fp);
+	return 1;
+}
+
+static void usage(void)
+{
+	printf("Usage:\n"
+	       "\n"
+	       "    tbmcat [OPTIONS] CATALOG\n"
+	       "    tbmcat --add [OPTIONS] CATALOG VOLUME...\n"
+	       "    tbmcat --add [OPTIONS] --list LISTFILE CATALOG\n"
+	       "\n"
+	       "Options:\n"
+	       "\n"
+	       "    -a, --add            Add the labels of each VOLUME to CATALOG,\n"
+	       "                         creating it if need be. A volume with\n"
+	       "                         the same base name as one already in the\n"
+	       "                         catalog replaces it.\n"
+	       "    -l, --list LISTFILE  Add every volume named in LISTFILE (one\n"
+	       "                         path per line).\n"
+	       "    -j, --jobs N         Number of volumes read at once by --add\n"
+	       "                         (default: one per processor).\n"
+	       "    -d, --dataset ID     Only list files whose data set IDs begin\n"
+	       "                         with ID.\n"
+	       "    -Y, --year YEAR      Only list files created in YEAR.\n"
+	       "    -v, --volumes        List the volumes holding the matching\n"
+	       "                         files rather than the files.\n");
+}
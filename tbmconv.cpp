@@ -40,114 +40,645 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "gbytes.cpp"
 #include "cdc.hpp"
 #include "tbm.hpp"
+#include "shard.hpp"
+#include "output.hpp"
+#include "verify.hpp"
+#include "survey.hpp"
+#include "libtbm.hpp"
+#include "convert.hpp"
+#include "npy.hpp"
 
-#define OUT_FILE_NAME_LEN 100
+#define OUT_FILE_NAME_LEN 1024
+#define SHARD_KEY_LEN 256
+
+/**
+ * A TBM archive to be converted, along with its share of the work when
+ * running as one shard of a job array.
+ */
+typedef struct {
+	char *path;           /* Path to the TBM archive. */
+	const char *name;     /* Base name of the path; used as the shard key. */
+	uint64_t size;        /* Size of the archive in bytes. */
+	int numFiles;         /* Only known when sharding by file. */
+	size_t *fileBlocks;   /* BK blocks spanned by each file. */
+	unsigned *fileShards; /* Shard of each file, when sharding by file. */
+	unsigned shard;       /* Shard of the whole volume. */
+} Volume;
+
+/**
+ * State shared by the tbm_walk() callbacks while converting one volume.
+ */
+typedef struct {
+	TBMArchive const *archive;
+	Volume const *vol;
+	Shard const *shard;
+	const char *outFileNameFormatStr;
+	FILE *summary;
+	size_t *bytesWritten;
+	int filesWritten;
+	int skip;                            /* Not extracting the current file. */
+	int isOpen;                          /* `out' and `writer' are in use. */
+	int convert;                         /* Converting records by mode. */
+	size_t preallocSize;                 /* Bytes allocated for the current
+	                                        output file when it is opened,
+	                                        or 0 if its size isn't known. */
+	Converter conv;
+	size_t convertedSize;                /* Bytes of the current file
+	                                        written so far, when converting. */
+	int arrayMode;                       /* Mode of the records written as
+	                                        the current file's NumPy array,
+	                                        or -1 if it has none. */
+	char outFileName[OUT_FILE_NAME_LEN]; /* Name of the current output file. */
+	OutFile out;
+	OutWriter writer;
+} Extraction;
+
+static int convert_volume(Volume const*const vol,
+                          const char outFileNameBase[],
+                          Shard const*const shard,
+                          const unsigned verifyThreads, const int useIndex,
+                          const int convert,
+                          ConvertOptions const*const convertOpts,
+                          FILE *const summary,
+                          size_t *const bytesWritten);
+static int survey_volume(Volume const*const vol, const unsigned numSamples,
+                         const uint64_t seed);
+static int dump_record(Volume const*const vol, const int file,
+                       const size_t record, const char wordCacheDir[],
+                       const char outFileName[]);
+static int open_output(Extraction *const ex);
+static int begin_file(void *arg, const int i, TBMFile const*const file);
+static int write_segment(void *arg, const int i, uint8_t const*const inBuf,
+                         DataBufferFlags const*const dbf, const size_t offset,
+                         const size_t numWords, const size_t writeOffset);
+static int end_file(void *arg, const int i, TBMFile const*const file);
+static int convert_file(TBMArchive const*const archive, const int i,
+                        Extraction *const ex);
+static int begin_array(TBMArchive const*const archive, const int i,
+                       Extraction *const ex);
+static int is_written(Extraction const*const ex,
+                      TBMRecordView const*const view);
+static int convert_batch(Extraction *const ex,
+                         TBMRecordView const*const views, const size_t n,
+                         const size_t size);
+static int read_volume_list(const char listFileName[], Volume **volumes,
+                            size_t *numVolumes);
+static int read_label_block(Volume *const vol);
+static int check_names(Volume const*const volumes, const size_t numVolumes);
+static int compare_names(const void *a, const void *b);
+static void free_volumes(Volume *const volumes, const size_t numVolumes,
+                         const int ownPaths);
+static void usage(void);
 
 int main(int argc, char **argv)
 {
-	SYSLBN_Data syslbn_data;
-	SYSLBN_Text syslbn_text;
-	FileHistoryWord_Data fhw_data;
-	FileHistoryWord_Text fhw_text;
-	FileControlPointer fcp;
-	DataBufferFlags dbf;
-	FILE *fp;                       /* Handle to the input/output files. */
-	char *inFileName;               /* Name of the input file. */
-	char outFileName[OUT_FILE_NAME_LEN]; /* Name of the output file. */
-	char *outFileNameFormatStr;     /* */
-	uint8_t *inBuf;                 /* */
-	size_t fileSize;                /* */
-	size_t offset;                  /* */
-	uint8_t *decodeBuf = NULL;      /* */
-	int first;                      /* */
-	int i;                          /* */
-	int numFiles = 0;               /* Number of files in the TBM archive. */
-	size_t outFileNameFormatStrLen, newLen;
-	const char fileIndexFormatStr[] = "%d";
-	size_t writeOffset = 0;
-	TBMFile *files;
-	int filesWritten = 0;
+	static const struct option longOptions[] = {
+		{ "shard",       required_argument, NULL, 's' },
+		{ "balance",     no_argument,       NULL, 'b' },
+		{ "shard-files", no_argument,       NULL, 'f' },
+		{ "list",        required_argument, NULL, 'l' },
+		{ "summary",     required_argument, NULL, 'S' },
+		{ "verify",      no_argument,       NULL, 'V' },
+		{ "jobs",        required_argument, NULL, 'j' },
+		{ "survey",      no_argument,       NULL, 'y' },
+		{ "samples",     required_argument, NULL, 'n' },
+		{ "seed",        required_argument, NULL, 'r' },
+		{ "index",       no_argument,       NULL, 'i' },
+		{ "record",      required_argument, NULL, 'R' },
+		{ "word-cache",  required_argument, NULL, 'w' },
+		{ "convert",     no_argument,       NULL, 'c' },
+		{ "big-endian",  no_argument,       NULL, 'B' },
+		{ "nan-payload", required_argument, NULL, 'N' },
+		{ "double",      required_argument, NULL, 'D' },
+		{ "quad",        no_argument,       NULL, 'Q' },
+		{ "mode",        required_argument, NULL, 'm' },
+		{ "framed",      no_argument,       NULL, 'F' },
+		{ "npy",         no_argument,       NULL, 'P' },
+		{ "select",      required_argument, NULL, 'e' },
+		{ NULL,          0,                 NULL,  0  }
+	};
+	Volume *volumes = NULL;
+	size_t numVolumes = 0;
+	Shard shard;
+	int haveShard = 0;
+	int balance = 0;
+	int shardFiles = 0;
+	char *listFileName = NULL;
+	char *summaryFileName = NULL;
+	FILE *summary = NULL;
+	int verify = 0;
+	int survey = 0;
+	int useIndex = 0;
+	int convert = 0;
+	int convertMode = CONVERT_MODE_RECORD;
+	int convertFlags = 0;
+	uint64_t nanPayload = 0;
+	ConvertOptions convertOpts;
+	ConvertRange *doubles = NULL, *selected = NULL, *ranges;
+	size_t numDoubles = 0, numSelected = 0;
+	int recordFile = -1;
+	unsigned long recordNum = 0;
+	char *wordCacheDir = NULL;
+	char trailing;
+	unsigned numSamples = SURVEY_DEFAULT_SAMPLES;
+	uint64_t seed = 0;
+	long numJobs;
+	unsigned verifyThreads;
+	FILE *fp;
+	char outFileName[OUT_FILE_NAME_LEN];
+	char key[SHARD_KEY_LEN];
+	const char *s;
+	uint64_t *weights = NULL;
+	const char **keys = NULL;
+	unsigned *assignment = NULL;
+	size_t numUnits = 0, unit, bytesWritten, totalBytes = 0;
+	size_t i;
+	int j, opt;
+	int status = 0;
+	int volumesConverted = 0;
 
-	if (argc != 3) {
-		fprintf(stderr, "Error: Require exactly two arguments.\n");
-		printf("Usage:\n"
-		       "\n"
-		       "    tbmconv INFILE OUTFILE\n");
-		return 1;
+	verifyThreads = 0;
+
+	while ((opt = getopt_long(argc, argv, "s:bfl:S:Vj:yn:r:iR:w:cBN:D:Qm:FPe:",
+	                          longOptions, NULL)) != -1)
+	{
+		switch (opt) {
+			case 's':
+				if (shard_parse(optarg, &shard)) {
+					fprintf(stderr, "Error: invalid shard \"%s\"; expected "
+					                "I/N with 0 <= I < N.\n", optarg);
+					return 1;
+				}
+				haveShard = 1;
+				break;
+			case 'b': balance = 1;              break;
+			case 'f': shardFiles = 1;           break;
+			case 'l': listFileName = optarg;    break;
+			case 'S': summaryFileName = optarg; break;
+			case 'V': verify = 1;               break;
+			case 'j':
+				if ((numJobs = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid number of jobs \"%s\".\n",
+					        optarg);
+					return 1;
+				}
+				verifyThreads = (unsigned) numJobs;
+				break;
+			case 'y': survey = 1;               break;
+			case 'n':
+				if ((numJobs = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid number of samples "
+					                "\"%s\".\n", optarg);
+					return 1;
+				}
+				numSamples = (unsigned) numJobs;
+				break;
+			case 'r': seed = strtoull(optarg, NULL, 0); break;
+			case 'i': useIndex = 1;             break;
+			case 'R':
+				if (sscanf(optarg, "%d:%lu%c", &recordFile, &recordNum,
+				           &trailing) != 2 || recordFile < 0)
+				{
+					fprintf(stderr, "Error: invalid record \"%s\"; expected "
+					                "FILE:RECORD.\n", optarg);
+					return 1;
+				}
+				break;
+			case 'w': wordCacheDir = optarg;    break;
+			case 'c': convert = 1;              break;
+			case 'B': convertFlags |= CONVERT_BIG_ENDIAN; break;
+			case 'N': nanPayload = strtoull(optarg, NULL, 0); break;
+			case 'D':
+				if (!(ranges = (ConvertRange*) realloc(doubles,
+				              sizeof(ConvertRange)*(numDoubles+1))))
+				{
+					goto mallocfail;
+				}
+				doubles = ranges;
+				if (convert_parse_range(optarg, &doubles[numDoubles])) {
+					fprintf(stderr, "Error: invalid records \"%s\"; "
+					                "expected FILE, FILE:RECORD or "
+					                "FILE:FIRST-LAST.\n", optarg);
+					return 1;
+				}
+				numDoubles++;
+				break;
+			case 'Q': convertFlags |= CONVERT_QUAD; break;
+			case 'F':
+				convert = 1;
+				convertFlags |= CONVERT_FRAMED;
+				break;
+			case 'P':
+				convert = 1;
+				convertFlags |= CONVERT_NPY;
+				break;
+			case 'e':
+				if (!(ranges = (ConvertRange*) realloc(selected,
+				              sizeof(ConvertRange)*(numSelected+1))))
+				{
+					goto mallocfail;
+				}
+				selected = ranges;
+				if (convert_parse_range(optarg, &selected[numSelected])) {
+					fprintf(stderr, "Error: invalid records \"%s\"; "
+					                "expected FILE, FILE:RECORD or "
+					                "FILE:FIRST-LAST.\n", optarg);
+					return 1;
+				}
+				numSelected++;
+				break;
+			case 'm':
+				if (sscanf(optarg, "%d%c", &convertMode, &trailing) != 1 ||
+				    convertMode < 0 || convertMode > CONVERT_MODE_MAX)
+				{
+					fprintf(stderr, "Error: invalid mode \"%s\"; expected "
+					                "0 to %d.\n", optarg, CONVERT_MODE_MAX);
+					return 1;
+				}
+				break;
+			default:
+				usage();
+				return 1;
+		}
 	}
 
-	inFileName = argv[1];
+	if (numSelected && !convert) {
+		fprintf(stderr, "Error: --select requires --convert, --framed or "
+		                "--npy.\n");
+		return 1;
+	}
+	if ((convertFlags & CONVERT_NPY) && (convertFlags & CONVERT_FRAMED)) {
+		fprintf(stderr, "Error: --npy can't be used with --framed.\n");
+		return 1;
+	}
+	if ((convertFlags & CONVERT_NPY) && (convertFlags & CONVERT_QUAD)) {
+		fprintf(stderr, "Error: --npy can't be used with --quad.\n");
+		return 1;
+	}
 
-	outFileNameFormatStrLen = strlen(argv[2]);
-	if (!(outFileNameFormatStr = (char*)
-	      malloc(sizeof(char) * (outFileNameFormatStrLen+1))))
-	{
-		goto mallocfail;
+	if (verify && !verifyThreads) {
+		numJobs = sysconf(_SC_NPROCESSORS_ONLN);
+		verifyThreads = numJobs > 0 ? (unsigned) numJobs : 1;
 	}
-	strcpy(outFileNameFormatStr, argv[2]);
 
-	if (!(fp = fopen(inFileName, "r"))) {
-		fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n",
-		        inFileName);
+	if (survey) {
+		/* Surveying writes nothing, so every argument names a volume. */
+		if (listFileName ? argc - optind != 0 : argc - optind < 1) {
+			fprintf(stderr, "Error: Require %s.\n", listFileName ?
+			        "no arguments with --list" : "at least one argument");
+			usage();
+			return 1;
+		}
+		shardFiles = 0;
+	} else if (argc - optind != (listFileName ? 1 : 2)) {
+		fprintf(stderr, "Error: Require exactly %s.\n",
+		        listFileName ? "one argument" : "two arguments");
+		usage();
 		return 1;
 	}
 
-	fseek(fp, 0L, SEEK_END);
-	fileSize = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
+	if (listFileName) {
+		if (read_volume_list(listFileName, &volumes, &numVolumes)) {
+			return 1;
+		}
+	} else if (survey) {
+		numVolumes = argc - optind;
+		if (!(volumes = (Volume*) calloc(numVolumes, sizeof(Volume)))) {
+			goto mallocfail;
+		}
+		for (i = 0; i < numVolumes; i++) {
+			volumes[i].path = argv[optind+i];
+		}
+	} else {
+		if (!(volumes = (Volume*) calloc(1, sizeof(Volume)))) {
+			goto mallocfail;
+		}
+		volumes[0].path = argv[optind];
+		numVolumes = 1;
+	}
 
-	if (!(inBuf = (uint8_t*) malloc(sizeof(uint8_t)*fileSize))) {
-		goto mallocfail;
+	for (i = 0; i < numVolumes; i++) {
+		s = strrchr(volumes[i].path, '/');
+		volumes[i].name = s ? s+1 : volumes[i].path;
+		if (!(fp = fopen(volumes[i].path, "r"))) {
+			fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n",
+			        volumes[i].path);
+			status = 1;
+			goto done;
+		}
+		fseek(fp, 0L, SEEK_END);
+		volumes[i].size = ftell(fp);
+		fclose(fp);
+	}
+	if (check_names(volumes, numVolumes)) {
+		status = 1;
+		goto done;
 	}
 
-	if (fread(inBuf, sizeof(uint8_t), fileSize, fp) != fileSize) {
-		fprintf(stderr, "Error: failed to read contents of \"%s\".\n",
-		        inFileName);
-		return 1;
+	if (recordFile >= 0) {
+		if (listFileName) {
+			fprintf(stderr, "Error: --record can't be used with --list.\n");
+			status = 1;
+		} else {
+			status = dump_record(&volumes[0], recordFile, recordNum,
+			                     wordCacheDir, argv[optind+1]);
+		}
+		goto done;
 	}
 
-	read_syslbn(inBuf, &syslbn_text, &syslbn_data, 0);
-	print_syslbn(&syslbn_text, &syslbn_data, 0);
+	convertOpts.flags = convertFlags;
+	convertOpts.mode = convertMode;
+	convertOpts.nanPayload = nanPayload;
+	convertOpts.doubles = doubles;
+	convertOpts.numDoubles = numDoubles;
+	convertOpts.selected = selected;
+	convertOpts.numSelected = numSelected;
+
+	if (!haveShard) {
+		shard.index = 0;
+		shard.count = 1;
+		shardFiles = 0;
+	}
 
-	/* Sanity check the SYSLBN header. */
-	assert(syslbn_data.vol1.vol1 == MAGIC_VOL1);
-	assert(syslbn_data.hdr1.hdr1 == MAGIC_HDR1);
-	assert(syslbn_data.hdr1.dataSetID_1_6 == MAGIC_NCARSY);
-	assert(syslbn_data.hdr1.dataSetID_7_12 == MAGIC_STEMHD);
-	assert(syslbn_data.hdr1.dataSetID_13_16 == MAGIC_1000);
-	assert(syslbn_data.hdr1.dataSetID_17 == MAGIC_1);
-	assert(syslbn_data.hdr2.hdr2 == MAGIC_HDR2);
-
-	/* Sanity check the length of the file. */
-	assert(fileSize == (size_t) (syslbn_data.numBKBlocks+1)*
-	                            syslbn_data.bk*BK_BLOCK_SIZE_BYTES);
-
-	/* The location of the first file control pointer is specified in the
-	 * SYSLBN.
+	/* Assign work to shards. Every shard performs this same computation on
+	 * the same inputs, so all shards agree on the assignment without talking
+	 * to each other.
 	 */
-	offset = syslbn_data.firstFCPOff * 60;
+	if (haveShard && shardFiles) {
+		numUnits = 0;
+		for (i = 0; i < numVolumes; i++) {
+			if (read_label_block(&volumes[i])) {
+				status = 1;
+				goto done;
+			}
+			numUnits += volumes[i].numFiles;
+		}
+	} else {
+		numUnits = numVolumes;
+	}
 
-	/* Read file control pointers. */
-	do {
-		read_fileControlPointer(inBuf, &fcp, offset);
+	weights = (uint64_t*) malloc(sizeof(uint64_t)*(numUnits+1));
+	keys = (const char**) calloc(numUnits+1, sizeof(char*));
+	assignment = (unsigned*) malloc(sizeof(unsigned)*(numUnits+1));
+	if (!weights || !keys || !assignment) {
+		goto mallocfail;
+	}
 
-		/* Each file control pointer is immediately followed by a set of file
-		 * history words.
-		 */
-		read_fileHistoryWord(inBuf, &fhw_text, &fhw_data, offset+60);
+	for (i = 0, unit = 0; i < numVolumes; i++) {
+		if (haveShard && shardFiles) {
+			for (j = 0; j < volumes[i].numFiles; j++, unit++) {
+				snprintf(key, SHARD_KEY_LEN, "%s:%d", volumes[i].name, j);
+				if (!(keys[unit] = strdup(key))) {
+					goto mallocfail;
+				}
+				weights[unit] = volumes[i].fileBlocks[j];
+			}
+		} else {
+			keys[unit] = volumes[i].name;
+			weights[unit] = volumes[i].size;
+			unit++;
+		}
+	}
+
+	if (balance) {
+		shard_balance(weights, keys, numUnits, shard.count, assignment);
+	} else {
+		for (unit = 0; unit < numUnits; unit++) {
+			assignment[unit] = shard_of_key(keys[unit], shard.count);
+		}
+	}
+
+	for (i = 0, unit = 0; i < numVolumes; i++) {
+		if (haveShard && shardFiles) {
+			volumes[i].fileShards = assignment+unit;
+			unit += volumes[i].numFiles;
+		} else {
+			volumes[i].shard = assignment[unit++];
+		}
+	}
+
+	if (survey) {
+		for (i = 0; i < numVolumes; i++) {
+			if (volumes[i].shard != shard.index) {
+				continue;
+			}
+			/* Mix the name into the seed so that each volume gets its own,
+			 * repeatable, sample.
+			 */
+			if (survey_volume(&volumes[i], numSamples,
+			                  seed ^ shard_hash(volumes[i].name)))
+			{
+				status = 1;
+			}
+		}
+		goto done;
+	}
 
-		print_fileControlPtr(&fcp, offset, 0, 0);
-		print_fileHistoryWord(&fhw_text, &fhw_data, offset+60);
+	if (summaryFileName) {
+		if (!(summary = fopen(summaryFileName, "w"))) {
+			fprintf(stderr, "Error: failed to open \"%s\" for writing.\n",
+			        summaryFileName);
+			status = 1;
+			goto done;
+		}
+		fprintf(summary, "# tbmconv shard %u/%u\n"
+		                 "# volume\tfile\tbytes\toutput\n",
+		        shard.index, shard.count);
+	}
 
-		offset += fcp.nextFCPOff*60;
+	for (i = 0; i < numVolumes; i++) {
+		if (!volumes[i].fileShards && volumes[i].shard != shard.index) {
+			fprintf(stderr, "Info: \"%s\" belongs to shard %u, skipping\n",
+			        volumes[i].path, volumes[i].shard);
+			continue;
+		}
 
-		if (!fcp.isEOF && fcp.dataBlkNum != syslbn_data.numBKBlocks-1) {
-			numFiles++;
+		if (listFileName) {
+			snprintf(outFileName, OUT_FILE_NAME_LEN, "%s/%s", argv[optind],
+			         volumes[i].name);
+		} else {
+			snprintf(outFileName, OUT_FILE_NAME_LEN, "%s", argv[optind+1]);
 		}
-	} while (!fcp.isEOF);
+
+		bytesWritten = 0;
+		if (convert_volume(&volumes[i], outFileName,
+		                   haveShard ? &shard : NULL,
+		                   verify ? verifyThreads : 0, useIndex, convert,
+		                   &convertOpts, summary, &bytesWritten))
+		{
+			status = 1;
+			if (summary) {
+				fprintf(summary, "%s\t-\t-\tFAILED\n", volumes[i].name);
+			}
+			continue;
+		}
+		totalBytes += bytesWritten;
+		volumesConverted++;
+	}
+
+	if (summary) {
+		fprintf(summary, "# total\t%d\t%lu\n", volumesConverted,
+		        (unsigned long) totalBytes);
+		fclose(summary);
+	}
+
+	if (numVolumes > 1) {
+		printf("Info: Converted %d of %lu volumes\n", volumesConverted,
+		       (unsigned long) numVolumes);
+	}
+
+done:
+	/* Only the per-file keys are copies; the others are volume names. */
+	if (keys && haveShard && shardFiles) {
+		for (unit = 0; unit < numUnits; unit++) {
+			free((char*) keys[unit]);
+		}
+	}
+	free(keys);
+	free(weights);
+	free(assignment);
+	free_volumes(volumes, numVolumes, listFileName != NULL);
+	free(doubles);
+	free(selected);
+
+	return status;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
+	status = 1;
+	goto done;
+}
+
+/**
+ * Extracts the files contained in one TBM archive.
+ *
+ * @param vol
+ * @param outFileNameBase Output file name, or printf format string taking the
+ *        index of the file within the archive.
+ * @param shard If not NULL, only the files assigned to this shard are written.
+ * @param verifyThreads If nonzero, the block checksums are verified using this
+ *        many threads before anything is written. Blocks whose checksums
+ *        differ are reported (see verify.cpp), but the archive is only not
+ *        converted if blocks are missing from it.
+ * @param useIndex If set to true, the archive's sidecar index is used instead
+ *        of walking the archive, and is created if it is missing or stale.
+ * @param convert If set to true, each record is converted according to its
+ *        data mode (see convert_records()) rather than written as it is.
+ * @param convertOpts How to convert records.
+ * @param summary If not NULL, a line describing each file written is appended
+ *        to this file.
+ * @param bytesWritten Incremented by the number of bytes written.
+ * @return 0 on success, or 1 if the archive could not be converted.
+ */
+static int convert_volume(Volume const*const vol,
+                          const char outFileNameBase[],
+                          Shard const*const shard,
+                          const unsigned verifyThreads, const int useIndex,
+                          const int convert,
+                          ConvertOptions const*const convertOpts,
+                          FILE *const summary,
+                          size_t *const bytesWritten)
+{
+	SYSLBN_Data syslbn_data;
+	SYSLBN_Text syslbn_text;
+	TBMArchive *archive = NULL;
+	char *outFileNameFormatStr;     /* */
+	uint8_t const *inBuf;           /* */
+	size_t fileSize;                /* */
+	int numFiles = 0;               /* Number of files in the TBM archive. */
+	size_t outFileNameFormatStrLen, newLen;
+	const char fileIndexFormatStr[] = "%d";
+	char *str;
+	Extraction ex;
+	TBMExtractor extractor;
+	BlockCheck *bad;
+	size_t numBad, numBadBlocks, numMissing, j;
+	int i;
+	int status;
+
+	outFileNameFormatStrLen = strlen(outFileNameBase);
+	if (!(outFileNameFormatStr = (char*)
+	      malloc(sizeof(char) * (outFileNameFormatStrLen+1))))
+	{
+		goto mallocfail;
+	}
+	strcpy(outFileNameFormatStr, outFileNameBase);
+
+	/* Opening the archive checks its labels and walks it once (or loads its
+	 * sidecar index).
+	 */
+	if ((status = tbm_open_path(&archive, vol->path,
+	                            useIndex ? TBM_OPEN_INDEX : 0)))
+	{
+		fprintf(stderr, "Error: Failed to open \"%s\": %s\n", vol->path,
+		        status == TBM_ERR_IO ? strerror(errno)
+		                             : tbm_strerror(status));
+		free(outFileNameFormatStr);
+		return 1;
+	}
+	inBuf = tbm_archive_data(archive, &fileSize);
+
+	tbm_archive_syslbn(archive, &syslbn_text, &syslbn_data);
+	print_syslbn(&syslbn_text, &syslbn_data, 0);
+
+	/* Print file control pointers. */
+	tbm_count_files(inBuf, &syslbn_data, NULL, 1);
+	numFiles = tbm_num_files(archive);
+
+	if (verifyThreads) {
+		if (tbm_verify(inBuf, fileSize, &syslbn_data, verifyThreads, &bad,
+		               &numBad))
+		{
+			goto mallocfail;
+		}
+		/* A block shared by two files is described by two BCPs, and so is
+		 * reported once for each file.
+		 */
+		numBadBlocks = numMissing = 0;
+		for (j = 0; j < numBad; j++) {
+			if (j == 0 || bad[j].block != bad[j-1].block) {
+				numBadBlocks++;
+			}
+			if (bad[j].actual == VERIFY_BLOCK_MISSING) {
+				fprintf(stderr, "Error: block %lu of \"%s\" (file %d) is "
+				                "beyond the end of the archive\n",
+				        (unsigned long) bad[j].block, vol->path,
+				        bad[j].file);
+				numMissing++;
+			} else {
+				fprintf(stderr, "Warning: block %lu of \"%s\" (file %d) "
+				                "has checksum %04o, expected %04o\n",
+				        (unsigned long) bad[j].block, vol->path,
+				        bad[j].file, bad[j].actual, bad[j].expected);
+			}
+		}
+		free(bad);
+		if (numMissing) {
+			fprintf(stderr, "Error: \"%s\" is missing blocks; not "
+			                "converting it\n", vol->path);
+			tbm_close(archive);
+			free(outFileNameFormatStr);
+			return 1;
+		}
+		/* The checksum algorithm is unconfirmed (see verify.cpp), so
+		 * mismatches don't stop the volume being converted.
+		 */
+		if (numBad) {
+			fprintf(stderr, "Warning: %lu block%s of \"%s\" failed "
+			                "verification\n", (unsigned long) numBadBlocks,
+			        numBadBlocks > 1 ? "s" : "", vol->path);
+		} else {
+			printf("Info: All block checksums of \"%s\" verified\n",
+			       vol->path);
+		}
+	}
 
 	if (numFiles > 1) {
 		if (!strstr(outFileNameFormatStr, "%d")) {
@@ -155,84 +686,891 @@ int main(int argc, char **argv)
 			                "file name format string as there are multiple "
 			                "files in this TBM archive.\n", fileIndexFormatStr);
 			newLen = outFileNameFormatStrLen + strlen(fileIndexFormatStr);
-			if (!(outFileNameFormatStr = (char*) realloc(outFileNameFormatStr,
-			                                             sizeof(char)*(newLen+1)))) {
+			if (!(str = (char*) realloc(outFileNameFormatStr,
+			                            sizeof(char)*(newLen+1)))) {
 				goto mallocfail;
 			}
+			outFileNameFormatStr = str;
 			strcpy(outFileNameFormatStr+outFileNameFormatStrLen, "%d");
 		}
 	}
 
-	if (!(files = (TBMFile*) malloc(sizeof(TBMFile)*numFiles))) {
+	/* TODO: Sanity check that number of BK blocks adds up. */
+
+	ex.archive = archive;
+	ex.vol = vol;
+	ex.shard = shard;
+	ex.outFileNameFormatStr = outFileNameFormatStr;
+	ex.summary = summary;
+	ex.bytesWritten = bytesWritten;
+	ex.filesWritten = 0;
+	ex.isOpen = 0;
+	ex.convert = convert;
+	ex.arrayMode = -1;
+	convert_init(&ex.conv, convertOpts);
+	extractor.arg = &ex;
+	extractor.beginFile = begin_file;
+	extractor.segment = write_segment;
+	extractor.endFile = end_file;
+
+	/* Write out the files, decoding each data segment straight into its
+	 * place in the output file, or converting each record in turn.
+	 */
+	if (convert) {
+		for (i = 0, status = 0; i < numFiles && !status; i++) {
+			status = convert_file(archive, i, &ex);
+		}
+	} else {
+		status = tbm_walk(archive, &extractor);
+	}
+	if (status == TBM_ERR_NOMEM) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+	}
+	if (status && ex.isOpen) {
+		out_writer_free(&ex.writer);
+		out_close(&ex.out);
+	}
+	for (i = 0; i < CONVERT_NUM_MODES; i++) {
+		if (ex.conv.numRecords[i]) {
+			printf("Info: Converted %lu records of mode %d (%s)\n",
+			       (unsigned long) ex.conv.numRecords[i], i,
+			       convert_mode_name(i));
+		}
+	}
+	convert_free(&ex.conv);
+
+	printf("Info: Wrote %d files\n", ex.filesWritten);
+
+	tbm_close(archive);
+	free(outFileNameFormatStr);
+
+	return status ? 1 : 0;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
+	if (archive) {
+		tbm_close(archive);
+	}
+	free(outFileNameFormatStr);
+	return 1;
+}
+
+/**
+ * Writes one record of a file, as packed 60-bit words, to a file. If the
+ * archive has an up-to-date sidecar index, only its label buffer and the
+ * bytes holding the record are read; otherwise the index is built first.
+ *
+ * @param vol
+ * @param file Index of the file within the archive.
+ * @param record Index of the record within the file.
+ * @param wordCacheDir If not NULL, read the record from the shared word cache
+ *        in this directory (see tbm_use_word_cache()).
+ * @param outFileName
+ * @return 0 on success, or 1 on failure.
+ */
+static int dump_record(Volume const*const vol, const int file,
+                       const size_t record, const char wordCacheDir[],
+                       const char outFileName[])
+{
+	TBMArchive *archive;
+	uint64_t *words = NULL;
+	uint8_t *packed = NULL;
+	ssize_t numWords, n;
+	size_t len;
+	FILE *fp;
+	int ok;
+	int status;
+
+	if ((status = tbm_open_path(&archive, vol->path, TBM_OPEN_INDEX))) {
+		fprintf(stderr, "Error: Failed to open \"%s\": %s\n", vol->path,
+		        status == TBM_ERR_IO ? strerror(errno) : tbm_strerror(status));
+		return 1;
+	}
+	status = 1;
+
+	/* Without the cache the record is still read, only more slowly. */
+	if (wordCacheDir && (status = tbm_use_word_cache(archive, wordCacheDir))) {
+		fprintf(stderr, "Warning: Failed to use the word cache in \"%s\": "
+		        "%s\n", wordCacheDir, status == TBM_ERR_IO ? strerror(errno)
+		                                                  : tbm_strerror(status));
+	}
+	status = 1;
+
+	if ((numWords = tbm_record_length(archive, file, record)) < 0) {
+		fprintf(stderr, "Error: \"%s\" has no record %lu in file %d\n",
+		        vol->path, (unsigned long) record, file);
+		goto done;
+	}
+
+	words = (uint64_t*) malloc(sizeof(uint64_t)*(numWords+1));
+	packed = (uint8_t*) calloc(DIV_CEIL(numWords*60, 8)+8, sizeof(uint8_t));
+	if (!words || !packed) {
 		goto mallocfail;
 	}
+	if ((n = tbm_read_record(archive, file, record, words, numWords)) !=
+	    numWords)
+	{
+		fprintf(stderr, "Error: failed to read record %lu of file %d of "
+		        "\"%s\": %s\n", (unsigned long) record, file, vol->path,
+		        n < 0 ? tbm_strerror((int) n) : "the record is truncated");
+		goto done;
+	}
+	sbytes<uint8_t,uint64_t>(packed, words, 0, 60, 0, numWords);
 
-	/* TODO: Sanity check that number of BK blocks adds up. */
+	if (!(fp = fopen(outFileName, "w"))) {
+		fprintf(stderr, "Error: failed to open \"%s\" for writing: %s\n",
+		        outFileName, strerror(errno));
+		goto done;
+	}
+	len = DIV_CEIL(numWords*60, 8);
+	ok = fwrite(packed, sizeof(uint8_t), len, fp) == len;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok) {
+		fprintf(stderr, "Error: failed to write \"%s\": %s\n", outFileName,
+		        strerror(errno));
+		goto done;
+	}
+	printf("Info: wrote record %lu of file %d (%ld words) to \"%s\"\n",
+	       (unsigned long) record, file, (long) numWords, outFileName);
+	status = 0;
+	goto done;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
 
-	tbm_read(inBuf, syslbn_data.bk, files, numFiles);
+done:
+	tbm_close(archive);
+	free(words);
+	free(packed);
+	return status;
+}
+
+/**
+ * Surveys one TBM archive from a random sample of its blocks and prints the
+ * results.
+ *
+ * @param vol
+ * @param numSamples The number of blocks to sample.
+ * @param seed
+ * @return 0 on success, or 1 if the archive could not be surveyed.
+ */
+static int survey_volume(Volume const*const vol, const unsigned numSamples,
+                         const uint64_t seed)
+{
+	Survey survey;
+	int fd;
+	int status;
+
+	if ((fd = open(vol->path, O_RDONLY)) < 0) {
+		fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n",
+		        vol->path);
+		return 1;
+	}
+
+	if (!(status = tbm_survey(fd, vol->path, numSamples, seed, &survey))) {
+		print_survey(&survey, vol->path);
+	}
+	close(fd);
+
+	return status;
+}
+
+/**
+ * Opens the output file for the file being extracted.
+ *
+ * @param ex
+ * @return 0 on success, or 1 on failure.
+ */
+static int open_output(Extraction *const ex)
+{
+	if (out_open(&ex->out, ex->outFileName, ex->preallocSize)) {
+		fprintf(stderr, "failed to open \"%s\" for writing: %s\n",
+		        ex->outFileName, strerror(errno));
+		return 1;
+	}
+	printf("Info: writing to \"%s\"\n", ex->outFileName);
+
+	if (out_writer_init(&ex->writer, &ex->out)) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+		out_close(&ex->out);
+		return 1;
+	}
+	ex->isOpen = 1;
+
+	return 0;
+}
+
+/**
+ * tbm_walk() callback; decides whether file `i' is to be written.
+ */
+static int begin_file(void *arg, const int i, TBMFile const*const file)
+{
+	Extraction *const ex = (Extraction*) arg;
+	TBMFileInfo info;
 
-	for (i = 0; i < numFiles; i++) {
-		if (files[i].size == 0) {
-			fprintf(stderr, "Info: file %d has zero size, skipping\n", i);
+	ex->isOpen = 0;
+	ex->skip = ex->vol->fileShards && (i >= ex->vol->numFiles ||
+	           ex->vol->fileShards[i] != ex->shard->index);
+	if (ex->skip) {
+		fprintf(stderr, "Info: file %d belongs to another shard, "
+		                "skipping\n", i);
+		return 0;
+	}
+
+	snprintf(ex->outFileName, OUT_FILE_NAME_LEN, ex->outFileNameFormatStr,
+	         i);
+
+	/* The index gives the exact size of an extracted file, so its space can
+	 * be allocated before any segment is written. Converted sizes depend on
+	 * the records, so converted files grow as they are written instead.
+	 */
+	ex->preallocSize = 0;
+	if (!ex->convert && tbm_file_info(ex->archive, i, &info) == TBM_OK) {
+		ex->preallocSize = info.size;
+	}
+
+	return 0;
+}
+
+/**
+ * tbm_walk() callback; decodes one data segment straight into its place
+ * in the output file. The output file is only created once there is data to
+ * write, and is then allocated at its final size where that is known.
+ */
+static int write_segment(void *arg, const int i, uint8_t const*const inBuf,
+                         DataBufferFlags const*const dbf, const size_t offset,
+                         const size_t numWords, const size_t writeOffset)
+{
+	Extraction *const ex = (Extraction*) arg;
+	const size_t segmentLen = DIV_CEIL(numWords*60, 8);
+	uint8_t *segment;
+
+	/* An empty segment which starts a record has nothing to write. */
+	if (ex->skip || segmentLen == 0) {
+		return 0;
+	}
+
+	if (!ex->isOpen && open_output(ex)) {
+		return 1;
+	}
+
+	if (!(segment = out_reserve(&ex->writer, writeOffset/8, segmentLen))) {
+		fprintf(stderr, "Error: failed to write \"%s\": %s\n",
+		        ex->outFileName, strerror(errno));
+		return 1;
+	}
+	gbytes<uint8_t,uint8_t>(inBuf+(offset/8), segment, offset%8, 8, 0,
+	                        segmentLen);
+
+	return 0;
+}
+
+/**
+ * tbm_walk() callback; sets the final size of the output file, which for a
+ * converted file is only known once its last record has been written, and
+ * closes it.
+ */
+static int end_file(void *arg, const int i, TBMFile const*const file)
+{
+	Extraction *const ex = (Extraction*) arg;
+	const size_t size = ex->convert ? ex->convertedSize
+	                                : DIV_CEIL(file->size, 8);
+
+	if (ex->skip) {
+		return 0;
+	}
+
+	if (size == 0) {
+		fprintf(stderr, "Info: file %d has zero size, skipping\n", i);
+		if (ex->isOpen) {
+			ex->isOpen = 0;
+			out_writer_free(&ex->writer);
+			out_close(&ex->out);
+			unlink(ex->outFileName);
+		}
+		return 0;
+	}
+
+	if (!ex->isOpen && open_output(ex)) {
+		return 1;
+	}
+
+	ex->isOpen = 0;
+	if (out_flush(&ex->writer)) {
+		out_writer_free(&ex->writer);
+		out_close(&ex->out);
+		goto writefail;
+	}
+	out_writer_free(&ex->writer);
+	if (out_set_size(&ex->out, size)) {
+		out_close(&ex->out);
+		goto writefail;
+	}
+	if (out_close(&ex->out)) {
+		goto writefail;
+	}
+
+	if (ex->summary) {
+		fprintf(ex->summary, "%s\t%d\t%lu\t%s\n", ex->vol->name, i,
+		        (unsigned long) size, ex->outFileName);
+	}
+	*ex->bytesWritten += size;
+	ex->filesWritten++;
+
+	return 0;
+
+writefail:
+	fprintf(stderr, "Error: failed to write \"%s\": %s\n", ex->outFileName,
+	        strerror(errno));
+	return 1;
+}
+
+/**
+ * Writes one file of an archive with each of its records converted according
+ * to its data mode, one record after another.
+ *
+ * @param archive
+ * @param i Index of the file within the archive.
+ * @param ex
+ * @return 0 on success, a TBM_ERR_* value, or 1 on any other failure.
+ */
+static int convert_file(TBMArchive const*const archive, const int i,
+                        Extraction *const ex)
+{
+	TBMFileInfo info;
+	TBMRecordIter it;
+	TBMRecordView view, batch[CONVERT_BATCH_RECORDS];
+	uint8_t *out;
+	size_t len, numUnnormalized, numOverflowed, numMismatched;
+	size_t numBatched = 0, batchWords = 0, batchSize = 0;
+	int status;
+
+	if ((status = tbm_file_info(archive, i, &info)) ||
+	    (status = begin_file(ex, i, &info.file)) || ex->skip)
+	{
+		return status;
+	}
+
+	ex->convertedSize = 0;
+	if ((ex->conv.opts->flags & CONVERT_NPY) &&
+	    (status = begin_array(archive, i, ex)))
+	{
+		return status;
+	}
+	numUnnormalized = ex->conv.numUnnormalized;
+	numOverflowed = ex->conv.numOverflowed;
+	numMismatched = ex->conv.numMismatched;
+	tbm_records(archive, i, &it);
+	while (tbm_next_record(&it, &view)) {
+		if (!is_written(ex, &view) ||
+		    !(len = convert_size(&ex->conv, &view)))
+		{
 			continue;
 		}
+		/* Runs of records of the same mode are converted together. */
+		if (numBatched &&
+		    (numBatched == CONVERT_BATCH_RECORDS ||
+		     batchWords + view.numBits/60 > CONVERT_BATCH_WORDS ||
+		     !convert_can_batch(&ex->conv, &batch[0], &view)))
+		{
+			if ((status = convert_batch(ex, batch, numBatched, batchSize))) {
+				return status;
+			}
+			numBatched = batchWords = batchSize = 0;
+		}
+		batch[numBatched++] = view;
+		batchWords += view.numBits/60;
+		batchSize += len;
+	}
+	if (numBatched &&
+	    (status = convert_batch(ex, batch, numBatched, batchSize)))
+	{
+		return status;
+	}
 
-		snprintf(outFileName, OUT_FILE_NAME_LEN, outFileNameFormatStr, i);
-		if (!(fp = fopen(outFileName, "w"))) {
-			fprintf(stderr, "failed to open \"%s\" for writing\n",
-			        outFileName);
+	if ((len = convert_file_padding(&ex->conv, ex->convertedSize))) {
+		if (!(out = out_reserve(&ex->writer, ex->convertedSize, len))) {
+			fprintf(stderr, "Error: failed to write \"%s\": %s\n",
+			        ex->outFileName, strerror(errno));
 			return 1;
 		}
-		printf("Info: writing to \"%s\"\n", outFileName);
+		memset(out, 0, len);
+		ex->convertedSize += len;
+	}
+
+	if ((numUnnormalized = ex->conv.numUnnormalized - numUnnormalized)) {
+		fprintf(stderr, "Warning: file %d has %lu unnormalized reals\n", i,
+		        (unsigned long) numUnnormalized);
+	}
+	if ((numOverflowed = ex->conv.numOverflowed - numOverflowed)) {
+		fprintf(stderr, "Warning: file %d has %lu reals too large for a "
+		                "double, written as infinities\n", i,
+		        (unsigned long) numOverflowed);
+	}
+	if ((numMismatched = ex->conv.numMismatched - numMismatched)) {
+		fprintf(stderr, "Warning: file %d has %lu double-precision reals "
+		                "whose words differ in sign\n", i,
+		        (unsigned long) numMismatched);
+	}
+
+	return end_file(ex, i, &info.file);
+}
 
-		if (!(decodeBuf = (uint8_t*) realloc(decodeBuf,
-		                                     DIV_CEIL(files[i].size,8))))
+/**
+ * Begins writing a file as a NumPy array (CONVERT_NPY). Its records are
+ * first looked over, without being decoded, to learn the array's type and
+ * shape: the mode of the first record of integers, reals or words decides
+ * which records make up the array, and these become its rows if they are
+ * all of the same length. The header is then written, and the records are
+ * converted after it as usual.
+ *
+ * @param archive
+ * @param i Index of the file within the archive.
+ * @param ex
+ * @return 0 on success, or 1 on failure.
+ */
+static int begin_array(TBMArchive const*const archive, const int i,
+                       Extraction *const ex)
+{
+	TBMRecordIter it;
+	TBMRecordView view;
+	uint8_t header[4*NPY_ALIGNMENT], *out;
+	size_t shape[NPY_MAX_DIMS];
+	size_t numRows = 0, rowSize = 0, total = 0, numLeftOut = 0, len;
+	int ragged = 0, ndim, mode;
+
+	ex->arrayMode = -1;
+	tbm_records(archive, i, &it);
+	while (tbm_next_record(&it, &view)) {
+		if (!convert_selected(&ex->conv, &view) ||
+		    !(len = convert_size(&ex->conv, &view)))
 		{
-			goto mallocfail;
+			continue;
 		}
-		memset(decodeBuf, 0, sizeof(uint8_t)*DIV_CEIL(files[i].size,8));
-
-		first = 1;
-		offset = files[i].offsetToDataStart;
-		writeOffset = 0;
-		do {
-			read_dataBufferFlags(inBuf, &dbf, offset);
-			offset += 60;
-			gbytes<uint8_t,uint8_t>(inBuf+(offset/8),
-			                        decodeBuf+(writeOffset/8),
-			                        offset%8, 8, 0,
-			                        DIV_CEIL((dbf.nextPtrOffset-1)*60,8));
-
-			writeOffset += 60*(dbf.nextPtrOffset-1);
-			/* Align writeOffset to 64-bit boundaries, but not immediately after
-			 * the GENPRO-I header.
-			 */
-			if (!first && !dbf.isEOF && (writeOffset % 64) == 0) {
-				writeOffset += 64;
-			} else {
-				writeOffset = 64*DIV_CEIL(writeOffset,64);
+		mode = convert_mode(&ex->conv, &view);
+		if (ex->arrayMode < 0 && convert_npy_descr(&ex->conv, mode)) {
+			ex->arrayMode = mode;
+			rowSize = len;
+		}
+		if (mode != ex->arrayMode) {
+			numLeftOut++;
+			continue;
+		}
+		ragged |= len != rowSize;
+		numRows++;
+		total += len;
+	}
+
+	if (ex->arrayMode < 0) {
+		fprintf(stderr, "Info: file %d has no records of integers, reals "
+		                "or words to write\n", i);
+		return 0;
+	}
+	if (numLeftOut) {
+		fprintf(stderr, "Warning: file %d has %lu records not of mode %d, "
+		                "which are left out of its array\n", i,
+		        (unsigned long) numLeftOut, ex->arrayMode);
+	}
+
+	/* Records of different lengths can't be the rows of one array, so
+	 * their values are written one after another.
+	 */
+	if (ragged) {
+		fprintf(stderr, "Info: records of file %d differ in length; "
+		                "writing a one-dimensional array\n", i);
+		shape[0] = total/sizeof(uint64_t);
+		ndim = 1;
+	} else {
+		shape[0] = numRows;
+		shape[1] = rowSize/sizeof(uint64_t);
+		ndim = 2;
+	}
+	len = npy_header(header, sizeof(header),
+	                 convert_npy_descr(&ex->conv, ex->arrayMode), shape,
+	                 ndim);
+	assert(len);
+
+	if (!ex->isOpen && open_output(ex)) {
+		return 1;
+	}
+	if (!(out = out_reserve(&ex->writer, 0, len))) {
+		fprintf(stderr, "Error: failed to write \"%s\": %s\n",
+		        ex->outFileName, strerror(errno));
+		return 1;
+	}
+	memcpy(out, header, len);
+	ex->convertedSize = len;
+
+	return 0;
+}
+
+/**
+ * @param ex
+ * @param view
+ * @return Whether a record of the current file is written: whether it is
+ *         selected (see convert_selected()), and, when writing NumPy
+ *         arrays, of the mode of the file's array.
+ */
+static int is_written(Extraction const*const ex,
+                      TBMRecordView const*const view)
+{
+	return convert_selected(&ex->conv, view) &&
+	       (!(ex->conv.opts->flags & CONVERT_NPY) ||
+	        convert_mode(&ex->conv, view) == ex->arrayMode);
+}
+
+/**
+ * Converts a batch of records of a file (see convert_records()) and writes
+ * them after those already written.
+ *
+ * @param ex
+ * @param views The records.
+ * @param n Number of records.
+ * @param size Number of bytes they are converted to.
+ * @return 0 on success, a TBM_ERR_* value, or 1 on any other failure.
+ */
+static int convert_batch(Extraction *const ex,
+                         TBMRecordView const*const views, const size_t n,
+                         const size_t size)
+{
+	uint8_t *out;
+	int status;
+
+	if (!ex->isOpen && open_output(ex)) {
+		return 1;
+	}
+	if (!(out = out_reserve(&ex->writer, ex->convertedSize, size))) {
+		fprintf(stderr, "Error: failed to write \"%s\": %s\n",
+		        ex->outFileName, strerror(errno));
+		return 1;
+	}
+	if ((status = convert_records(&ex->conv, views, n, out))) {
+		return status;
+	}
+	ex->convertedSize += size;
+
+	return 0;
+}
+
+/**
+ * Reads a list of TBM archive paths, one per line. Blank lines and lines
+ * beginning with '#' are ignored.
+ *
+ * @param listFileName
+ * @param volumes Receives a newly allocated array of volumes.
+ * @param numVolumes Receives the number of volumes in the list.
+ * @return 0 on success, 1 on failure.
+ */
+static int read_volume_list(const char listFileName[], Volume **volumes,
+                            size_t *numVolumes)
+{
+	FILE *fp;
+	char *line = NULL;
+	size_t lineLen = 0;
+	size_t capacity = 0;
+	Volume *v;
+	char *s;
+
+	if (!(fp = fopen(listFileName, "r"))) {
+		fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n",
+		        listFileName);
+		return 1;
+	}
+
+	*volumes = NULL;
+	*numVolumes = 0;
+	while (getline(&line, &lineLen, fp) != -1) {
+		if ((s = strchr(line, '\n'))) {
+			*s = '\0';
+		}
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
+		}
+		if (*numVolumes == capacity) {
+			capacity = capacity ? 2*capacity : 64;
+			if (!(v = (Volume*) realloc(*volumes, sizeof(Volume)*capacity))) {
+				goto mallocfail;
 			}
-			first = 0;
+			*volumes = v;
+		}
+		memset(&(*volumes)[*numVolumes], 0, sizeof(Volume));
+		if (!((*volumes)[*numVolumes].path = strdup(line))) {
+			goto mallocfail;
+		}
+		(*numVolumes)++;
+	}
 
-			offset += 60*(dbf.nextPtrOffset-1);
-		} while (!dbf.isEOF);
+	free(line);
+	fclose(fp);
 
-		fwrite(decodeBuf, sizeof(uint8_t), DIV_CEIL(files[i].size, 8), fp);
-		fclose(fp);
+	if (*numVolumes == 0) {
+		fprintf(stderr, "Error: \"%s\" lists no volumes.\n", listFileName);
+		return 1;
+	}
+
+	return 0;
+
+mallocfail:
+	fprintf(stderr, "Error: memory allocation failed\n");
+	free(line);
+	fclose(fp);
+	free_volumes(*volumes, *numVolumes, 1);
+	*volumes = NULL;
+	*numVolumes = 0;
+	return 1;
+}
+
+/**
+ * Reads only the label buffer (the first BK block) of a TBM archive to learn
+ * how many files it contains and how many BK blocks each of them spans. This
+ * is much cheaper than reading the entire archive, which matters when every
+ * shard must plan the work for every volume.
+ *
+ * @param vol
+ * @return 0 on success, 1 on failure.
+ */
+static int read_label_block(Volume *const vol)
+{
+	SYSLBN_Data syslbn_data;
+	SYSLBN_Text syslbn_text;
+	FILE *fp;
+	uint8_t *labelBuf, *buf;
+	size_t labelSize;
+
+	if (!(fp = fopen(vol->path, "r"))) {
+		fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n",
+		        vol->path);
+		return 1;
+	}
 
-		filesWritten++;
+	labelSize = sizeof(SYSLBN_Data)*60/64;
+	if (!(labelBuf = (uint8_t*) malloc(labelSize))) {
+		goto mallocfail;
 	}
+	if (fread(labelBuf, sizeof(uint8_t), labelSize, fp) != labelSize) {
+		goto readfail;
+	}
+	read_syslbn(labelBuf, &syslbn_text, &syslbn_data, 0);
 
-	printf("Info: Wrote %d files\n", filesWritten);
+	labelSize = syslbn_data.bk*BK_BLOCK_SIZE_BYTES;
+	if (labelSize > vol->size || syslbn_data.vol1.vol1 != MAGIC_VOL1) {
+		fprintf(stderr, "Error: \"%s\" does not look like a TBM archive.\n",
+		        vol->path);
+		free(labelBuf);
+		fclose(fp);
+		return 1;
+	}
+	if (!(buf = (uint8_t*) realloc(labelBuf, labelSize))) {
+		goto mallocfail;
+	}
+	labelBuf = buf;
+	fseek(fp, 0L, SEEK_SET);
+	if (fread(labelBuf, sizeof(uint8_t), labelSize, fp) != labelSize) {
+		goto readfail;
+	}
+	fclose(fp);
+	fp = NULL;
 
-	free(inBuf);
-	free(decodeBuf);
-	free(outFileNameFormatStr);
+	vol->numFiles = tbm_count_files(labelBuf, &syslbn_data, NULL, 0);
+	if (!(vol->fileBlocks = (size_t*) malloc(sizeof(size_t)*
+	                                         (vol->numFiles+1)))) {
+		goto mallocfail;
+	}
+	tbm_count_files(labelBuf, &syslbn_data, vol->fileBlocks, 0);
+
+	free(labelBuf);
 
 	return 0;
 
 mallocfail:
 	fprintf(stderr, "Error: memory allocation failed\n");
+	goto fail;
+
+readfail:
+	fprintf(stderr, "Error: failed to read contents of \"%s\".\n", vol->path);
+
+fail:
+	free(labelBuf);
+	if (fp) {
+		fclose(fp);
+	}
 	return 1;
 }
 
+/**
+ * Checks that no two volumes have the same base name. Volumes are told apart
+ * by name when they are assigned to shards and when their output is named in
+ * OUTDIR, so two volumes of the same name in different directories would
+ * share a shard key and overwrite each other's output.
+ *
+ * @param volumes
+ * @param numVolumes
+ * @return 0 if the names are distinct, or 1 after reporting a duplicate.
+ */
+static int check_names(Volume const*const volumes, const size_t numVolumes)
+{
+	Volume const **sorted;
+	size_t i;
+	int status = 0;
+
+	if (numVolumes < 2) {
+		return 0;
+	}
+	if (!(sorted = (Volume const**) malloc(sizeof(Volume*)*numVolumes))) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+		return 1;
+	}
+	for (i = 0; i < numVolumes; i++) {
+		sorted[i] = &volumes[i];
+	}
+	qsort(sorted, numVolumes, sizeof(Volume*), compare_names);
+
+	for (i = 1; i < numVolumes; i++) {
+		if (!strcmp(sorted[i-1]->name, sorted[i]->name)) {
+			fprintf(stderr, "Error: \"%s\" and \"%s\" have the same name; "
+			                "volumes must have distinct names.\n",
+			        sorted[i-1]->path, sorted[i]->path);
+			status = 1;
+		}
+	}
+	free(sorted);
+
+	return status;
+}
+
+/**
+ * qsort() comparison function ordering pointers to volumes by name.
+ */
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp((*(Volume const*const*) a)->name,
+	              (*(Volume const*const*) b)->name);
+}
+
+/**
+ * Releases a list of volumes and what each of them holds.
+ *
+ * @param volumes
+ * @param numVolumes
+ * @param ownPaths If set to true, the paths were allocated (as by
+ *        read_volume_list()) and are freed too.
+ */
+static void free_volumes(Volume *const volumes, const size_t numVolumes,
+                         const int ownPaths)
+{
+	size_t i;
+
+	for (i = 0; volumes && i < numVolumes; i++) {
+		if (ownPaths) {
+			free((char*) volumes[i].path);
+		}
+		free(volumes[i].fileBlocks);
+	}
+	free(volumes);
+}
+
+static void usage(void)
+{
+	printf("Usage:\n"
+	       "\n"
+	       "    tbmconv [OPTIONS] INFILE OUTFILE\n"
+	       "    tbmconv [OPTIONS] --list LISTFILE OUTDIR\n"
+	       "    tbmconv --survey [OPTIONS] INFILE...\n"
+	       "    tbmconv --survey [OPTIONS] --list LISTFILE\n"
+	       "\n"
+	       "Options:\n"
+	       "\n"
+	       "    -l, --list LISTFILE  Convert every volume named in LISTFILE\n"
+	       "                         (one path per line); the files of each\n"
+	       "                         volume are written to OUTDIR/NAME.\n"
+	       "    -s, --shard I/N      Only do the work assigned to shard I of\n"
+	       "                         N (0 <= I < N), e.g. one task of a job\n"
+	       "                         array. Volumes are assigned by a stable\n"
+	       "                         hash of their base names.\n"
+	       "    -b, --balance        With --shard, assign work by size so\n"
+	       "                         that shards receive equal amounts of data.\n"
+	       "    -f, --shard-files    With --shard, assign individual files\n"
+	       "                         within volumes rather than whole volumes.\n"
+	       "    -S, --summary FILE   Write a tab-separated summary of the files\n"
+	       "                         written. Summaries from all shards can be\n"
+	       "                         concatenated; lines beginning with '#' are\n"
+	       "                         comments.\n"
+	       "    -V, --verify         Verify the block checksums of each volume\n"
+	       "                         first. Blocks whose checksums differ\n"
+	       "                         are reported; volumes missing blocks\n"
+	       "                         are not converted.\n"
+	       "    -j, --jobs N         Number of threads used by --verify\n"
+	       "                         (default: one per processor).\n"
+	       "    -y, --survey         Instead of converting, estimate the\n"
+	       "                         contents of each volume from a random\n"
+	       "                         sample of its blocks.\n"
+	       "    -n, --samples N      Number of blocks sampled by --survey\n"
+	       "                         (default: %d).\n"
+	       "    -r, --seed N         Seed for choosing the blocks sampled.\n"
+	       "    -i, --index          Use the sidecar index INFILE.tbmidx of\n"
+	       "                         each volume instead of walking the\n"
+	       "                         volume, creating it if it is missing or\n"
+	       "                         out of date.\n"
+	       "    -R, --record F:R     Write only record R of file F (both\n"
+	       "                         counted from 0) to OUTFILE, as packed\n"
+	       "                         60-bit words, using the sidecar index.\n"
+	       "    -w, --word-cache DIR With --record, read the record from a\n"
+	       "                         cache of decoded words in DIR which is\n"
+	       "                         shared by every process using DIR,\n"
+	       "                         filling it if this volume is not yet\n"
+	       "                         cached.\n"
+	       "    -c, --convert        Convert each record according to its\n"
+	       "                         data mode, as tbm2cos did: display code\n"
+	       "                         (mode 0) records become lines of ASCII\n"
+	       "                         text, one's-complement integer (mode 5)\n"
+	       "                         records 64-bit integers, real (mode 6)\n"
+	       "                         records IEEE doubles, and COSY card\n"
+	       "                         image (mode 7) records 80-column lines.\n"
+	       "                         BCD (mode 2) records become lines of\n"
+	       "                         ASCII text as display code does, and\n"
+	       "                         EBCDIC (mode 4) bytes are translated to\n"
+	       "                         ASCII. Records of other modes are\n"
+	       "                         written as packed bits zero-filled to\n"
+	       "                         64-bit words.\n"
+	       "    -m, --mode N         With --convert, convert every record with\n"
+	       "                         mode N rather than its own, as tbm2cos's\n"
+	       "                         MODE=N did. Records of mode 8\n"
+	       "                         (transparent) are written as packed\n"
+	       "                         bits and the file filled out with zeros\n"
+	       "                         to a 4096-byte Cray block; mode 9 writes\n"
+	       "                         each 60-bit word right-justified in a\n"
+	       "                         64-bit word.\n"
+	       "    -B, --big-endian     With --convert, write integers, reals\n"
+	       "                         and mode 9 words big-endian rather than\n"
+	       "                         in this machine's byte order.\n"
+	       "    -N, --nan-payload N  With --convert, give the NaNs made from\n"
+	       "                         indefinite reals the payload N (the low\n"
+	       "                         51 bits of the NaN; default 0).\n"
+	       "    -D, --double FILE[:FIRST[-LAST]]\n"
+	       "                         With --convert, take the real records\n"
+	       "                         of file FILE (or only records FIRST to\n"
+	       "                         LAST of it) to hold double-precision\n"
+	       "                         reals, in pairs of words. May be given\n"
+	       "                         more than once.\n"
+	       "    -Q, --quad           With --double, write double-precision\n"
+	       "                         reals as IEEE binary128 values, which\n"
+	       "                         keep all 96 bits of the coefficient,\n"
+	       "                         rather than as doubles.\n"
+	       "    -F, --framed         Write each record unconverted, after an\n"
+	       "                         8-byte big-endian header holding its\n"
+	       "                         mode in the high 8 bits and its exact\n"
+	       "                         length in bits in the rest, its bits\n"
+	       "                         zero-filled to 64-bit words.\n"
+	       "    -P, --npy            Write the integer, real or mode 9\n"
+	       "                         records of each file, converted as by\n"
+	       "                         --convert, as a NumPy .npy array of one\n"
+	       "                         row per record. The first such record\n"
+	       "                         decides the array's mode; records of\n"
+	       "                         other modes are left out.\n"
+	       "    -e, --select FILE[:FIRST[-LAST]]\n"
+	       "                         With --convert, --framed or --npy, only\n"
+	       "                         write file FILE (or only records FIRST\n"
+	       "                         to LAST of it). May be given more than\n"
+	       "                         once.\n",
+	       SURVEY_DEFAULT_SAMPLES);
+}
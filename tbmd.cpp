@@ -0,0 +1,756 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * A daemon which keeps TBM archives open and answers requests for their
+ * files, records and labels over a Unix-domain socket.
+ *
+ * Each connection sends requests, one per line, and reads each response
+ * before sending the next. Volumes are named by path, last so that a path may
+ * hold spaces:
+ *
+ *     LIST PATH                  List the files of a volume.
+ *     LABEL PATH                 Describe the labels of a volume.
+ *     FILE F PATH                Fetch file F of a volume.
+ *     RECORD F R PATH            Fetch record R of file F of a volume.
+ *
+ * A response begins with a line "OK N" or "ERR MESSAGE". For LIST and LABEL,
+ * N lines of tab-separated text follow; for FILE, the N bytes of the file;
+ * for RECORD, the N 60-bit words of the record, packed as by
+ * `tbmconv --record'.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "gbytes.cpp"
+#include "tbm.hpp"
+#include "libtbm.hpp"
+
+/* Number of volumes kept open by default. */
+#define TBMD_DEFAULT_MAX_VOLUMES 64
+
+/* Number of accepted connections which may wait for a worker, per worker. */
+#define TBMD_QUEUE_PER_WORKER 4
+
+/* Seconds a connection may sit idle before it is closed by default. */
+#define TBMD_DEFAULT_TIMEOUT 60
+
+/**
+ * An open volume. A volume in use by a request is never closed.
+ */
+typedef struct {
+	char *path;
+	TBMArchive *archive;
+	unsigned users;    /* Requests using the volume now. */
+	uint64_t lastUse;  /* Value of VolumeCache.clock when last used. */
+} OpenVolume;
+
+/**
+ * The open volumes, of which the least recently used is closed to make room
+ * for another.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	OpenVolume *volumes;
+	size_t numVolumes;
+	size_t maxVolumes;
+	uint64_t clock;
+	char *root;                /* If not NULL, paths are relative to it; it
+	                              is resolved by realpath(). */
+	size_t rootLen;
+	const char *wordCacheDir;  /* If not NULL, see tbm_use_word_cache(). */
+} VolumeCache;
+
+/**
+ * Accepted connections waiting for a worker.
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t notEmpty;
+	pthread_cond_t notFull;
+	int *fds;
+	size_t capacity;
+	size_t first;
+	size_t len;
+} ConnQueue;
+
+typedef struct {
+	VolumeCache *cache;
+	ConnQueue *queue;
+} Worker;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void *serve_worker(void *arg);
+static void serve_connection(VolumeCache *const cache, const int fd);
+static int serve_request(VolumeCache *const cache, char *const line,
+                         FILE *const out);
+static int serve_list(TBMArchive const*const archive, FILE *const out);
+static int serve_label(TBMArchive const*const archive, FILE *const out);
+static int serve_file(TBMArchive const*const archive, const int file,
+                      FILE *const out);
+static int serve_record(TBMArchive const*const archive, const int file,
+                        const size_t record, FILE *const out);
+static int write_chunk(void *arg, uint8_t const*const data, const size_t len);
+static int acquire_volume(VolumeCache *const cache, const char path[],
+                          OpenVolume **const vol, TBMArchive **const archive);
+static void release_volume(VolumeCache *const cache, OpenVolume *const vol,
+                           TBMArchive *const archive);
+static void put_text(FILE *const out, const char name[], const char text[],
+                     const size_t len);
+static void on_signal(int sig);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+	static const struct option longOptions[] = {
+		{ "jobs",        required_argument, NULL, 'j' },
+		{ "max-volumes", required_argument, NULL, 'm' },
+		{ "root",        required_argument, NULL, 'r' },
+		{ "timeout",     required_argument, NULL, 't' },
+		{ "word-cache",  required_argument, NULL, 'w' },
+		{ NULL,          0,                 NULL,  0  }
+	};
+	VolumeCache cache;
+	ConnQueue queue;
+	Worker worker;
+	struct sockaddr_un addr;
+	struct sigaction sa;
+	struct stat st;
+	struct timeval timeout;
+	pthread_t thread;
+	const char *socketPath;
+	const char *root = NULL;
+	unsigned numWorkers = 0;
+	unsigned t, started = 0;
+	int listenFd, fd;
+	long n;
+	int opt;
+
+	memset(&cache, 0, sizeof(cache));
+	cache.maxVolumes = TBMD_DEFAULT_MAX_VOLUMES;
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.tv_sec = TBMD_DEFAULT_TIMEOUT;
+
+	while ((opt = getopt_long(argc, argv, "j:m:r:t:w:", longOptions,
+	                          NULL)) != -1)
+	{
+		switch (opt) {
+			case 'j':
+				if ((n = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid number of jobs \"%s\".\n",
+					        optarg);
+					return 1;
+				}
+				numWorkers = (unsigned) n;
+				break;
+			case 'm':
+				if ((n = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid number of volumes "
+					                "\"%s\".\n", optarg);
+					return 1;
+				}
+				cache.maxVolumes = (size_t) n;
+				break;
+			case 'r': root = optarg;               break;
+			case 't':
+				if ((n = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid timeout \"%s\".\n",
+					        optarg);
+					return 1;
+				}
+				timeout.tv_sec = n;
+				break;
+			case 'w': cache.wordCacheDir = optarg; break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		fprintf(stderr, "Error: Require exactly one argument.\n");
+		usage();
+		return 1;
+	}
+	socketPath = argv[optind];
+
+	/* Requests are confined to the root by comparing resolved paths, so the
+	 * root itself must be resolved too.
+	 */
+	if (root) {
+		if (!(cache.root = realpath(root, NULL))) {
+			fprintf(stderr, "Error: invalid root \"%s\": %s\n", root,
+			        strerror(errno));
+			return 1;
+		}
+		cache.rootLen = strlen(cache.root);
+		if (cache.root[cache.rootLen-1] == '/') {
+			cache.rootLen--;
+		}
+	}
+
+	if (!numWorkers) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		numWorkers = n > 0 ? (unsigned) n : 1;
+	}
+
+	pthread_mutex_init(&cache.lock, NULL);
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.notEmpty, NULL);
+	pthread_cond_init(&queue.notFull, NULL);
+	queue.capacity = numWorkers*TBMD_QUEUE_PER_WORKER;
+	queue.first = queue.len = 0;
+	cache.volumes = (OpenVolume*) calloc(cache.maxVolumes, sizeof(OpenVolume));
+	queue.fds = (int*) malloc(sizeof(int)*queue.capacity);
+	if (!cache.volumes || !queue.fds) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+		return 1;
+	}
+
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: socket path \"%s\" is too long.\n",
+		        socketPath);
+		return 1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socketPath);
+
+	/* Replace the socket of a daemon which did not exit cleanly. */
+	if (!stat(socketPath, &st) && S_ISSOCK(st.st_mode)) {
+		unlink(socketPath);
+	}
+	if ((listenFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) ||
+	    listen(listenFd, SOMAXCONN))
+	{
+		fprintf(stderr, "Error: failed to listen on \"%s\": %s\n", socketPath,
+		        strerror(errno));
+		return 1;
+	}
+
+	/* A client which goes away mid-response must not kill the daemon. Signals
+	 * which stop the daemon interrupt accept() so that the socket is removed.
+	 */
+	signal(SIGPIPE, SIG_IGN);
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	worker.cache = &cache;
+	worker.queue = &queue;
+	for (t = 0; t < numWorkers; t++) {
+		if (pthread_create(&thread, NULL, serve_worker, &worker) ||
+		    pthread_detach(thread))
+		{
+			break;
+		}
+		started++;
+	}
+	if (!started) {
+		fprintf(stderr, "Error: failed to start any workers\n");
+		unlink(socketPath);
+		return 1;
+	}
+
+	printf("Info: listening on \"%s\" with %u workers\n", socketPath,
+	       started);
+	fflush(stdout);
+
+	while (!stopping) {
+		if ((fd = accept(listenFd, NULL, NULL)) < 0) {
+			if (errno != EINTR && errno != ECONNABORTED) {
+				fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+				break;
+			}
+			continue;
+		}
+		/* A client which stops sending or reading must not hold a worker
+		 * forever.
+		 */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		pthread_mutex_lock(&queue.lock);
+		while (queue.len == queue.capacity) {
+			pthread_cond_wait(&queue.notFull, &queue.lock);
+		}
+		queue.fds[(queue.first + queue.len++) % queue.capacity] = fd;
+		pthread_cond_signal(&queue.notEmpty);
+		pthread_mutex_unlock(&queue.lock);
+	}
+
+	close(listenFd);
+	unlink(socketPath);
+	printf("Info: stopped\n");
+
+	return stopping ? 0 : 1;
+}
+
+/**
+ * Serves connections from the queue, one at a time, forever.
+ */
+static void *serve_worker(void *arg)
+{
+	Worker const*const w = (Worker const*) arg;
+	ConnQueue *const queue = w->queue;
+	sigset_t set;
+	int fd;
+
+	/* Leave the signals which stop the daemon to the main thread. */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	while (1) {
+		pthread_mutex_lock(&queue->lock);
+		while (queue->len == 0) {
+			pthread_cond_wait(&queue->notEmpty, &queue->lock);
+		}
+		fd = queue->fds[queue->first];
+		queue->first = (queue->first+1) % queue->capacity;
+		queue->len--;
+		pthread_cond_signal(&queue->notFull);
+		pthread_mutex_unlock(&queue->lock);
+
+		serve_connection(w->cache, fd);
+	}
+
+	return NULL;
+}
+
+/**
+ * Answers the requests of one connection until the client closes it, then
+ * closes it.
+ */
+static void serve_connection(VolumeCache *const cache, const int fd)
+{
+	FILE *in, *out;
+	char *line = NULL;
+	size_t lineLen = 0;
+	ssize_t n;
+	int outFd;
+
+	if ((outFd = dup(fd)) < 0 || !(in = fdopen(fd, "r"))) {
+		close(fd);
+		if (outFd >= 0) {
+			close(outFd);
+		}
+		return;
+	}
+	if (!(out = fdopen(outFd, "w"))) {
+		close(outFd);
+		fclose(in);
+		return;
+	}
+
+	while ((n = getline(&line, &lineLen, in)) > 0) {
+		if (line[n-1] == '\n') {
+			line[--n] = '\0';
+		}
+		if (n > 0 && line[n-1] == '\r') {
+			line[--n] = '\0';
+		}
+		if (serve_request(cache, line, out) || fflush(out)) {
+			break;
+		}
+	}
+
+	free(line);
+	fclose(in);
+	fclose(out);
+}
+
+/**
+ * Answers one request.
+ *
+ * @return 0 if the connection may be used for another request, or 1 if it
+ *         can't (the client has gone, or a response was cut short).
+ */
+static int serve_request(VolumeCache *const cache, char *const line,
+                         FILE *const out)
+{
+	OpenVolume *vol;
+	TBMArchive *archive;
+	char command[16];
+	char kind;
+	int file = 0;
+	unsigned long record = 0;
+	int pathStart = -1;
+	int status;
+
+	if (sscanf(line, "%15s", command) != 1) {
+		fprintf(out, "ERR empty request\n");
+		return 0;
+	}
+	if (!strcmp(command, "LIST")) {
+		kind = 'I';
+		sscanf(line, "%*s %n", &pathStart);
+	} else if (!strcmp(command, "LABEL")) {
+		kind = 'A';
+		sscanf(line, "%*s %n", &pathStart);
+	} else if (!strcmp(command, "FILE")) {
+		kind = 'F';
+		sscanf(line, "%*s %d %n", &file, &pathStart);
+	} else if (!strcmp(command, "RECORD")) {
+		kind = 'R';
+		sscanf(line, "%*s %d %lu %n", &file, &record, &pathStart);
+	} else {
+		fprintf(out, "ERR unknown request \"%s\"\n", command);
+		return 0;
+	}
+	if (pathStart < 0 || !line[pathStart]) {
+		fprintf(out, "ERR malformed %s request\n", command);
+		return 0;
+	}
+
+	if ((status = acquire_volume(cache, line+pathStart, &vol, &archive))) {
+		fprintf(out, "ERR %s\n", status == TBM_ERR_IO ? strerror(errno)
+		                                              : tbm_strerror(status));
+		return 0;
+	}
+
+	switch (kind) {
+		case 'I': status = serve_list(archive, out);                 break;
+		case 'A': status = serve_label(archive, out);                break;
+		case 'F': status = serve_file(archive, file, out);           break;
+		default:  status = serve_record(archive, file, record, out); break;
+	}
+
+	release_volume(cache, vol, archive);
+
+	return status;
+}
+
+static int serve_list(TBMArchive const*const archive, FILE *const out)
+{
+	TBMFileInfo info;
+	const int numFiles = tbm_num_files(archive);
+	int i;
+
+	fprintf(out, "OK %d\n", numFiles);
+	for (i = 0; i < numFiles; i++) {
+		tbm_file_info(archive, i, &info);
+		fprintf(out, "%d\t%.17s\t%lu\t%lu\n", i, info.file.hdr1_text.dataSetID,
+		        (unsigned long) info.size, (unsigned long) info.numRecords);
+	}
+
+	return 0;
+}
+
+static int serve_label(TBMArchive const*const archive, FILE *const out)
+{
+	SYSLBN_Text text;
+	SYSLBN_Data data;
+	size_t len;
+
+	tbm_archive_syslbn(archive, &text, &data);
+	tbm_archive_data(archive, &len);
+
+	fprintf(out, "OK 12\n");
+	put_text(out, "volSerialName", text.vol1.volSerialName1,
+	         sizeof(text.vol1.volSerialName1));
+	put_text(out, "tbmVolSerial", text.vol1.tbmVolSerial,
+	         sizeof(text.vol1.tbmVolSerial));
+	put_text(out, "dataSetID", text.hdr1.dataSetID,
+	         sizeof(text.hdr1.dataSetID));
+	put_text(out, "creationDate", text.hdr1.creationDate,
+	         sizeof(text.hdr1.creationDate));
+	put_text(out, "expirationDate", text.hdr1.expirationDate,
+	         sizeof(text.hdr1.expirationDate));
+	fprintf(out, "machineType\t%s\n",
+	        data.machineType <= MACHINE_TYPE_MAX
+	            ? machineTypes[data.machineType].str : "unknown");
+	fprintf(out, "dataType\t%s\n", data.dataType <= DATA_TYPE_MAX
+	                                   ? dataTypes[data.dataType].str
+	                                   : "unknown");
+	fprintf(out, "density\t%s\n", data.density <= DENSITY_MAX
+	                                  ? densities[data.density].str
+	                                  : "unknown");
+	fprintf(out, "bk\t%u\n", (unsigned) data.bk);
+	fprintf(out, "numBKBlocks\t%u\n", (unsigned) data.numBKBlocks);
+	fprintf(out, "numFiles\t%d\n", tbm_num_files(archive));
+	fprintf(out, "size\t%lu\n", (unsigned long) len);
+
+	return 0;
+}
+
+static int serve_file(TBMArchive const*const archive, const int file,
+                      FILE *const out)
+{
+	TBMFileInfo info;
+
+	if (tbm_file_info(archive, file, &info)) {
+		fprintf(out, "ERR %s\n", tbm_strerror(TBM_ERR_RANGE));
+		return 0;
+	}
+
+	fprintf(out, "OK %lu\n", (unsigned long) info.size);
+
+	/* The length has been promised, so a failure here ends the connection. */
+	return tbm_stream_file(archive, file, write_chunk, out) != TBM_OK;
+}
+
+static int serve_record(TBMArchive const*const archive, const int file,
+                        const size_t record, FILE *const out)
+{
+	uint64_t *words;
+	uint8_t *packed;
+	ssize_t numWords, n;
+	size_t numBytes;
+	int status;
+
+	if ((numWords = tbm_record_length(archive, file, record)) < 0) {
+		fprintf(out, "ERR %s\n", tbm_strerror(TBM_ERR_RANGE));
+		return 0;
+	}
+	numBytes = numWords ? DIV_CEIL(numWords*60, 8) : 0;
+
+	words = (uint64_t*) malloc(sizeof(uint64_t)*(numWords+1));
+	packed = (uint8_t*) calloc(numBytes+8, sizeof(uint8_t));
+	if (!words || !packed) {
+		free(words);
+		free(packed);
+		fprintf(out, "ERR %s\n", tbm_strerror(TBM_ERR_NOMEM));
+		return 0;
+	}
+
+	/* A record that can't be read whole is refused before "OK" is sent. */
+	if ((n = tbm_read_record(archive, file, record, words, numWords)) !=
+	    numWords)
+	{
+		free(words);
+		free(packed);
+		fprintf(out, "ERR %s\n", tbm_strerror(n < 0 ? (int) n
+		                                             : TBM_ERR_FORMAT));
+		return 0;
+	}
+	sbytes<uint8_t,uint64_t>(packed, words, 0, 60, 0, numWords);
+
+	fprintf(out, "OK %ld\n", (long) numWords);
+	status = fwrite(packed, sizeof(uint8_t), numBytes, out) != numBytes;
+
+	free(words);
+	free(packed);
+
+	return status;
+}
+
+static int write_chunk(void *arg, uint8_t const*const data, const size_t len)
+{
+	return fwrite(data, sizeof(uint8_t), len, (FILE*) arg) != len;
+}
+
+/**
+ * Finds a volume among the open volumes, or opens it.
+ *
+ * @param cache
+ * @param path Path of the volume, relative to cache->root if it is set.
+ * @param vol Receives the volume, or NULL if it could not be kept open; pass
+ *        it to release_volume() when done.
+ * @param archive Receives the archive.
+ * @return TBM_OK, or one of the TBM_ERR_* values.
+ */
+static int acquire_volume(VolumeCache *const cache, const char path[],
+                          OpenVolume **const vol, TBMArchive **const archive)
+{
+	OpenVolume *v, *victim;
+	char *fullPath, *joined;
+	size_t i;
+	int status;
+
+	if (!cache->root) {
+		if (!(fullPath = strdup(path))) {
+			return TBM_ERR_NOMEM;
+		}
+	} else {
+		if (!(joined = (char*) malloc(cache->rootLen + strlen(path) + 2))) {
+			return TBM_ERR_NOMEM;
+		}
+		sprintf(joined, "%.*s/%s", (int) cache->rootLen, cache->root, path);
+		fullPath = realpath(joined, NULL);
+		free(joined);
+		if (!fullPath) {
+			return errno == ENOMEM ? TBM_ERR_NOMEM : TBM_ERR_IO;
+		}
+		/* Keep requests within the root, wherever ".." or symbolic links
+		 * lead.
+		 */
+		if (strncmp(fullPath, cache->root, cache->rootLen) ||
+		    fullPath[cache->rootLen] != '/')
+		{
+			free(fullPath);
+			errno = EACCES;
+			return TBM_ERR_IO;
+		}
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	for (i = 0; i < cache->numVolumes; i++) {
+		v = &cache->volumes[i];
+		if (!strcmp(v->path, fullPath)) {
+			v->users++;
+			v->lastUse = ++cache->clock;
+			pthread_mutex_unlock(&cache->lock);
+			free(fullPath);
+			*vol = v;
+			*archive = v->archive;
+			return TBM_OK;
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	/* Opening walks the whole volume (or reads its index), so it is done
+	 * without holding the lock; two requests may open the same volume at
+	 * once, in which case the second copy is closed below.
+	 */
+	if ((status = tbm_open_path(archive, fullPath, TBM_OPEN_INDEX))) {
+		free(fullPath);
+		return status;
+	}
+	if (cache->wordCacheDir) {
+		tbm_use_word_cache(*archive, cache->wordCacheDir);
+	}
+
+	pthread_mutex_lock(&cache->lock);
+	victim = NULL;
+	for (i = 0; i < cache->numVolumes; i++) {
+		v = &cache->volumes[i];
+		if (!strcmp(v->path, fullPath)) {
+			v->users++;
+			v->lastUse = ++cache->clock;
+			pthread_mutex_unlock(&cache->lock);
+			tbm_close(*archive);
+			free(fullPath);
+			*vol = v;
+			*archive = v->archive;
+			return TBM_OK;
+		}
+		if (!v->users && (!victim || v->lastUse < victim->lastUse)) {
+			victim = v;
+		}
+	}
+	if (cache->numVolumes < cache->maxVolumes) {
+		victim = &cache->volumes[cache->numVolumes++];
+	} else if (victim) {
+		tbm_close(victim->archive);
+		free(victim->path);
+	} else {
+		/* Every open volume is in use, so this one is not kept. */
+		pthread_mutex_unlock(&cache->lock);
+		free(fullPath);
+		*vol = NULL;
+		return TBM_OK;
+	}
+	victim->path = fullPath;
+	victim->archive = *archive;
+	victim->users = 1;
+	victim->lastUse = ++cache->clock;
+	pthread_mutex_unlock(&cache->lock);
+
+	*vol = victim;
+
+	return TBM_OK;
+}
+
+static void release_volume(VolumeCache *const cache, OpenVolume *const vol,
+                           TBMArchive *const archive)
+{
+	if (!vol) {
+		tbm_close(archive);
+		return;
+	}
+	pthread_mutex_lock(&cache->lock);
+	vol->users--;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * Writes a line "NAME\tTEXT", with trailing blanks removed from TEXT.
+ */
+static void put_text(FILE *const out, const char name[], const char text[],
+                     const size_t len)
+{
+	size_t n = len;
+
+	while (n > 0 && text[n-1] == ' ') {
+		n--;
+	}
+	fprintf(out, "%s\t%.*s\n", name, (int) n, text);
+}
+
+static void on_signal(int sig)
+{
+	(void) sig;
+	stopping = 1;
+}
+
+static void usage(void)
+{
+	printf("Usage:\n"
+	       "\n"
+	       "    tbmd [OPTIONS] SOCKET\n"
+	       "\n"
+	       "Serves requests for the files, records and labels of TBM volumes\n"
+	       "on the Unix-domain socket SOCKET. See tbmd.cpp for the protocol.\n"
+	       "\n"
+	       "Options:\n"
+	       "\n"
+	       "    -j, --jobs N         Number of connections served at once\n"
+	       "                         (default: one per processor).\n"
+	       "    -m, --max-volumes N  Number of volumes kept open (default:\n"
+	       "                         %d); the least recently used is closed\n"
+	       "                         to make room for another.\n"
+	       "    -r, --root DIR       Volumes are named relative to DIR, and\n"
+	       "                         may not be outside it, even through\n"
+	       "                         symbolic links.\n"
+	       "    -t, --timeout N      Close a connection after N seconds\n"
+	       "                         without progress (default: %d).\n"
+	       "    -w, --word-cache DIR Read records through the shared word\n"
+	       "                         cache in DIR.\n",
+	       TBMD_DEFAULT_MAX_VOLUMES, TBMD_DEFAULT_TIMEOUT);
+}
@@ -40,21 +40,32 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "gbytes.cpp"
 #include "cdc.hpp"
 #include "tbm.hpp"
-
-// Rounds up division.
-#define DIV_CEIL(n,d) (((n)-1)/(d)+1)
+#include "blockcache.hpp"
 
 #define LINE_LENGTH 100
 
 void print_bin(uint64_t bin, unsigned numDigits);
 int prompt_yesno(const char prompt[]);
+static void reserve(char **buf, size_t *bufLen, const size_t len);
+static void usage(void);
 
 int main(int argc, char **argv)
 {
-	FILE *fp;
+	static const struct option longOptions[] = {
+		{ "cache-size", required_argument, NULL, 'c' },
+		{ "verbose",    no_argument,       NULL, 'v' },
+		{ NULL,         0,                 NULL,  0  }
+	};
+	int fd;
+	struct stat st;
 	char *s;
 	char *inFileName;
 	SYSLBN_Data syslbn_data;
@@ -68,43 +79,73 @@ int main(int argc, char **argv)
 	size_t decodeAmount;
 	size_t offset;
 	DataBufferFlags dbf;
+	BlockCache cache;
+	size_t cacheSize = BLOCK_CACHE_DEFAULT_SIZE;
+	int mapped = 1;
+	int verbose = 0;
 	char *decodeBuf = NULL;
+	size_t decodeBufLen = 0;
 	char *responseText = NULL;
 	size_t responseTextLen = 0;
 	int responseValue;
 	int i, j;
 	int first;
+	long n;
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "c:v", longOptions, NULL)) != -1) {
+		switch (opt) {
+			case 'c':
+				if ((n = strtol(optarg, NULL, 10)) < 1) {
+					fprintf(stderr, "Error: invalid cache size \"%s\".\n",
+					        optarg);
+					exit(1);
+				}
+				cacheSize = (size_t) n << 20;
+				break;
+			case 'v': verbose = 1; break;
+			default:
+				usage();
+				exit(1);
+		}
+	}
 
-	if (argc != 2) {
+	if (argc - optind != 1) {
 		fprintf(stderr, "Error: Require one argument.\n");
-		printf("Usage:\n"
-		       "\n"
-		       "    tbmconv INFILE\n");
+		usage();
 		exit(1);
 	}
 
-	inFileName = argv[1];
+	inFileName = argv[optind];
 
-	if (!(fp = fopen(inFileName, "r"))) {
+	if ((fd = open(inFileName, O_RDONLY)) < 0 || fstat(fd, &st)) {
 		fprintf(stderr, "Error: Failed to open \"%s\" for reading.\n", inFileName);
 		exit(1);
 	}
 
-	fseek(fp, 0L, SEEK_END);
-	readAmount = ftell(fp);
-	fseek(fp, 0L, SEEK_SET);
+	readAmount = st.st_size;
 
 	decodeAmount = (readAmount*8)/6;
 
-	if (!(inBuf = (uint8_t*) malloc(sizeof(uint8_t)*readAmount)) ||
-	    !(decodeBuf = (char*) malloc(sizeof(char)*decodeAmount)))
-	{
-		fprintf(stderr, "Error: memory allocation failed\n");
-		exit(1);
+	/* Map the archive rather than reading it, so that only the parts which
+	 * are looked at need to be in memory.
+	 */
+	inBuf = (uint8_t*) mmap(NULL, readAmount, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (inBuf == MAP_FAILED) {
+		mapped = 0;
+		if (!(inBuf = (uint8_t*) malloc(sizeof(uint8_t)*readAmount))) {
+			fprintf(stderr, "Error: memory allocation failed\n");
+			exit(1);
+		}
+		if (tbm_pread(fd, inBuf, readAmount, 0)) {
+			fprintf(stderr, "read fail\n");
+			exit(1);
+		}
 	}
+	close(fd);
 
-	if (fread(inBuf, sizeof(uint8_t), readAmount, fp) != readAmount) {
-		fprintf(stderr, "read fail\n");
+	if (block_cache_init(&cache, inBuf, readAmount, cacheSize)) {
+		fprintf(stderr, "Error: memory allocation failed\n");
 		exit(1);
 	}
 
@@ -182,9 +223,10 @@ getDisplay:
 						break;
 					}
 				}
-				gbytes<uint8_t,char>(inBuf+(offset/8), decodeBuf, offset%8,
-				                     6, 0, responseValue);
-				cdc_decode(decodeBuf, responseValue);
+				/* Output is by whole lines. */
+				n = DIV_CEIL(responseValue, LINE_LENGTH)*LINE_LENGTH;
+				reserve(&decodeBuf, &decodeBufLen, n);
+				block_cache_text(&cache, offset, decodeBuf, n);
 				for (i = 0; i < responseValue; i += LINE_LENGTH) {
 					fwrite(decodeBuf+i, sizeof(char), LINE_LENGTH, stdout);
 #if 0
@@ -202,9 +244,8 @@ getDisplay:
 				responseValue = prompt_yesno("Follow Data Buffer Flags until EOF?");
 				first = 1;
 				do {
-					gbytes<uint8_t,uint64_t>(inBuf+(offset/8), (uint64_t*) &dbf,
-					                         offset%8, 60, 0,
-					                         sizeof(DataBufferFlags)/8);
+					block_cache_words(&cache, offset, (uint64_t*) &dbf,
+					                  sizeof(DataBufferFlags)/8);
 					print_dataBufferFlags(&dbf, offset, responseValue, first);
 					offset += dbf.nextPtrOffset*60;
 					first = 0;
@@ -223,9 +264,8 @@ getDisplay:
 					}
 				}
 				for (i = 0; i < responseValue; i++) {
-					gbytes<uint8_t,uint64_t>(inBuf+(offset/8), (uint64_t*) &bcp,
-					                         offset%8, 60, 0,
-					                         sizeof(BlockControlPointer)/8);
+					block_cache_words(&cache, offset, (uint64_t*) &bcp,
+					                  sizeof(BlockControlPointer)/8);
 					print_blockControlPointer(&bcp, offset, responseValue, i == 0);
 					offset += 60;
 				}
@@ -234,64 +274,49 @@ getDisplay:
 				responseValue = prompt_yesno("Follow File Control Pointers until EOF?");
 				first = 1;
 				do {
-					gbytes<uint8_t,uint64_t>(inBuf+(offset/8), (uint64_t*) &fcp,
-					                         offset%8, 60, 0,
-					                         sizeof(FileControlPointer)/8);
+					block_cache_words(&cache, offset, (uint64_t*) &fcp,
+					                  sizeof(FileControlPointer)/8);
 					print_fileControlPtr(&fcp, offset, responseValue, first);
 					offset += fcp.nextFCPOff*60;
 					first = 0;
 				} while (responseValue && !fcp.isEOF);
 				break;
 			case 5: /* File History Word */
-				gbytes<uint8_t,uint64_t>(inBuf+(offset/8),
-				                         (uint64_t*) &fhw_data,
-				                         offset%8, 60, 0,
-				                         sizeof(FileHistoryWord_Data)/8);
-				gbytes<uint8_t,uint8_t>(inBuf+(offset/8),
-				                        (uint8_t*) &fhw_text,
-				                        offset%8, 6, 0,
-				                         sizeof(FileHistoryWord_Text));
-				cdc_decode((char*) &fhw_text, sizeof(FileHistoryWord_Text));
+				block_cache_words(&cache, offset, (uint64_t*) &fhw_data,
+				                  sizeof(FileHistoryWord_Data)/8);
+				block_cache_text(&cache, offset, (char*) &fhw_text,
+				                 sizeof(FileHistoryWord_Text));
 				print_fileHistoryWord(&fhw_text, &fhw_data, offset);
 				break;
 			case 6: /* SYSLBN */
-				gbytes<uint8_t,uint8_t>(inBuf+(offset/8),
-				                        (uint8_t*) &syslbn_text, offset%8,
-				                        6, 0, sizeof(SYSLBN_Text));
-				cdc_decode((char*) &syslbn_text, sizeof(SYSLBN_Text));
-				gbytes<uint8_t,uint64_t>(inBuf+(offset/8),
-				                         (uint64_t*) &syslbn_data, offset%8, 
-				                         60, 0, sizeof(SYSLBN_Data)/8);
+				block_cache_text(&cache, offset, (char*) &syslbn_text,
+				                 sizeof(SYSLBN_Text));
+				block_cache_words(&cache, offset, (uint64_t*) &syslbn_data,
+				                  sizeof(SYSLBN_Data)/8);
 				print_syslbn(&syslbn_text, &syslbn_data, offset);
 				break;
 			case 7: /* VOL1 */
-				gbytes<uint8_t,uint8_t>(inBuf+(offset/8),
-				                        (uint8_t*) &(syslbn_text.vol1), offset%8,
-				                        6, 0, sizeof(HDR1_Text));
-				cdc_decode((char*) &(syslbn_text.vol1), sizeof(HDR1_Text));
-				gbytes<uint8_t,uint64_t>(inBuf+(offset/8),
-				                         (uint64_t*) &(syslbn_data.vol1), offset%8,
-				                         60, 0, sizeof(HDR1_Data)/8);
+				block_cache_text(&cache, offset, (char*) &(syslbn_text.vol1),
+				                 sizeof(HDR1_Text));
+				block_cache_words(&cache, offset,
+				                  (uint64_t*) &(syslbn_data.vol1),
+				                  sizeof(HDR1_Data)/8);
 				print_vol1(&(syslbn_text.vol1), &(syslbn_data.vol1), offset);
 				break;
 			case 8: /* HDR1 */
-				gbytes<uint8_t,uint8_t>(inBuf+(offset/8),
-				                        (uint8_t*) &(syslbn_text.hdr1), offset%8,
-				                        6, 0, sizeof(HDR1_Text));
-				cdc_decode((char*) &(syslbn_text.hdr1), sizeof(HDR1_Text));
-				gbytes<uint8_t,uint64_t>(inBuf+(offset/8),
-				                         (uint64_t*) &(syslbn_data.hdr1), offset%8,
-				                         60, 0, sizeof(HDR1_Data)/8);
+				block_cache_text(&cache, offset, (char*) &(syslbn_text.hdr1),
+				                 sizeof(HDR1_Text));
+				block_cache_words(&cache, offset,
+				                  (uint64_t*) &(syslbn_data.hdr1),
+				                  sizeof(HDR1_Data)/8);
 				print_hdr1(&(syslbn_text.hdr1), &(syslbn_data.hdr1), offset);
 				break;
 			case 9: /* HDR2 */
-				gbytes<uint8_t,uint8_t>(inBuf+(offset/8),
-				                        (uint8_t*) &(syslbn_text.hdr2), offset%8,
-				                        6, 0, sizeof(HDR1_Text));
-				cdc_decode((char*) &(syslbn_text.hdr2), sizeof(HDR1_Text));
-				gbytes<uint8_t,uint64_t>(inBuf+(offset/8),
-				                         (uint64_t*) &(syslbn_data.hdr2), offset%8,
-				                         60, 0, sizeof(HDR1_Data)/8);
+				block_cache_text(&cache, offset, (char*) &(syslbn_text.hdr2),
+				                 sizeof(HDR1_Text));
+				block_cache_words(&cache, offset,
+				                  (uint64_t*) &(syslbn_data.hdr2),
+				                  sizeof(HDR1_Data)/8);
 				print_hdr2(&(syslbn_text.hdr2), &(syslbn_data.hdr2), offset);
 				break;
 			case 10: /* 20-bit integers */
@@ -306,6 +331,8 @@ getDisplay:
 						break;
 					}
 				}
+				reserve(&decodeBuf, &decodeBufLen,
+				        sizeof(uint32_t)*(responseValue+2));
 				gbytes<uint8_t,uint32_t>(inBuf+(offset/8),
 				                         (uint32_t*) decodeBuf, offset%8,
 				                         20, 0, responseValue);
@@ -328,9 +355,10 @@ getDisplay:
 						break;
 					}
 				}
-				gbytes<uint8_t,uint64_t>(inBuf+(offset/8),
-				                         (uint64_t*) decodeBuf, offset%8,
-				                         60, 0, responseValue);
+				reserve(&decodeBuf, &decodeBufLen,
+				        sizeof(uint64_t)*responseValue);
+				block_cache_words(&cache, offset, (uint64_t*) decodeBuf,
+				                  responseValue);
 				for (i = 0; i < responseValue; i++) {
 					fprintf(stdout, "%19ld ", ((uint64_t*) decodeBuf)[i]);
 					print_bin(((uint64_t*) decodeBuf)[i], 60);
@@ -344,12 +372,53 @@ getDisplay:
 		}
 	}
 
+	if (verbose) {
+		fprintf(stderr, "Info: block cache: %lu hits, %lu misses\n",
+		        (unsigned long) cache.hits, (unsigned long) cache.misses);
+	}
+
+	block_cache_free(&cache);
 	free(responseText);
-	free(inBuf);
+	free(decodeBuf);
+	if (mapped) {
+		munmap(inBuf, readAmount);
+	} else {
+		free(inBuf);
+	}
 
 	return 0;
 }
 
+/**
+ * Makes sure `*buf' holds at least `len' bytes, exiting if it cannot.
+ */
+static void reserve(char **buf, size_t *bufLen, const size_t len)
+{
+	if (len <= *bufLen) {
+		return;
+	}
+	if (!(*buf = (char*) realloc(*buf, len))) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+		exit(1);
+	}
+	*bufLen = len;
+}
+
+static void usage(void)
+{
+	printf("Usage:\n"
+	       "\n"
+	       "    tbmexplore [--cache-size MIB] [--verbose] INFILE\n"
+	       "\n"
+	       "Options:\n"
+	       "\n"
+	       "    -c, --cache-size MIB  Keep up to MIB mebibytes of decoded blocks\n"
+	       "                          (default %d).\n"
+	       "    -v, --verbose         Report how well the block cache did on\n"
+	       "                          exit.\n",
+	       BLOCK_CACHE_DEFAULT_SIZE >> 20);
+}
+
 void print_bin(uint64_t bin, unsigned numDigits)
 {
 	int i = numDigits;
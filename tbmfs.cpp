@@ -0,0 +1,403 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * A FUSE filesystem which presents each of a set of TBM volumes as a
+ * directory of its files, decoding file contents only as they are read.
+ *
+ *     tbmfs [FUSE OPTIONS] MOUNTPOINT VOLUME...
+ *
+ * Volume VOLUME appears as the directory MOUNTPOINT/NAME, where NAME is its
+ * base name, and file I of it as NAME/III-DSID, where DSID is the data set
+ * ID from the file's HDR1 label. A volume is opened (through its sidecar
+ * index) when it is first looked at, and stays open.
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fuse.h>
+#include "tbm.hpp"
+#include "libtbm.hpp"
+
+/* Length of a file name: an index of up to 11 digits, '-' and a data set
+ * ID. */
+#define TBMFS_NAME_LEN (11 + 1 + 17 + 1)
+
+/**
+ * One volume given on the command line.
+ */
+typedef struct {
+	const char *path;
+	const char *name;     /* Base name of the path. */
+	TBMArchive *archive;  /* NULL until the volume is first looked at. */
+	int status;           /* Result of opening the volume, once tried. */
+	int tried;
+	int numFiles;
+	char (*fileNames)[TBMFS_NAME_LEN];
+	struct stat *fileStats;
+} FSVolume;
+
+static FSVolume *volumes;
+static int numVolumes;
+static pthread_mutex_t openLock = PTHREAD_MUTEX_INITIALIZER;
+static struct stat volumeStat;
+
+static int open_volume(FSVolume *const vol);
+static int lookup(const char path[], FSVolume **const vol, int *const file);
+static void *tbmfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg);
+static int tbmfs_getattr(const char *path, struct stat *st,
+                         struct fuse_file_info *fi);
+static int tbmfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags);
+static int tbmfs_open(const char *path, struct fuse_file_info *fi);
+static int tbmfs_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi);
+
+int main(int argc, char **argv)
+{
+	struct fuse_operations ops;
+	const char *s;
+	int fuseArgc;
+	int i, j;
+
+	/* FUSE takes the options and the mount point; the volumes follow. */
+	for (fuseArgc = 1; fuseArgc < argc && argv[fuseArgc][0] == '-';
+	     fuseArgc++)
+	{
+		if (!strcmp(argv[fuseArgc], "-o") && fuseArgc+1 < argc) {
+			fuseArgc++;
+		}
+	}
+	fuseArgc++;
+	if (fuseArgc >= argc) {
+		fprintf(stderr, "Error: Require a mount point and at least one "
+		                "volume.\n");
+		printf("Usage:\n"
+		       "\n"
+		       "    tbmfs [FUSE OPTIONS] MOUNTPOINT VOLUME...\n");
+		return 1;
+	}
+
+	numVolumes = argc - fuseArgc;
+	if (!(volumes = (FSVolume*) calloc(numVolumes, sizeof(FSVolume)))) {
+		fprintf(stderr, "Error: memory allocation failed\n");
+		return 1;
+	}
+	for (i = 0; i < numVolumes; i++) {
+		/* FUSE changes directory to "/" once mounted. */
+		if (!(volumes[i].path = realpath(argv[fuseArgc+i], NULL))) {
+			fprintf(stderr, "Error: Failed to open \"%s\": %s\n",
+			        argv[fuseArgc+i], strerror(errno));
+			return 1;
+		}
+		s = strrchr(volumes[i].path, '/');
+		volumes[i].name = s ? s+1 : volumes[i].path;
+		/* Each volume is a directory named after it, so the names must
+		 * differ.
+		 */
+		for (j = 0; j < i; j++) {
+			if (!strcmp(volumes[i].name, volumes[j].name)) {
+				fprintf(stderr, "Error: \"%s\" and \"%s\" would both be "
+				                "mounted as \"%s\".\n", volumes[j].path,
+				        volumes[i].path, volumes[i].name);
+				return 1;
+			}
+		}
+	}
+
+	memset(&volumeStat, 0, sizeof(volumeStat));
+	volumeStat.st_mode = S_IFDIR | 0555;
+	volumeStat.st_nlink = 2;
+
+	memset(&ops, 0, sizeof(ops));
+	ops.init = tbmfs_init;
+	ops.getattr = tbmfs_getattr;
+	ops.readdir = tbmfs_readdir;
+	ops.open = tbmfs_open;
+	ops.read = tbmfs_read;
+
+	return fuse_main(fuseArgc, argv, &ops, NULL);
+}
+
+/**
+ * Opens a volume and names its files, if that has not been tried yet.
+ *
+ * @return 0, or a negative errno value if the volume can't be opened.
+ */
+static int open_volume(FSVolume *const vol)
+{
+	TBMFileInfo info;
+	size_t n;
+	int i;
+	char *c;
+
+	pthread_mutex_lock(&openLock);
+	if (vol->tried) {
+		pthread_mutex_unlock(&openLock);
+		return vol->status;
+	}
+	vol->tried = 1;
+
+	if (tbm_open_path(&vol->archive, vol->path, TBM_OPEN_INDEX)) {
+		fprintf(stderr, "Error: Failed to open \"%s\"\n", vol->path);
+		vol->status = -EIO;
+		goto done;
+	}
+
+	vol->numFiles = tbm_num_files(vol->archive);
+	vol->fileNames = (char (*)[TBMFS_NAME_LEN])
+		malloc(sizeof(*vol->fileNames)*(vol->numFiles+1));
+	vol->fileStats = (struct stat*) calloc(vol->numFiles+1,
+	                                       sizeof(struct stat));
+	if (!vol->fileNames || !vol->fileStats) {
+		free(vol->fileNames);
+		free(vol->fileStats);
+		vol->fileNames = NULL;
+		vol->fileStats = NULL;
+		vol->numFiles = 0;
+		tbm_close(vol->archive);
+		vol->archive = NULL;
+		vol->status = -ENOMEM;
+		goto done;
+	}
+
+	for (i = 0; i < vol->numFiles; i++) {
+		tbm_file_info(vol->archive, i, &info);
+		snprintf(vol->fileNames[i], TBMFS_NAME_LEN, "%03d-%.17s", i,
+		         info.file.hdr1_text.dataSetID);
+		/* Data set IDs are padded with blanks, and may hold a '/'. */
+		n = strlen(vol->fileNames[i]);
+		while (n > 4 && vol->fileNames[i][n-1] == ' ') {
+			vol->fileNames[i][--n] = '\0';
+		}
+		for (c = vol->fileNames[i]; *c; c++) {
+			if (*c == '/') {
+				*c = '_';
+			}
+		}
+		vol->fileStats[i].st_mode = S_IFREG | 0444;
+		vol->fileStats[i].st_nlink = 1;
+		vol->fileStats[i].st_size = info.size;
+	}
+	vol->status = 0;
+
+done:
+	pthread_mutex_unlock(&openLock);
+	return vol->status;
+}
+
+/**
+ * Finds what a path names.
+ *
+ * @param path
+ * @param vol Receives the volume, or NULL for the root.
+ * @param file Receives the index of the file, or -1 for the volume itself.
+ * @return 0, or a negative errno value.
+ */
+static int lookup(const char path[], FSVolume **const vol, int *const file)
+{
+	const char *s;
+	size_t len;
+	int status;
+	int i;
+
+	*vol = NULL;
+	*file = -1;
+
+	if (!strcmp(path, "/")) {
+		return 0;
+	}
+
+	path++;
+	s = strchr(path, '/');
+	len = s ? (size_t) (s - path) : strlen(path);
+	for (i = 0; i < numVolumes; i++) {
+		if (strlen(volumes[i].name) == len &&
+		    !strncmp(volumes[i].name, path, len))
+		{
+			break;
+		}
+	}
+	if (i == numVolumes) {
+		return -ENOENT;
+	}
+	*vol = &volumes[i];
+	if (!s || !s[1]) {
+		return 0;
+	}
+
+	if ((status = open_volume(*vol))) {
+		return status;
+	}
+	for (i = 0; i < (*vol)->numFiles; i++) {
+		if (!strcmp((*vol)->fileNames[i], s+1)) {
+			*file = i;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+static void *tbmfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+	(void) conn;
+
+	/* The volumes don't change, so what the kernel caches stays valid. */
+	cfg->kernel_cache = 1;
+
+	return NULL;
+}
+
+static int tbmfs_getattr(const char *path, struct stat *st,
+                         struct fuse_file_info *fi)
+{
+	FSVolume *vol;
+	int file;
+	int status;
+
+	(void) fi;
+
+	if ((status = lookup(path, &vol, &file))) {
+		return status;
+	}
+	*st = file < 0 ? volumeStat : vol->fileStats[file];
+
+	return 0;
+}
+
+static int tbmfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                         off_t offset, struct fuse_file_info *fi,
+                         enum fuse_readdir_flags flags)
+{
+	FSVolume *vol;
+	int file;
+	int status;
+	int i;
+
+	(void) offset;
+	(void) fi;
+	(void) flags;
+
+	if ((status = lookup(path, &vol, &file))) {
+		return status;
+	}
+	if (file >= 0) {
+		return -ENOTDIR;
+	}
+	if (vol && (status = open_volume(vol))) {
+		return status;
+	}
+
+	filler(buf, ".", NULL, 0, (enum fuse_fill_dir_flags) 0);
+	filler(buf, "..", NULL, 0, (enum fuse_fill_dir_flags) 0);
+	if (!vol) {
+		for (i = 0; i < numVolumes; i++) {
+			filler(buf, volumes[i].name, &volumeStat, 0,
+			       (enum fuse_fill_dir_flags) 0);
+		}
+	} else {
+		for (i = 0; i < vol->numFiles; i++) {
+			filler(buf, vol->fileNames[i], &vol->fileStats[i], 0,
+			       (enum fuse_fill_dir_flags) 0);
+		}
+	}
+
+	return 0;
+}
+
+static int tbmfs_open(const char *path, struct fuse_file_info *fi)
+{
+	FSVolume *vol;
+	int file;
+	int status;
+
+	if ((status = lookup(path, &vol, &file))) {
+		return status;
+	}
+	if (file < 0) {
+		return -EISDIR;
+	}
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		return -EROFS;
+	}
+	fi->fh = file;
+	fi->keep_cache = 1;
+
+	return 0;
+}
+
+/**
+ * Reads part of a file. Only the data segments holding that part are
+ * decoded, and the archive is mapped, so only the pages holding them are
+ * read from disk. libtbm's errors are not errno values, so they are mapped
+ * to ones FUSE understands.
+ */
+static int tbmfs_read(const char *path, char *buf, size_t size, off_t offset,
+                      struct fuse_file_info *fi)
+{
+	FSVolume *vol;
+	ssize_t n;
+	int file;
+	int status;
+
+	if ((status = lookup(path, &vol, &file))) {
+		return status;
+	}
+	if (file < 0) {
+		return -EISDIR;
+	}
+	if (offset < 0) {
+		return -EINVAL;
+	}
+
+	n = tbm_read_file(vol->archive, (int) fi->fh, offset, (uint8_t*) buf,
+	                  size);
+	if (n == TBM_ERR_RANGE) {
+		return 0;
+	}
+	if (n < 0) {
+		return n == TBM_ERR_NOMEM ? -ENOMEM : -EIO;
+	}
+
+	return (int) n;
+}
@@ -0,0 +1,563 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Sidecar index (".tbmidx" file) of the control structures of a TBM archive.
+ *
+ * An index file is a TBMIndexHeader, followed by the SYSLBN_Text and
+ * SYSLBN_Data of the archive, its TBMIndexFile records, its TBMIndexEntry
+ * records and then its record table, all stored as they are laid out in
+ * memory. The
+ * header records the byte order and the sizes of the records, so an index
+ * written by an incompatible build is treated as stale rather than misread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "gbytes.cpp"
+#include "tbm.hpp"
+#include "tbmidx.hpp"
+
+#define TBMIDX_BYTE_ORDER 0x01020304
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t syslbnSize;  /* sizeof(SYSLBN_Text)+sizeof(SYSLBN_Data) */
+	uint32_t fileSize;    /* sizeof(TBMIndexFile) */
+	uint32_t entrySize;   /* sizeof(TBMIndexEntry) */
+	uint32_t numFiles;
+	uint64_t numEntries;
+	uint64_t numRecords;
+	uint64_t volumeSize;
+	uint64_t volumeHash;
+	uint64_t volumeInode;
+	uint64_t volumeMtime;
+	uint64_t contentHash;
+} TBMIndexHeader;
+
+/**
+ * State of tbmidx_build() while walking the archive.
+ */
+typedef struct {
+	TBMIndex *idx;
+	size_t capacity;  /* Number of entries allocated. */
+} IndexBuilder;
+
+static int index_begin_file(void *arg, const int i, TBMFile const*const file);
+static int index_segment(void *arg, const int i, uint8_t const*const inBuf,
+                         DataBufferFlags const*const dbf, const size_t offset,
+                         const size_t numWords, const size_t writeOffset);
+static int index_end_file(void *arg, const int i, TBMFile const*const file);
+static int build_record_table(TBMIndex *const idx);
+static int check_index(TBMIndex const*const idx);
+
+/**
+ * Computes the 64-bit FNV-1a hash of a buffer. This is used to hash the
+ * label buffer of an archive.
+ *
+ * @param inBuf
+ * @param len
+ */
+uint64_t tbmidx_hash(uint8_t const*const inBuf, const size_t len)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= inBuf[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Builds the index of an archive by walking its control structures once.
+ *
+ * @param inBuf The whole archive.
+ * @param len Length of the archive in bytes.
+ * @param idx Receives the index; free with tbmidx_free().
+ * @return TBM_OK, TBM_ERR_NOMEM, or TBM_ERR_FORMAT if the archive is
+ *         malformed.
+ */
+int tbmidx_build(uint8_t const*const inBuf, const size_t len,
+                 TBMIndex *const idx)
+{
+	FileControlPointer fcp;
+	TBMExtractor extractor;
+	IndexBuilder builder;
+	TBMFile *files;
+	size_t offset;
+	int i;
+	int status;
+
+	memset(idx, 0, sizeof(TBMIndex));
+
+	read_syslbn(inBuf, &idx->syslbn_text, &idx->syslbn_data, 0);
+	idx->volumeSize = len;
+	idx->volumeHash = tbmidx_hash(inBuf,
+	                              idx->syslbn_data.bk*BK_BLOCK_SIZE_BYTES);
+	idx->numFiles = tbm_count_files(inBuf, &idx->syslbn_data, NULL, 0);
+
+	idx->files = (TBMIndexFile*) calloc(idx->numFiles+1,
+	                                    sizeof(TBMIndexFile));
+	files = (TBMFile*) calloc(idx->numFiles+1, sizeof(TBMFile));
+	if (!idx->files || !files) {
+		free(files);
+		tbmidx_free(idx);
+		return TBM_ERR_NOMEM;
+	}
+
+	/* The control pointers of each file, as counted by tbm_count_files(). */
+	offset = idx->syslbn_data.firstFCPOff * 60;
+	i = 0;
+	do {
+		read_fileControlPointer(inBuf, &fcp, offset);
+		if (!fcp.isEOF && fcp.dataBlkNum != idx->syslbn_data.numBKBlocks-1) {
+			idx->files[i].fcp = fcp;
+			read_fileHistoryWord(inBuf, &(idx->files[i].fhw_text),
+			                     &(idx->files[i].fhw_data), offset+60);
+			i++;
+		}
+		offset += fcp.nextFCPOff*60;
+	} while (!fcp.isEOF && fcp.nextFCPOff && i < idx->numFiles);
+
+	builder.idx = idx;
+	builder.capacity = 0;
+	extractor.arg = &builder;
+	extractor.beginFile = index_begin_file;
+	extractor.segment = index_segment;
+	extractor.endFile = index_end_file;
+
+	if ((status = tbm_extract(inBuf, len, idx->syslbn_data.bk, files,
+	                          idx->numFiles, &extractor)))
+	{
+		free(files);
+		tbmidx_free(idx);
+		return status;
+	}
+
+	for (i = 0; i < idx->numFiles; i++) {
+		idx->files[i].file = files[i];
+	}
+	free(files);
+
+	if (build_record_table(idx)) {
+		tbmidx_free(idx);
+		return TBM_ERR_NOMEM;
+	}
+
+	return 0;
+}
+
+/**
+ * Finds where each record starts. A record starts at each segment whose DBF
+ * has isRecordStart set; the first segment of a file always starts a record.
+ *
+ * @return 0 on success, or -1 if memory could not be allocated.
+ */
+static int build_record_table(TBMIndex *const idx)
+{
+	TBMIndexFile *f;
+	uint64_t j;
+	int i;
+
+	if (!(idx->records = (uint64_t*) malloc(sizeof(uint64_t)*
+	                                        (idx->numEntries+1))))
+	{
+		return -1;
+	}
+
+	idx->numRecords = 0;
+	for (i = 0; i < idx->numFiles; i++) {
+		f = &(idx->files[i]);
+		f->firstRecord = idx->numRecords;
+		for (j = f->firstEntry; j < f->firstEntry + f->numEntries; j++) {
+			if (j == f->firstEntry || idx->entries[j].dbf.isRecordStart) {
+				idx->records[idx->numRecords++] = j;
+			}
+		}
+		f->numRecords = idx->numRecords - f->firstRecord;
+	}
+
+	return 0;
+}
+
+static int index_begin_file(void *arg, const int i, TBMFile const*const file)
+{
+	IndexBuilder *const builder = (IndexBuilder*) arg;
+
+	builder->idx->files[i].firstEntry = builder->idx->numEntries;
+
+	return 0;
+}
+
+static int index_segment(void *arg, const int i, uint8_t const*const inBuf,
+                         DataBufferFlags const*const dbf, const size_t offset,
+                         const size_t numWords, const size_t writeOffset)
+{
+	IndexBuilder *const builder = (IndexBuilder*) arg;
+	TBMIndex *const idx = builder->idx;
+	TBMIndexEntry *entries;
+
+	if (idx->numEntries == builder->capacity) {
+		builder->capacity = builder->capacity ? 2*builder->capacity : 1024;
+		if (!(entries = (TBMIndexEntry*)
+		      realloc(idx->entries, sizeof(TBMIndexEntry)*builder->capacity)))
+		{
+			return TBM_ERR_NOMEM;
+		}
+		idx->entries = entries;
+	}
+
+	idx->entries[idx->numEntries].offset = offset-60;
+	idx->entries[idx->numEntries].writeOffset = writeOffset;
+	idx->entries[idx->numEntries].dbf = *dbf;
+	idx->numEntries++;
+
+	return 0;
+}
+
+static int index_end_file(void *arg, const int i, TBMFile const*const file)
+{
+	IndexBuilder *const builder = (IndexBuilder*) arg;
+	TBMIndexFile *const f = &(builder->idx->files[i]);
+
+	f->numEntries = builder->idx->numEntries - f->firstEntry;
+
+	return 0;
+}
+
+/**
+ * Writes an index to a file. The index is written to a temporary file which
+ * is then renamed, so that readers never see a partial index.
+ *
+ * @param idx
+ * @param path
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+int tbmidx_write(TBMIndex const*const idx, const char path[])
+{
+	TBMIndexHeader header;
+	char *tmpPath;
+	FILE *fp;
+	int ok;
+
+	if (!(tmpPath = (char*) malloc(strlen(path) + 32))) {
+		return -1;
+	}
+	sprintf(tmpPath, "%s.%ld", path, (long) getpid());
+
+	if (!(fp = fopen(tmpPath, "wb"))) {
+		free(tmpPath);
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TBMIDX_MAGIC, sizeof(header.magic));
+	header.version = TBMIDX_VERSION;
+	header.byteOrder = TBMIDX_BYTE_ORDER;
+	header.syslbnSize = sizeof(SYSLBN_Text) + sizeof(SYSLBN_Data);
+	header.fileSize = sizeof(TBMIndexFile);
+	header.entrySize = sizeof(TBMIndexEntry);
+	header.numFiles = idx->numFiles;
+	header.numEntries = idx->numEntries;
+	header.numRecords = idx->numRecords;
+	header.volumeSize = idx->volumeSize;
+	header.volumeHash = idx->volumeHash;
+	header.volumeInode = idx->volumeInode;
+	header.volumeMtime = idx->volumeMtime;
+	header.contentHash = idx->contentHash;
+
+	ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+	     fwrite(&idx->syslbn_text, sizeof(SYSLBN_Text), 1, fp) == 1 &&
+	     fwrite(&idx->syslbn_data, sizeof(SYSLBN_Data), 1, fp) == 1 &&
+	     fwrite(idx->files, sizeof(TBMIndexFile), idx->numFiles, fp) ==
+	         (size_t) idx->numFiles &&
+	     fwrite(idx->entries, sizeof(TBMIndexEntry), idx->numEntries, fp) ==
+	         idx->numEntries &&
+	     fwrite(idx->records, sizeof(uint64_t), idx->numRecords, fp) ==
+	         idx->numRecords;
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmpPath, path)) {
+		unlink(tmpPath);
+		free(tmpPath);
+		return -1;
+	}
+
+	free(tmpPath);
+
+	return 0;
+}
+
+/**
+ * Reads the index of an archive, if there is an up-to-date one.
+ *
+ * @param idx Receives the index; free with tbmidx_free().
+ * @param path
+ * @param volume The volumeSize, volumeHash (from tbmidx_hash()), volumeInode
+ *        and volumeMtime of the archive; its other members are unused.
+ * @return 0 if the index was read, or 1 if there is no index, or it is stale,
+ *         unreadable, inconsistent (see check_index()) or from an
+ *         incompatible version; `idx' is then empty.
+ */
+int tbmidx_read(TBMIndex *const idx, const char path[],
+                TBMIndex const*const volume)
+{
+	TBMIndexHeader header;
+	struct stat st;
+	FILE *fp;
+
+	memset(idx, 0, sizeof(TBMIndex));
+
+	if (!(fp = fopen(path, "rb"))) {
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header.magic, TBMIDX_MAGIC, sizeof(header.magic)) ||
+	    header.version != TBMIDX_VERSION ||
+	    header.byteOrder != TBMIDX_BYTE_ORDER ||
+	    header.syslbnSize != sizeof(SYSLBN_Text) + sizeof(SYSLBN_Data) ||
+	    header.fileSize != sizeof(TBMIndexFile) ||
+	    header.entrySize != sizeof(TBMIndexEntry) ||
+	    header.volumeSize != volume->volumeSize ||
+	    header.volumeHash != volume->volumeHash ||
+	    header.volumeInode != volume->volumeInode ||
+	    header.volumeMtime != volume->volumeMtime)
+	{
+		fclose(fp);
+		return 1;
+	}
+
+	/* A truncated index, or one whose counts are corrupt, is stale; the
+	 * counts are checked against the size of the file before anything is
+	 * allocated for them.
+	 */
+	if (fstat(fileno(fp), &st) ||
+	    header.numEntries > (uint64_t) st.st_size/sizeof(TBMIndexEntry) ||
+	    header.numRecords > (uint64_t) st.st_size/sizeof(uint64_t) ||
+	    (uint64_t) st.st_size != sizeof(header) + header.syslbnSize +
+	                             header.numFiles*sizeof(TBMIndexFile) +
+	                             header.numEntries*sizeof(TBMIndexEntry) +
+	                             header.numRecords*sizeof(uint64_t))
+	{
+		fclose(fp);
+		return 1;
+	}
+
+	idx->volumeSize = header.volumeSize;
+	idx->volumeHash = header.volumeHash;
+	idx->volumeInode = header.volumeInode;
+	idx->volumeMtime = header.volumeMtime;
+	idx->contentHash = header.contentHash;
+	idx->numFiles = header.numFiles;
+	idx->numEntries = header.numEntries;
+	idx->numRecords = header.numRecords;
+	idx->files = (TBMIndexFile*) malloc(sizeof(TBMIndexFile)*
+	                                    (idx->numFiles+1));
+	idx->entries = (TBMIndexEntry*) malloc(sizeof(TBMIndexEntry)*
+	                                       (idx->numEntries+1));
+	idx->records = (uint64_t*) malloc(sizeof(uint64_t)*(idx->numRecords+1));
+
+	if (!idx->files || !idx->entries || !idx->records ||
+	    fread(&idx->syslbn_text, sizeof(SYSLBN_Text), 1, fp) != 1 ||
+	    fread(&idx->syslbn_data, sizeof(SYSLBN_Data), 1, fp) != 1 ||
+	    fread(idx->files, sizeof(TBMIndexFile), idx->numFiles, fp) !=
+	        (size_t) idx->numFiles ||
+	    fread(idx->entries, sizeof(TBMIndexEntry), idx->numEntries, fp) !=
+	        idx->numEntries ||
+	    fread(idx->records, sizeof(uint64_t), idx->numRecords, fp) !=
+	        idx->numRecords ||
+	    check_index(idx))
+	{
+		fclose(fp);
+		tbmidx_free(idx);
+		return 1;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+/**
+ * Checks that an index read from a file describes an archive of
+ * idx->volumeSize bytes consistently, as everything which uses the index
+ * indexes the archive and the index's own tables with what it holds: every
+ * segment must lie within the archive, every file's segments and records
+ * within the tables, each extracted segment must end before the next one
+ * starts and within its file's size, and every record must start at one of
+ * its file's segments, after the start of the record before it.
+ *
+ * @return 0 if the index is consistent, or 1 if not.
+ */
+static int check_index(TBMIndex const*const idx)
+{
+	const uint64_t volumeBits = 8*idx->volumeSize;
+	TBMIndexFile const *f;
+	TBMIndexEntry const *e;
+	uint64_t j, prev, end;
+	int i;
+
+	if (idx->numFiles < 0 || idx->syslbn_data.bk == 0 ||
+	    idx->syslbn_data.bk*BK_BLOCK_SIZE_BYTES > idx->volumeSize)
+	{
+		return 1;
+	}
+
+	/* Segments are padded to 64-bit boundaries when extracted (see
+	 * tbm_extract()), so a file is at most 128 bits per segment longer
+	 * than the archive.
+	 */
+	for (j = 0; j < idx->numEntries; j++) {
+		e = &(idx->entries[j]);
+		if (e->dbf.nextPtrOffset == 0 || e->offset > volumeBits ||
+		    60*(uint64_t) e->dbf.nextPtrOffset > volumeBits - e->offset ||
+		    e->writeOffset > volumeBits + 128*idx->numEntries)
+		{
+			return 1;
+		}
+	}
+
+	for (i = 0; i < idx->numFiles; i++) {
+		f = &(idx->files[i]);
+		if (f->firstEntry > idx->numEntries ||
+		    f->numEntries > idx->numEntries - f->firstEntry ||
+		    f->firstRecord > idx->numRecords ||
+		    f->numRecords > idx->numRecords - f->firstRecord ||
+		    (f->numEntries && f->numRecords == 0) ||
+		    f->numRecords > f->numEntries ||
+		    f->file.size > volumeBits + 128*idx->numEntries)
+		{
+			return 1;
+		}
+		/* Extracted files are read by binary search on writeOffset, and
+		 * their sizes are taken from file.size, so each segment, padded to
+		 * 64 bits, must end by the start of the next and within the file.
+		 */
+		for (j = 0; j < f->numEntries; j++) {
+			e = &(idx->entries[f->firstEntry + j]);
+			end = e->writeOffset +
+			      64*DIV_CEIL(60*(uint64_t) (e->dbf.nextPtrOffset-1), 64);
+			if (end > f->file.size ||
+			    (j+1 < f->numEntries && end > e[1].writeOffset))
+			{
+				return 1;
+			}
+		}
+		for (j = 0; j < f->numRecords; j++) {
+			prev = j ? idx->records[f->firstRecord + j-1] : f->firstEntry;
+			if ((j == 0 && idx->records[f->firstRecord] != f->firstEntry) ||
+			    (j > 0 && idx->records[f->firstRecord + j] <= prev) ||
+			    idx->records[f->firstRecord + j] >=
+			        f->firstEntry + f->numEntries)
+			{
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Hands the data of the files of an archive to the callbacks of `ex' in the
+ * same way as tbm_extract(), but using the index instead of walking the
+ * archive.
+ *
+ * @param idx
+ * @param inBuf The archive.
+ * @param files Receives the labels of each file; must have room for
+ *        idx->numFiles entries.
+ * @param ex
+ * @return 0, or the first nonzero value returned by a callback.
+ */
+int tbmidx_extract(TBMIndex const*const idx, uint8_t const*const inBuf,
+                   TBMFile *const files, TBMExtractor const*const ex)
+{
+	TBMIndexEntry const *e;
+	uint64_t j;
+	int i;
+	int status;
+
+	for (i = 0; i < idx->numFiles; i++) {
+		files[i] = idx->files[i].file;
+
+		if (ex->beginFile && (status = ex->beginFile(ex->arg, i, &files[i]))) {
+			return status;
+		}
+
+		for (j = 0; ex->segment && j < idx->files[i].numEntries; j++) {
+			e = &(idx->entries[idx->files[i].firstEntry + j]);
+			if ((status = ex->segment(ex->arg, i, inBuf, &(e->dbf),
+			                          e->offset+60, e->dbf.nextPtrOffset-1,
+			                          e->writeOffset)))
+			{
+				return status;
+			}
+		}
+
+		if (ex->endFile && (status = ex->endFile(ex->arg, i, &files[i]))) {
+			return status;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Releases the memory held by an index.
+ *
+ * @param idx
+ */
+void tbmidx_free(TBMIndex *const idx)
+{
+	free(idx->files);
+	free(idx->entries);
+	free(idx->records);
+	idx->files = NULL;
+	idx->entries = NULL;
+	idx->records = NULL;
+	idx->numFiles = 0;
+	idx->numEntries = 0;
+	idx->numRecords = 0;
+}
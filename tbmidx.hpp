@@ -0,0 +1,108 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Sidecar index (".tbmidx" file) of the control structures of a TBM archive,
+ * so that repeated operations on an archive need not walk its chain of data
+ * buffer flags again.
+ */
+
+#ifndef TBMIDX_HPP
+#define TBMIDX_HPP
+
+#define TBMIDX_MAGIC   "TBMIDX\r\n"
+#define TBMIDX_VERSION 5
+#define TBMIDX_SUFFIX  ".tbmidx"
+
+/**
+ * One data segment of a file.
+ */
+typedef struct {
+	uint64_t offset;      /** Bit offset of the DBF in the archive. */
+	uint64_t writeOffset; /** Bit offset of the data in the extracted file. */
+	DataBufferFlags dbf;
+} TBMIndexEntry;
+
+/**
+ * The labels and control pointers of one file, and where its data segments
+ * are in the index.
+ */
+typedef struct {
+	TBMFile file;
+	FileControlPointer fcp;
+	FileHistoryWord_Data fhw_data;
+	FileHistoryWord_Text fhw_text;
+	uint64_t firstEntry;  /** Index of the file's first TBMIndexEntry. */
+	uint64_t numEntries;  /** Number of data segments in the file. */
+	uint64_t firstRecord; /** Index of the file's first record start. */
+	uint64_t numRecords;  /** Number of records in the file. */
+} TBMIndexFile;
+
+/**
+ * Everything that is learned by walking the control structures of a TBM
+ * archive. The index belongs to the archive file whose size, inode number,
+ * modification time and label buffer hash match those recorded in it. The
+ * hash alone covers only the first BK block, so it is the file's metadata
+ * which tells a copy that differs in its data blocks, or a volume rewritten
+ * in place, from the one the index was built from.
+ */
+typedef struct {
+	uint64_t volumeSize;  /** Size of the archive in bytes. */
+	uint64_t volumeHash;  /** Hash of the archive's label buffer. */
+	uint64_t volumeInode; /** Inode number of the archive file. */
+	uint64_t volumeMtime; /** Modification time of the archive file, in
+	                          nanoseconds since the epoch. */
+	uint64_t contentHash; /** wordcache_hash() of the whole archive, kept
+	                          so that the word cache can be found without
+	                          reading it all; 0 if not computed. */
+	SYSLBN_Text syslbn_text;
+	SYSLBN_Data syslbn_data;
+	int numFiles;
+	TBMIndexFile *files;
+	size_t numEntries;
+	TBMIndexEntry *entries;
+	size_t numRecords;
+	uint64_t *records;    /** Index of the TBMIndexEntry starting each record. */
+} TBMIndex;
+
+uint64_t tbmidx_hash(uint8_t const*const inBuf, const size_t len);
+int tbmidx_build(uint8_t const*const inBuf, const size_t len,
+                 TBMIndex *const idx);
+int tbmidx_write(TBMIndex const*const idx, const char path[]);
+int tbmidx_read(TBMIndex *const idx, const char path[],
+                TBMIndex const*const volume);
+int tbmidx_extract(TBMIndex const*const idx, uint8_t const*const inBuf,
+                   TBMFile *const files, TBMExtractor const*const ex);
+void tbmidx_free(TBMIndex *const idx);
+
+#endif
@@ -0,0 +1,416 @@
+/* Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Checks the CDC data conversions of cdc.cpp against known answers. The
+ * answers follow the rules of tbm2cos (t.f): i7tic for integers, nc7tc for
+ * reals, dpcasc for display code and the COSY expansion of mode 7, with
+ * values written out by hand in octal. Prints each mismatch and exits with
+ * status 1 if there were any.
+ *
+ * Build from the top directory with `make check'.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "cdc.hpp"
+
+#define NAN_PAYLOAD 01234
+
+static int numChecks = 0;
+static int numFailed = 0;
+
+/**
+ * Records one check, printing it if it failed.
+ */
+static void check(const int ok, const char what[], const uint64_t got,
+                  const uint64_t expected)
+{
+	numChecks++;
+	if (!ok) {
+		numFailed++;
+		fprintf(stderr, "Error: %s: got %016llx, expected %016llx\n", what,
+		        (unsigned long long) got, (unsigned long long) expected);
+	}
+}
+
+static void check_bits(const char what[], const uint64_t got,
+                       const uint64_t expected)
+{
+	check(got == expected, what, got, expected);
+}
+
+static void check_chars(const char what[], const char got[],
+                        const char expected[], const size_t n)
+{
+	numChecks++;
+	if (memcmp(got, expected, n)) {
+		numFailed++;
+		fprintf(stderr, "Error: %s: got \"%.*s\", expected \"%.*s\"\n", what,
+		        (int) n, got, (int) n, expected);
+	}
+}
+
+/**
+ * @return The one's complement negation of a 60-bit word.
+ */
+static uint64_t neg(const uint64_t w)
+{
+	return ~w & CDC_WORD_MASK;
+}
+
+/**
+ * Packs six-bit character codes ten to a 60-bit word, first code highest,
+ * filling out the last word with zero codes.
+ */
+static void pack_chars(const uint8_t codes[], const size_t n,
+                       uint64_t words[])
+{
+	size_t i;
+
+	memset(words, 0, sizeof(uint64_t)*((n+9)/10));
+	for (i = 0; i < n; i++) {
+		words[i/10] |= (uint64_t) (codes[i] & 077) << (54 - 6*(i%10));
+	}
+}
+
+static void check_ints(void)
+{
+	static const struct {
+		uint64_t word;
+		int64_t value;
+	} cases[] = {
+		{ 05,                   5 },
+		{ 077777777777777777772, -5 },
+		{ 0,                    0 },
+		/* i7tic adds one to the sign-extended word, so -0 becomes 0. */
+		{ 077777777777777777777, 0 },
+		{ 037777777777777777777, 576460752303423487LL },
+		{ 040000000000000000000, -576460752303423487LL }
+	};
+	const size_t n = sizeof(cases)/sizeof(cases[0]);
+	uint64_t words[16];
+	int64_t ints[16];
+	char what[64];
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		words[i] = cases[i].word;
+	}
+	cdc_ints(words, ints, n);
+	for (i = 0; i < n; i++) {
+		snprintf(what, sizeof(what), "cdc_ints(%020llo)",
+		         (unsigned long long) cases[i].word);
+		check_bits(what, (uint64_t) ints[i], (uint64_t) cases[i].value);
+	}
+}
+
+static void check_reals(void)
+{
+	static const struct {
+		uint64_t word;
+		uint64_t bits;
+	} cases[] = {
+		{ 017204000000000000000, 0x3FF0000000000000 }, /* 1.0 */
+		{ 017174000000000000000, 0x3FE0000000000000 }, /* 0.5 */
+		{ 017235000000000000000, 0x4024000000000000 }, /* 10.0 */
+		{ 000014000000000000000, 0x0300000000000000 }, /* 2^-975 */
+		/* nc7tc takes a zero exponent to mean an integer. */
+		{ 05,                    0x4014000000000000 }, /* 5 */
+		{ 0,                     0 },
+		{ 077777777777777777777, 0 },                  /* -0 */
+		{ 037770000000000000000, 0x7FF0000000000000 }, /* infinite */
+		{ 017770000000000000000, 0x7FF8000000000000 | NAN_PAYLOAD },
+		/* Unnormalized values are converted as they stand. */
+		{ 017200000000000000001, 0x3D00000000000000 }, /* 2^-47 */
+		/* The largest real that fits a double, (2^48 - 1)*2^976, and reals
+		 * beyond it, which overflow to infinity.
+		 */
+		{ 037207777777777777777, 0x7FEFFFFFFFFFFFE0 },
+		{ 037214000000000000000, 0x7FF0000000000000 }, /* 2^1024 */
+		{ 037764000000000000000, 0x7FF0000000000000 }  /* 2^1069 */
+	};
+	const size_t n = sizeof(cases)/sizeof(cases[0]);
+	uint64_t words[2*16], bits[2*16];
+	double reals[2*16];
+	char what[64];
+	size_t i, numUnnormalized, numOverflowed;
+
+	/* Each value, then its negation: the same bits with the sign set, but
+	 * for the zeros.
+	 */
+	for (i = 0; i < n; i++) {
+		words[i] = cases[i].word;
+		words[n+i] = neg(cases[i].word);
+	}
+	numUnnormalized = cdc_reals(words, reals, 2*n, NAN_PAYLOAD,
+	                            &numOverflowed);
+	memcpy(bits, reals, sizeof(double)*2*n);
+	for (i = 0; i < 2*n; i++) {
+		snprintf(what, sizeof(what), "cdc_reals(%020llo)",
+		         (unsigned long long) words[i]);
+		check_bits(what, bits[i], cases[i%n].bits |
+		           (i >= n && cases[i%n].bits ? 1ULL << 63 : 0));
+	}
+	check_bits("cdc_reals unnormalized count", numUnnormalized, 2);
+	check_bits("cdc_reals overflow count", numOverflowed, 4);
+}
+
+static void check_doubles(void)
+{
+	static const struct {
+		uint64_t upper, lower;
+		uint64_t bits;
+	} cases[] = {
+		{ 017204000000000000000, 016400000000000000000,
+		  0x3FF0000000000000 },                        /* 1.0 */
+		{ 017204000000000000000, 016404000000000000000,
+		  0x3FF0000000000010 },                        /* 1 + 2^-48 */
+		/* The 96-bit coefficient is rounded once, to nearest even. */
+		{ 017204000000000000000, 016400000000000000001,
+		  0x3FF0000000000000 },                        /* 1 + 2^-95 */
+		{ 017204000000000000000, 016400100000000000000,
+		  0x3FF0000000000000 },                        /* 1 + 2^-53 */
+		{ 017204000000000000000, 016400100000000000001,
+		  0x3FF0000000000001 },                        /* 1 + 2^-53 + 2^-95 */
+		{ 05,                    0,
+		  0x4014000000000000 },                        /* 5 */
+		{ 037770000000000000000, 0,
+		  0x7FF0000000000000 },
+		{ 017770000000000000000, 0,
+		  0x7FF8000000000000 | NAN_PAYLOAD },
+		/* The lower word rounds the largest double up to infinity. */
+		{ 037207777777777777777, 016207777777777777777,
+		  0x7FF0000000000000 },
+		{ 037764000000000000000, 0,
+		  0x7FF0000000000000 }                         /* 2^1069 */
+	};
+	const size_t n = sizeof(cases)/sizeof(cases[0]);
+	uint64_t words[4*16], bits[2*16];
+	double reals[2*16];
+	char what[64];
+	size_t i, numOverflowed;
+
+	for (i = 0; i < n; i++) {
+		words[2*i] = cases[i].upper;
+		words[2*i+1] = cases[i].lower;
+		words[2*(n+i)] = neg(cases[i].upper);
+		words[2*(n+i)+1] = neg(cases[i].lower);
+	}
+	cdc_doubles(words, reals, 2*n, NAN_PAYLOAD, &numOverflowed);
+	memcpy(bits, reals, sizeof(double)*2*n);
+	for (i = 0; i < 2*n; i++) {
+		snprintf(what, sizeof(what), "cdc_doubles(%020llo %020llo)",
+		         (unsigned long long) words[2*i],
+		         (unsigned long long) words[2*i+1]);
+		check_bits(what, bits[i], cases[i%n].bits |
+		           (i >= n ? 1ULL << 63 : 0));
+	}	check_bits("cdc_doubles overflow count", numOverflowed, 4);
+}
+
+static void check_quads(void)
+{
+	static const struct {
+		uint64_t upper, lower;
+		uint64_t hi, lo;
+	} cases[] = {
+		{ 017204000000000000000, 016400000000000000000,
+		  0x3FFF000000000000, 0 },                     /* 1.0 */
+		{ 017204000000000000000, 016404000000000000000,
+		  0x3FFF000000000001, 0 },                     /* 1 + 2^-48 */
+		/* Exact, where a double rounds. */
+		{ 017204000000000000000, 016400000000000000001,
+		  0x3FFF000000000000, 1 << 17 },               /* 1 + 2^-95 */
+		{ 05,                    0,
+		  0x4001400000000000, 0 },                     /* 5 */
+		{ 037770000000000000000, 0,
+		  0x7FFF000000000000, 0 },
+		{ 017770000000000000000, 0,
+		  0x7FFF800000000000, NAN_PAYLOAD }
+	};
+	const size_t n = sizeof(cases)/sizeof(cases[0]);
+	uint64_t words[2*16], quads[2*16], hi, lo;
+	char what[64];
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		words[2*i] = cases[i].upper;
+		words[2*i+1] = cases[i].lower;
+	}
+	cdc_quads(words, quads, n, NAN_PAYLOAD);
+	for (i = 0; i < n; i++) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+		lo = quads[2*i];
+		hi = quads[2*i+1];
+#else
+		hi = quads[2*i];
+		lo = quads[2*i+1];
+#endif
+		snprintf(what, sizeof(what), "cdc_quads(%020llo %020llo) high",
+		         (unsigned long long) words[2*i],
+		         (unsigned long long) words[2*i+1]);
+		check_bits(what, hi, cases[i].hi);
+		snprintf(what, sizeof(what), "cdc_quads(%020llo %020llo) low",
+		         (unsigned long long) words[2*i],
+		         (unsigned long long) words[2*i+1]);
+		check_bits(what, lo, cases[i].lo);
+	}
+}
+
+static void check_dpc(void)
+{
+	/* "HELLO WORLD" */
+	static const uint8_t codes[] = {
+		010, 005, 014, 014, 017, 055, 027, 017, 022, 014, 004
+	};
+	uint64_t words[2];
+	char str[16];
+
+	pack_chars(codes, sizeof(codes), words);
+	cdc_dpc_ascii(words, str, sizeof(codes));
+	check_chars("cdc_dpc_ascii", str, "HELLO WORLD", sizeof(codes));
+}
+
+static void check_bcd(void)
+{
+	/* External BCD, as on seven-track tape: "HELLO 1230+-*$/.,()=". */
+	static const uint8_t codes[] = {
+		070, 065, 043, 043, 046, 020, 001, 002, 003, 012,
+		060, 040, 054, 053, 021, 073, 033, 034, 074, 013
+	};
+	uint64_t words[2];
+	char str[24];
+
+	pack_chars(codes, sizeof(codes), words);
+	cdc_bcd_ascii(words, str, sizeof(codes));
+	check_chars("cdc_bcd_ascii", str, "HELLO 1230+-*$/.,()=", sizeof(codes));
+}
+
+static void check_ebcdic(void)
+{
+	/* Code page 037, with the cent and not signs as '[' and '^'. */
+	static const uint8_t codes[] = {
+		0xC8, 0x85, 0x93, 0x93, 0x96, 0x40, 0xF1, 0xF2, 0xF3, 0xF0,
+		0x4B, 0x6B, 0x4D, 0x5D, 0x7E, 0x5B, 0x7C, 0x4F, 0xBA, 0xBB,
+		0xC0, 0xD0, 0xE0, 0xA1, 0x79, 0x4A, 0x5F, 0x25, 0x00
+	};
+	static const char expected[] = "Hello 1230.,()=$@|[]{}\\~`[^\n";
+	char str[32];
+	int counts[128];
+	uint8_t all[256];
+	int i;
+
+	cdc_ebcdic_ascii(codes, str, sizeof(codes));
+	check_chars("cdc_ebcdic_ascii", str, expected, sizeof(codes));
+
+	/* Codes with no ASCII equivalent become SUB. */
+	all[0] = 0x9F; /* currency sign */
+	all[1] = 0x15; /* next line */
+	cdc_ebcdic_ascii(all, str, 2);
+	check_chars("cdc_ebcdic_ascii", str, "\x1A\x1A", 2);
+
+	/* Every printable ASCII character comes from exactly one code, but for
+	 * '[' and '^', which also stand for the cent and not signs.
+	 */
+	for (i = 0; i < 256; i++) {
+		all[i] = (uint8_t) i;
+	}
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < 256; i++) {
+		cdc_ebcdic_ascii(all+i, str, 1);
+		counts[(uint8_t) str[0] & 0177]++;
+	}
+	for (i = ' '; i < 0177; i++) {
+		check(counts[i] == (i == '[' || i == '^' ? 2 : 1),
+		      "cdc_ebcdic_ascii codes per character", (uint64_t) counts[i],
+		      (uint64_t) i);
+	}
+}
+
+static void check_cosy(void)
+{
+	/* "AB", two blanks (064), "C", an escaped 064 ('"'), thirty blanks
+	 * (076), "D", and the end of the card (00).
+	 */
+	static const uint8_t short_[] = {
+		001, 002, 064, 003, 077, 064, 076, 004, 000, 001
+	};
+	/* Three runs of thirty blanks overflow the card; ten blanks (074) and
+	 * twenty (075) follow t.f's table.
+	 */
+	static const uint8_t long_[] = {
+		076, 076, 001, 074, 075, 002, 076, 003
+	};
+	/* A whole word with no COSY codes, then a partial one. */
+	static const uint8_t plain[] = {
+		001, 002, 003, 004, 005, 006, 007, 010, 011, 012, 033, 034, 035
+	};
+	uint64_t words[4];
+	char card[CDC_COSY_COLUMNS+1], expected[CDC_COSY_COLUMNS+1];
+
+	pack_chars(short_, sizeof(short_), words);
+	cdc_cosy_ascii(words, card, sizeof(short_));
+	snprintf(expected, sizeof(expected), "AB  C\"%30sD%*s", "",
+	         CDC_COSY_COLUMNS - 37, "");
+	check_chars("cdc_cosy_ascii", card, expected, CDC_COSY_COLUMNS);
+
+	pack_chars(long_, sizeof(long_), words);
+	cdc_cosy_ascii(words, card, sizeof(long_));
+	snprintf(expected, sizeof(expected), "%60sA%10s%9s", "", "", "");
+	check_chars("cdc_cosy_ascii", card, expected, CDC_COSY_COLUMNS);
+
+	pack_chars(plain, sizeof(plain), words);
+	cdc_cosy_ascii(words, card, sizeof(plain));
+	snprintf(expected, sizeof(expected), "ABCDEFGHIJ012%*s",
+	         CDC_COSY_COLUMNS - 13, "");
+	check_chars("cdc_cosy_ascii", card, expected, CDC_COSY_COLUMNS);
+}
+
+int main(void)
+{
+	check_ints();
+	check_reals();
+	check_doubles();
+	check_quads();
+	check_dpc();
+	check_bcd();
+	check_ebcdic();
+	check_cosy();
+
+	if (numFailed) {
+		fprintf(stderr, "Error: %d of %d checks failed\n", numFailed,
+		        numChecks);
+		return 1;
+	}
+	printf("Info: all %d CDC conversion checks passed\n", numChecks);
+
+	return 0;
+}
@@ -0,0 +1,273 @@
+/* Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Checks the shard assignment of shard.cpp, the block checksums of
+ * verify.cpp and the .npy headers of npy.cpp against known answers. The
+ * hashes are the published FNV-1a test vectors, the checksums are also
+ * computed word by word with an end-around carry, and the headers are those
+ * numpy.save() writes. Prints each mismatch and exits with status 1 if there
+ * were any.
+ *
+ * Build from the top directory with `make check'.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "shard.hpp"
+#include "tbm.hpp"
+#include "verify.hpp"
+#include "npy.hpp"
+
+static int numChecks = 0;
+static int numFailed = 0;
+
+static void check(const int ok, const char what[], const uint64_t got,
+                  const uint64_t expected)
+{
+	numChecks++;
+	if (!ok) {
+		numFailed++;
+		fprintf(stderr, "Error: %s: got %llu, expected %llu\n", what,
+		        (unsigned long long) got, (unsigned long long) expected);
+	}
+}
+
+static void check_value(const char what[], const uint64_t got,
+                        const uint64_t expected)
+{
+	check(got == expected, what, got, expected);
+}
+
+/**
+ * Packs 12-bit bytes two to every three 8-bit bytes, as they lie in a block;
+ * an odd one out is followed by a zero.
+ *
+ * @return The length of the packed block in 8-bit bytes.
+ */
+static size_t pack_bytes(const unsigned bytes[], const size_t n,
+                         uint8_t block[])
+{
+	size_t i;
+	unsigned a, b;
+
+	for (i = 0; i < n; i += 2) {
+		a = bytes[i] & 07777;
+		b = i+1 < n ? bytes[i+1] & 07777 : 0;
+		block[3*(i/2)] = (uint8_t) (a >> 4);
+		block[3*(i/2)+1] = (uint8_t) ((a & 017) << 4 | b >> 8);
+		block[3*(i/2)+2] = (uint8_t) (b & 0377);
+	}
+
+	return 3*((n+1)/2);
+}
+
+/**
+ * The checksum of 12-bit bytes added one at a time, with end-around carry.
+ */
+static unsigned naive_checksum(const unsigned bytes[], const size_t n)
+{
+	unsigned sum = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		sum += bytes[i] & 07777;
+		if (sum > 07777) {
+			sum = (sum & 07777) + 1;
+		}
+	}
+
+	return sum;
+}
+
+static void check_shard(void)
+{
+	static const struct {
+		const char *key;
+		uint64_t hash;
+	} hashes[] = {
+		{ "",       0xCBF29CE484222325ULL },
+		{ "a",      0xAF63DC4C8601EC8CULL },
+		{ "foobar", 0x85944171F73967E8ULL }
+	};
+	/* Heaviest first, each to the lightest shard: 10 | 7, 5 | 10, 4 | 3 |
+	 * 1, for loads of 15 and 15.
+	 */
+	static const uint64_t weights[] = { 10, 7, 5, 4, 3, 1 };
+	static const char *const keys[] = { "a", "b", "c", "d", "e", "f" };
+	static const unsigned expected[] = { 0, 1, 1, 0, 1, 0 };
+	/* Equal weights go by key, "a", "b", "c", not by position. */
+	static const uint64_t tieWeights[] = { 5, 5, 5 };
+	static const char *const tieKeys[] = { "c", "a", "b" };
+	static const unsigned tieExpected[] = { 0, 0, 1 };
+	unsigned assignment[8];
+	Shard shard;
+	char what[64];
+	size_t i;
+
+	for (i = 0; i < sizeof(hashes)/sizeof(hashes[0]); i++) {
+		snprintf(what, sizeof(what), "shard_hash(\"%s\")", hashes[i].key);
+		check_value(what, shard_hash(hashes[i].key), hashes[i].hash);
+	}
+
+	shard_balance(weights, keys, 6, 2, assignment);
+	for (i = 0; i < 6; i++) {
+		snprintf(what, sizeof(what), "shard_balance unit %s", keys[i]);
+		check_value(what, assignment[i], expected[i]);
+	}
+	shard_balance(tieWeights, tieKeys, 3, 2, assignment);
+	for (i = 0; i < 3; i++) {
+		snprintf(what, sizeof(what), "shard_balance tied unit %s",
+		         tieKeys[i]);
+		check_value(what, assignment[i], tieExpected[i]);
+	}
+
+	check_value("shard_parse(\"2/4\")", shard_parse("2/4", &shard), 0);
+	check_value("shard_parse(\"2/4\") index", shard.index, 2);
+	check_value("shard_parse(\"2/4\") count", shard.count, 4);
+	check_value("shard_parse(\"4/4\")", shard_parse("4/4", &shard),
+	            (uint64_t) -1);
+	check_value("shard_parse(\"1/2x\")", shard_parse("1/2x", &shard),
+	            (uint64_t) -1);
+}
+
+static void check_checksum(void)
+{
+	static const struct {
+		const char *what;
+		unsigned bytes[5];
+		unsigned sum;
+	} cases[] = {
+		{ "1 to 5",        { 1, 2, 3, 4, 5 },                     017 },
+		/* The carry out of 07777 + 1 comes around to give 1. */
+		{ "07777 + 1",     { 07777, 1, 0, 0, 0 },                 1 },
+		{ "zeros",         { 0, 0, 0, 0, 0 },                     0 },
+		/* Never 0 unless every byte is. */
+		{ "all ones",      { 07777, 07777, 07777, 07777, 07777 }, 07777 },
+		{ "4000 + 4000",   { 04000, 04000, 0, 0, 0 },             1 }
+	};
+	/* Long enough for many rows and a ragged end. */
+	const size_t numLong = 5*1000 + 2;
+	unsigned *bytes;
+	uint8_t *block;
+	size_t len, i;
+
+	bytes = (unsigned*) malloc(sizeof(unsigned)*numLong);
+	block = (uint8_t*) malloc(3*(numLong/2+1));
+	if (!bytes || !block) {
+		fprintf(stderr, "Error: out of memory\n");
+		exit(1);
+	}
+
+	for (i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+		len = pack_bytes(cases[i].bytes, 5, block);
+		check_value(cases[i].what, tbm_block_checksum(block, len),
+		            cases[i].sum);
+		check_value(cases[i].what, naive_checksum(cases[i].bytes, 5),
+		            cases[i].sum);
+	}
+
+	for (i = 0; i < numLong; i++) {
+		bytes[i] = (unsigned) ((i*2654435761U) >> 7) & 07777;
+	}
+	len = pack_bytes(bytes, numLong, block);
+	check_value("tbm_block_checksum long block",
+	            tbm_block_checksum(block, len),
+	            naive_checksum(bytes, numLong));
+	for (i = 0; i < numLong; i++) {
+		bytes[i] = 07777;
+	}
+	len = pack_bytes(bytes, numLong, block);
+	check_value("tbm_block_checksum long block of ones",
+	            tbm_block_checksum(block, len), 07777);
+
+	free(bytes);
+	free(block);
+}
+
+static void check_npy(void)
+{
+	static const size_t shape1[] = { 3 };
+	static const size_t shape2[] = { 2, 5 };
+	static const struct {
+		const char *descr;
+		size_t const *shape;
+		int ndim;
+		const char *dict;
+	} cases[] = {
+		{ "<i8", shape1, 1,
+		  "{'descr': '<i8', 'fortran_order': False, 'shape': (3,), }" },
+		{ "<f8", shape2, 2,
+		  "{'descr': '<f8', 'fortran_order': False, 'shape': (2, 5), }" }
+	};
+	uint8_t out[256], expected[256];
+	char what[64];
+	size_t len, dictLen, i;
+
+	for (i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+		/* Version 1.0, a header length of 0166 and the dictionary, padded
+		 * with spaces to 128 bytes in all and ended by a newline.
+		 */
+		memcpy(expected, "\x93NUMPY\x01\x00\x76\x00", 10);
+		dictLen = strlen(cases[i].dict);
+		memcpy(expected+10, cases[i].dict, dictLen);
+		memset(expected+10+dictLen, ' ', 128-10-dictLen-1);
+		expected[127] = '\n';
+
+		len = npy_header(out, sizeof(out), cases[i].descr, cases[i].shape,
+		                 cases[i].ndim);
+		snprintf(what, sizeof(what), "npy_header(%s) length",
+		         cases[i].descr);
+		check_value(what, len, 128);
+		snprintf(what, sizeof(what), "npy_header(%s)", cases[i].descr);
+		check(len == 128 && !memcmp(out, expected, 128), what, 0, 0);
+	}
+
+	/* Too small a buffer is refused. */
+	check_value("npy_header short buffer",
+	            npy_header(out, 64, "<i8", shape1, 1), 0);
+}
+
+int main(void)
+{
+	check_shard();
+	check_checksum();
+	check_npy();
+
+	if (numFailed) {
+		fprintf(stderr, "Error: %d of %d checks failed\n", numFailed,
+		        numChecks);
+		return 1;
+	}
+	printf("Info: all %d library checks passed\n", numChecks);
+
+	return 0;
+}
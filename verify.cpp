@@ -0,0 +1,243 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Verification of the block control pointer checksums of a TBM archive.
+ *
+ * The checksum (LBCKS in as.s) of a data block is taken to be the 12-bit
+ * ones' complement (end-around carry) sum of the five 12-bit bytes of every
+ * 60-bit word in the block. Nothing in tbm2cos or its documentation defines
+ * the algorithm (t.f does not use the checksums), and it has not yet been
+ * checked against a real volume, so a mismatch is only grounds for a
+ * warning.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "tbm.hpp"
+#include "verify.hpp"
+
+/* Bytes summed per row by tbm_block_checksum(); a multiple of 3 and of the
+ * width of the vector registers.
+ */
+#define CHECKSUM_ROW_BYTES 48
+
+/* Rows summed before the partial sums are folded, chosen so that the 32-bit
+ * partial sums cannot overflow.
+ */
+#define CHECKSUM_CHUNK_ROWS 65536
+
+typedef struct {
+	uint8_t const *inBuf;
+	size_t blockBytes;  /* Size of a BK block in bytes. */
+	BlockCheck *checks;
+	size_t begin, end;  /* Range of `checks' handled by this worker. */
+} VerifyWork;
+
+/**
+ * Computes the checksum of a block of 60-bit words.
+ *
+ * A block always starts on a byte boundary and a 60-bit word holds exactly
+ * five 12-bit bytes, so the block is a stream of 12-bit bytes packed two to
+ * every three 8-bit bytes b0 b1 b2: (b0 << 4 | b1 >> 4) and
+ * ((b1 & 017) << 8 | b2). As 010000 is congruent to 1 modulo 07777, their sum
+ * is congruent to 16*b0 + 256*b1 + b2, which is all the end-around carry sum
+ * needs. So the 8-bit bytes need only be summed by their position modulo 3,
+ * which is done in rows of independent sums that the compiler can vectorize.
+ *
+ * @param block
+ * @param len Length of the block in bytes.
+ * @return The checksum, in the range [0, 07777].
+ */
+unsigned tbm_block_checksum(uint8_t const*const block, const size_t len)
+{
+	static const unsigned weights[3] = { 16, 256, 1 };
+	const size_t numRows = len/CHECKSUM_ROW_BYTES;
+	uint32_t rowSums[CHECKSUM_ROW_BYTES];
+	uint64_t sum = 0;
+	size_t row, end, i;
+	int k;
+
+	for (row = 0; row < numRows; row = end) {
+		end = row + CHECKSUM_CHUNK_ROWS < numRows ?
+		      row + CHECKSUM_CHUNK_ROWS : numRows;
+		memset(rowSums, 0, sizeof(rowSums));
+		for (i = row; i < end; i++) {
+			for (k = 0; k < CHECKSUM_ROW_BYTES; k++) {
+				rowSums[k] += block[i*CHECKSUM_ROW_BYTES + k];
+			}
+		}
+		for (k = 0; k < CHECKSUM_ROW_BYTES; k++) {
+			sum += (uint64_t) rowSums[k]*weights[k%3];
+		}
+	}
+	for (i = numRows*CHECKSUM_ROW_BYTES; i < len; i++) {
+		sum += block[i]*weights[i%3];
+	}
+
+	/* The end-around carry sum is zero only if every byte is zero; otherwise
+	 * a multiple of 07777 comes out as 07777.
+	 */
+	if (sum == 0) {
+		return 0;
+	}
+	sum %= 07777;
+
+	return sum ? (unsigned) sum : 07777;
+}
+
+static void *verify_worker(void *arg)
+{
+	VerifyWork *const work = (VerifyWork*) arg;
+	size_t i;
+
+	for (i = work->begin; i < work->end; i++) {
+		if (work->checks[i].actual == VERIFY_BLOCK_MISSING) {
+			continue;
+		}
+		work->checks[i].actual =
+			tbm_block_checksum(work->inBuf +
+			                   (work->checks[i].block+1)*work->blockBytes,
+			                   work->blockBytes);
+	}
+
+	return NULL;
+}
+
+/**
+ * Recomputes the checksum of every data block described by a block control
+ * pointer, dividing the blocks among `numThreads' threads, and returns the
+ * blocks whose checksums do not match.
+ *
+ * @param inBuf The whole archive.
+ * @param len Length of `inBuf' in bytes.
+ * @param syslbn_data The SYSLBN of the archive.
+ * @param numThreads
+ * @param bad Receives a list of the blocks which failed verification, which
+ *        the caller should free().
+ * @param numBad Receives the length of `bad'.
+ * @return 0 on success, or -1 if memory could not be allocated.
+ */
+int tbm_verify(uint8_t const*const inBuf, const size_t len,
+               SYSLBN_Data const*const syslbn_data, const unsigned numThreads,
+               BlockCheck **const bad, size_t *const numBad)
+{
+	const size_t blockBytes = syslbn_data->bk*BK_BLOCK_SIZE_BYTES;
+	BlockCheck *checks = NULL;
+	VerifyWork *work = NULL;
+	pthread_t *threads = NULL;
+	TBMBlock *blocks;
+	size_t numChecks, i, n;
+	unsigned t, numWorkers;
+
+	if (tbm_list_blocks(inBuf, syslbn_data, &blocks, &numChecks)) {
+		return -1;
+	}
+	if (!(checks = (BlockCheck*) malloc(sizeof(BlockCheck)*(numChecks+1)))) {
+		goto mallocfail;
+	}
+
+	/* Blocks beyond the end of the archive, or cut short by a truncated
+	 * archive, count as missing.
+	 */
+	for (i = 0; i < numChecks; i++) {
+		checks[i].block = blocks[i].block;
+		checks[i].file = blocks[i].file;
+		checks[i].expected = blocks[i].bcp.checksum;
+		checks[i].actual = 0;
+		if (checks[i].block >= syslbn_data->numBKBlocks ||
+		    (checks[i].block+2)*blockBytes > len)
+		{
+			checks[i].actual = VERIFY_BLOCK_MISSING;
+		}
+	}
+	free(blocks);
+	blocks = NULL;
+
+	numWorkers = numThreads ? numThreads : 1;
+	if (numWorkers > numChecks) {
+		numWorkers = numChecks ? numChecks : 1;
+	}
+	work = (VerifyWork*) malloc(sizeof(VerifyWork)*numWorkers);
+	threads = (pthread_t*) malloc(sizeof(pthread_t)*numWorkers);
+	if (!work || !threads) {
+		goto mallocfail;
+	}
+
+	for (t = 0; t < numWorkers; t++) {
+		work[t].inBuf = inBuf;
+		work[t].blockBytes = blockBytes;
+		work[t].checks = checks;
+		work[t].begin = numChecks*t/numWorkers;
+		work[t].end = numChecks*(t+1)/numWorkers;
+	}
+
+	/* The first share of the work is done on the calling thread. If a thread
+	 * can't be started, its share is done here too.
+	 */
+	for (t = 1; t < numWorkers; t++) {
+		if (pthread_create(&threads[t], NULL, verify_worker, &work[t])) {
+			verify_worker(&work[t]);
+			threads[t] = pthread_self();
+		}
+	}
+	verify_worker(&work[0]);
+	for (t = 1; t < numWorkers; t++) {
+		if (!pthread_equal(threads[t], pthread_self())) {
+			pthread_join(threads[t], NULL);
+		}
+	}
+
+	for (i = 0, n = 0; i < numChecks; i++) {
+		if (checks[i].actual != checks[i].expected) {
+			checks[n++] = checks[i];
+		}
+	}
+
+	free(work);
+	free(threads);
+
+	*bad = checks;
+	*numBad = n;
+
+	return 0;
+
+mallocfail:
+	free(blocks);
+	free(work);
+	free(threads);
+	free(checks);
+	return -1;
+}
@@ -0,0 +1,62 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Verification of the block control pointer checksums of a TBM archive.
+ */
+
+#ifndef VERIFY_HPP
+#define VERIFY_HPP
+
+/* Stands in for the checksum of a block which lies beyond the end of the
+ * archive; no 12-bit checksum has this value.
+ */
+#define VERIFY_BLOCK_MISSING 010000
+
+/**
+ * The checksum recorded for one data block, and the checksum of the block
+ * as it was read.
+ */
+typedef struct {
+	size_t block;      /** Data block number; block 0 follows the label buffer. */
+	int file;          /** Index of the file whose BCP describes the block. */
+	unsigned expected; /** Checksum from the block control pointer. */
+	unsigned actual;   /** Checksum computed from the block. */
+} BlockCheck;
+
+unsigned tbm_block_checksum(uint8_t const*const block, const size_t len);
+int tbm_verify(uint8_t const*const inBuf, const size_t len,
+               SYSLBN_Data const*const syslbn_data, const unsigned numThreads,
+               BlockCheck **const bad, size_t *const numBad);
+
+#endif
@@ -0,0 +1,319 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Shared on-disk cache of the decoded 60-bit words of TBM archives, so that
+ * processes reading the same archive decode it once between them.
+ *
+ * Each archive has one cache file in the cache directory, named by the size
+ * of the archive and a hash of all of its bytes (see wordcache_hash()), so
+ * the same archive under different paths shares a file, but copies which
+ * differ anywhere, even only in their data blocks, do not. A cache file holds
+ * a header and then every word of the archive in a uint64_t, and is mapped
+ * read-only.
+ *
+ * A cache file only appears, by rename(), once it is complete, so readers
+ * need no locks. Writers take an exclusive lock on a ".lock" file beside it
+ * while decoding, so that when several processes open a new archive at once
+ * one decodes it and the others wait for it and then map its result.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gbytes.cpp"
+#include "tbm.hpp"
+#include "wordcache.hpp"
+
+#define WORDCACHE_BYTE_ORDER 0x01020304
+
+/* Number of words decoded and written at a time. */
+#define WORDCACHE_CHUNK_WORDS 65536
+
+/* Number of independent sums kept by wordcache_hash(). */
+#define WORDCACHE_HASH_LANES 4
+
+/* The header is padded to keep the words 8-byte aligned. */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	uint64_t volumeSize;
+	uint64_t volumeHash;  /* From wordcache_hash(). */
+	uint64_t numWords;
+	uint64_t reserved[3];
+} WordCacheHeader;
+
+static int map_cache(WordCache *const cache, const char path[],
+                     const size_t len, const uint64_t volumeHash);
+static int write_cache(const char path[], uint8_t const*const inBuf,
+                       const size_t len, const uint64_t volumeHash);
+
+/**
+ * Hashes every byte of an archive. This reads the whole archive, but eight
+ * bytes at a time into independent sums, so it costs far less than decoding
+ * it.
+ *
+ * @param inBuf
+ * @param len Length of the archive in bytes.
+ * @return The hash.
+ */
+uint64_t wordcache_hash(uint8_t const*const inBuf, const size_t len)
+{
+	uint64_t lanes[WORDCACHE_HASH_LANES], w, hash;
+	const size_t numRows = len/(8*WORDCACHE_HASH_LANES);
+	size_t i;
+	int k;
+
+	for (k = 0; k < WORDCACHE_HASH_LANES; k++) {
+		lanes[k] = 0xCBF29CE484222325ULL + k;
+	}
+	for (i = 0; i < numRows; i++) {
+		for (k = 0; k < WORDCACHE_HASH_LANES; k++) {
+			memcpy(&w, inBuf + 8*(WORDCACHE_HASH_LANES*i + k), 8);
+			lanes[k] = (lanes[k] ^ w) * 0x9E3779B97F4A7C15ULL;
+			lanes[k] ^= lanes[k] >> 29;
+		}
+	}
+
+	hash = len;
+	for (k = 0; k < WORDCACHE_HASH_LANES; k++) {
+		hash = (hash ^ lanes[k]) * 0x100000001B3ULL;
+		hash ^= hash >> 32;
+	}
+	for (i = numRows*8*WORDCACHE_HASH_LANES; i < len; i++) {
+		hash = (hash ^ inBuf[i]) * 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+/**
+ * Maps the decoded words of an archive from the cache in `dir', decoding
+ * them into the cache first if no other process has.
+ *
+ * @param cache Receives the words; close with wordcache_close().
+ * @param dir The cache directory, which must exist.
+ * @param inBuf The archive; only read if its words are not yet cached.
+ * @param len Size of the archive in bytes.
+ * @param volumeHash wordcache_hash() of the archive, which the caller may
+ *        have kept from an earlier open.
+ * @return TBM_OK, TBM_ERR_NOMEM, or TBM_ERR_IO with errno set; `cache' is
+ *         then empty.
+ */
+int wordcache_open(WordCache *const cache, const char dir[],
+                   uint8_t const*const inBuf, const size_t len,
+                   const uint64_t volumeHash)
+{
+	char *path, *lockPath;
+	int lockFd;
+	int status;
+	int err;
+
+	memset(cache, 0, sizeof(WordCache));
+
+	if (!(path = (char*) malloc(strlen(dir) + 64)) ||
+	    !(lockPath = (char*) malloc(strlen(dir) + 64)))
+	{
+		free(path);
+		return TBM_ERR_NOMEM;
+	}
+	sprintf(path, "%s/%016llx-%llu%s", dir, (unsigned long long) volumeHash,
+	        (unsigned long long) len, WORDCACHE_SUFFIX);
+	sprintf(lockPath, "%s.lock", path);
+
+	if (!map_cache(cache, path, len, volumeHash)) {
+		status = TBM_OK;
+		goto done;
+	}
+
+	if ((lockFd = open(lockPath, O_RDWR | O_CREAT, 0666)) < 0) {
+		status = TBM_ERR_IO;
+		goto done;
+	}
+	while (flock(lockFd, LOCK_EX)) {
+		if (errno != EINTR) {
+			status = TBM_ERR_IO;
+			goto unlock;
+		}
+	}
+
+	/* Another process may have written it while we waited for the lock. */
+	status = TBM_OK;
+	if (map_cache(cache, path, len, volumeHash) &&
+	    !(status = write_cache(path, inBuf, len, volumeHash)) &&
+	    map_cache(cache, path, len, volumeHash))
+	{
+		status = TBM_ERR_IO;
+	}
+
+unlock:
+	err = errno;
+	close(lockFd);
+	errno = err;
+
+done:
+	free(path);
+	free(lockPath);
+
+	return status;
+}
+
+void wordcache_close(WordCache *const cache)
+{
+	if (cache->mapping) {
+		munmap(cache->mapping, cache->mappingLen);
+	}
+	memset(cache, 0, sizeof(WordCache));
+}
+
+/**
+ * Maps a cache file if it is complete and belongs to the archive.
+ *
+ * @return 0 if it was mapped, or 1 if not.
+ */
+static int map_cache(WordCache *const cache, const char path[],
+                     const size_t len, const uint64_t volumeHash)
+{
+	WordCacheHeader const *header;
+	const size_t numWords = (len*8)/60;
+	struct stat st;
+	void *mapping;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return 1;
+	}
+	if (fstat(fd, &st) ||
+	    (size_t) st.st_size != sizeof(WordCacheHeader) +
+	                           sizeof(uint64_t)*numWords ||
+	    (mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+	        MAP_FAILED)
+	{
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	header = (WordCacheHeader const*) mapping;
+	if (memcmp(header->magic, WORDCACHE_MAGIC, sizeof(header->magic)) ||
+	    header->version != WORDCACHE_VERSION ||
+	    header->byteOrder != WORDCACHE_BYTE_ORDER ||
+	    header->volumeSize != len ||
+	    header->volumeHash != volumeHash ||
+	    header->numWords != numWords)
+	{
+		munmap(mapping, st.st_size);
+		return 1;
+	}
+
+	cache->words = (uint64_t const*) (header+1);
+	cache->numWords = numWords;
+	cache->mapping = mapping;
+	cache->mappingLen = st.st_size;
+
+	return 0;
+}
+
+/**
+ * Decodes every word of an archive into a new cache file.
+ *
+ * @return TBM_OK, TBM_ERR_NOMEM, or TBM_ERR_IO with errno set.
+ */
+static int write_cache(const char path[], uint8_t const*const inBuf,
+                       const size_t len, const uint64_t volumeHash)
+{
+	WordCacheHeader header;
+	const size_t numWords = (len*8)/60;
+	uint64_t *words;
+	char *tmpPath;
+	FILE *fp;
+	size_t i, n;
+	int ok;
+	int err;
+
+	if (!(tmpPath = (char*) malloc(strlen(path) + 24)) ||
+	    !(words = (uint64_t*) malloc(sizeof(uint64_t)*WORDCACHE_CHUNK_WORDS)))
+	{
+		free(tmpPath);
+		return TBM_ERR_NOMEM;
+	}
+	sprintf(tmpPath, "%s.%ld", path, (long) getpid());
+
+	if (!(fp = fopen(tmpPath, "wb"))) {
+		err = errno;
+		free(tmpPath);
+		free(words);
+		errno = err;
+		return TBM_ERR_IO;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, WORDCACHE_MAGIC, sizeof(header.magic));
+	header.version = WORDCACHE_VERSION;
+	header.byteOrder = WORDCACHE_BYTE_ORDER;
+	header.volumeSize = len;
+	header.volumeHash = volumeHash;
+	header.numWords = numWords;
+
+	ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	/* Chunks start on even words, and so on byte boundaries. */
+	for (i = 0; ok && i < numWords; i += n) {
+		n = numWords-i < WORDCACHE_CHUNK_WORDS ? numWords-i
+		                                       : WORDCACHE_CHUNK_WORDS;
+		gbytes<uint8_t,uint64_t>(inBuf+(i*60)/8, words, 0, 60, 0, n);
+		ok = fwrite(words, sizeof(uint64_t), n, fp) == n;
+	}
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok || rename(tmpPath, path)) {
+		err = errno;
+		unlink(tmpPath);
+		free(tmpPath);
+		free(words);
+		errno = err;
+		return TBM_ERR_IO;
+	}
+
+	free(tmpPath);
+	free(words);
+
+	return TBM_OK;
+}
@@ -0,0 +1,63 @@
+
+/**
+ * Copyright (c) 2016, University Corporation for Atmospheric Research
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *   contributors may be used to endorse or promote products derived from this
+ *   software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * @file
+ * Shared on-disk cache of the decoded 60-bit words of TBM archives, so that
+ * processes reading the same archive decode it once between them.
+ */
+
+#ifndef WORDCACHE_HPP
+#define WORDCACHE_HPP
+
+#define WORDCACHE_MAGIC   "TBMWRD\r\n"
+#define WORDCACHE_VERSION 2
+#define WORDCACHE_SUFFIX  ".tbmwords"
+
+/**
+ * The decoded words of an archive, mapped read-only from a cache file:
+ * words[i] is the 60-bit word at bit offset 60*i of the archive.
+ */
+typedef struct {
+	uint64_t const *words;
+	size_t numWords;
+	void *mapping;     /** The whole cache file. */
+	size_t mappingLen;
+} WordCache;
+
+uint64_t wordcache_hash(uint8_t const*const inBuf, const size_t len);
+int wordcache_open(WordCache *const cache, const char dir[],
+                   uint8_t const*const inBuf, const size_t len,
+                   const uint64_t volumeHash);
+void wordcache_close(WordCache *const cache);
+
+#endif